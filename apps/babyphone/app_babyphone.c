@@ -31,16 +31,21 @@
 #include <avr/interrupt.h>
 #include <avr/eeprom.h> 
 
+#include "chime.h"
+#include "listener.h"
 #include "player.h"
 #include "recorder.h"
 
 #include "sd_raw.h"
+#include "cardmon.h"
 #include "keyboard.h"
 #include "leds.h"
 #include "slotfs.h"
 
 #include "delay.h"
-#include "LUFA/Drivers/Peripheral/SerialStream.h"
+#include "stats.h"
+#include "trace.h"
+#include "usart.h"
 
 /*****************************************************************************
 * Constants
@@ -50,14 +55,34 @@ enum state {
   STATE_RECORD_SELECT_SLOT,
   STATE_PLAYING,
   STATE_RECORDING,
+  STATE_NO_CARD,
+  STATE_LISTENING,
   
   STATE_SAME = 0xFF,
 };
 
+/* Card presence polling: every 100ms, 3 samples to debounce */
+#define CARD_POLLING_TICKS  (10)
+#define CARD_DEBOUNCING     (3)
+#define CARD_RETRY_POLLS    (5)  /* 500 ms between init attempts */
+
+/* Keyboard polling period, in Timer1 ticks */
+#define KEYBOARD_POLLING_PERIOD  (625) /* 10ms at Fclk / 256 */
+
+/* Partition of the recordings, the cries go to its slots in turn */
+#define RECORD_PARTITION  (2)
+
+/* Format of the recordings */
+#define RECORD_RATE  (8000)
+
+/* Samples within this level around the mid-scale are not written */
+#define RECORD_SPARSE_LEVEL  (3)
+
 enum event {
   EVENT_NONE,
   EVENT_END_OF_RECORD,
   EVENT_END_OF_PLAYBACK,
+  EVENT_CRY,
 };
 
 /*****************************************************************************
@@ -74,8 +99,18 @@ volatile struct {
   uint8_t key_event_flag;
   uint8_t key_event;
   
+  /* Last key pressed without a card, handled once it is mounted */
+  uint8_t pending_key;
+  
   uint8_t media_event_flag;
   uint8_t media_event;
+  
+  /* Recording a cry, listen again at the end */
+  uint8_t listening;
+  uint8_t record_slot;
+  uint8_t cry_slot;
+  
+  uint8_t ticks;
 } app;
 
 uint8_t EEMEM NonVolatilePartition; 
@@ -84,6 +119,7 @@ uint8_t EEMEM NonVolatilePartition;
 * Function prototypes
 ******************************************************************************/
 void set_next_state(uint8_t next_state);
+void update_leds(void);
 
 /*****************************************************************************
 * Functions
@@ -91,6 +127,8 @@ void set_next_state(uint8_t next_state);
 
 void stop_all(void)
 {
+  chime_stop();
+  
   switch(app.state)
   {
     case STATE_PLAYING:
@@ -100,17 +138,23 @@ void stop_all(void)
     case STATE_RECORDING:
       recorder_stop(NULL);
       break;
+      
+    case STATE_LISTENING:
+      listener_stop();
+      break;
   }
 }
 
 void init_keyboard_polling(void)
 {
-  /* Init the keyboard polling timer */
-  TCCR1B = _BV(WGM12); /* CTC mode */
+  /* Init the keyboard polling timer. It runs free, for the timestamps of
+     the statistics and of the traces, and the compare interrupt is moved
+     forward by one period at each tick */
+  TCCR1A = 0;
 
 #if (F_CPU == 16000000)
-  TCCR1B |= _BV(CS12); /* Fclk / 256 */
-  OCR1A = (uint16_t)(625 - 1); /* 100 Hz */
+  TCCR1B = _BV(CS12); /* Fclk / 256 */
+  OCR1A = TCNT1 + KEYBOARD_POLLING_PERIOD; /* 100 Hz */
 #else
 #error F_CPU not supported
 #endif
@@ -124,17 +168,18 @@ ISR(TIMER1_COMPA_vect)
 {
   uint8_t key_event;
   
+  OCR1A += KEYBOARD_POLLING_PERIOD;
+  app.ticks++;
+  
   if (!app.key_event_flag)
   {
-    PORTD |= _BV(PORTD6);
-    
     /* Capture a new keyboard event if the previous one has
        been acknowledged */
     keyboard_update(&key_event);
     
     if (key_event)
     {
-      printf("K");
+      trace(TRACE_KEY, key_event);
       app.key_event = key_event;
       app.key_event_flag = 1;
     }
@@ -145,20 +190,12 @@ void hardware_init(void)
 {
   set_sleep_mode(SLEEP_MODE_IDLE);
 
-  SerialStream_Init(38400, false);
-  
-  /* Init the sd card */
-  while(1)
-  {
-    if (sd_raw_init())
-       break;
-
-    printf_P(PSTR("MMC/SD initialization failed\n"));
-  }
+  usart_init(38400);
   
   leds_init();
   keyboard_init(2);
   init_keyboard_polling();
+  stats_init();
   
   /* Enable interrupts */
   sei();
@@ -175,39 +212,97 @@ void action_select_partition(uint8_t partition)
   /* Update the EEPROM */
   eeprom_write_byte(&NonVolatilePartition, app.partition);
     
-  printf_P(PSTR("Switch to partition %u\r\n"), app.partition);
+  trace(TRACE_PARTITION, app.partition);
 }
 
-void end_of_record(void)
+void end_of_record(void* opaque)
 {
-  printf_P(PSTR("End of record\r\n"));
+  trace(TRACE_END_OF_RECORD, 0);
 
   app.media_event = EVENT_END_OF_RECORD;
   app.media_event_flag = 1;
 }
 
-void action_start_record(uint8_t slot)
+/* The slot must hold the format of the recorder */
+uint8_t action_start_record(uint8_t slot)
 {
-  printf_P(PSTR("Start recording...\r\n"));
+  uint32_t start_block;
+  uint16_t max_content_blocks;
+  uint16_t sampling_rate = 0;
+  uint8_t codec = SLOTFS_CODEC_PCM_U8;
+  uint8_t nb_channels = 1;
+  
+  trace(TRACE_RECORD_START, slot);
+  
+  slotfs_get_slot_format(RECORD_PARTITION, slot, &sampling_rate, &codec, &nb_channels);
+  if ((codec != SLOTFS_CODEC_PCM_U8) || (nb_channels != 1) ||
+      (sampling_rate && (sampling_rate != RECORD_RATE)))
+  {
+    trace(TRACE_BAD_FORMAT, (codec << 8) | nb_channels);
+    return 0;
+  }
   
-  if (app.state != STATE_IDLE)
-    stop_all();
+  stop_all();
+  
+  /* Largest free extent of a dynamic partition, or the fixed slot */
+  if (!slotfs_allocate_slot(RECORD_PARTITION, slot))
+  {
+    trace(TRACE_CARD_FULL, slot);
+    return 0;
+  }
   
   /* Start the recording */
-  //printf("start block = %lu\r\n", get_start_block(app.bank, slot));
-  //recorder_start(get_start_block(app.bank, slot), 64, &end_of_record);
+  slotfs_get_slot_info(RECORD_PARTITION, slot, &start_block, &max_content_blocks, NULL);
+  
+  app.record_slot = slot;
+  recorder_start(start_block, max_content_blocks, &end_of_record, NULL);
+  
+  return 1;
 }
 
 void action_stop_record(void)
 {
-  //recorder_stop();
+  uint16_t nb_written_blocks;
   
-  printf("Record stopped.\r\n");
+  recorder_stop(&nb_written_blocks);
+  slotfs_update_slot_content_size(RECORD_PARTITION, app.record_slot, nb_written_blocks);
+  
+  trace(TRACE_RECORD_STOP, 0);
+}
+
+void cry_detected(void* opaque)
+{
+  trace(TRACE_CRY, 0);
+  
+  app.media_event = EVENT_CRY;
+  app.media_event_flag = 1;
+}
+
+/* The previous media must be stopped */
+void action_start_listening(void)
+{
+  trace(TRACE_LISTEN, 0);
+  
+  listener_start(&cry_detected, NULL);
+}
+
+/* Record the cry in the next slot of the record partition */
+uint8_t action_record_cry(void)
+{
+  uint8_t nb_slots = 0;
+  uint8_t slot;
+  
+  slotfs_get_partition_info(RECORD_PARTITION, NULL, &nb_slots);
+  if (app.cry_slot >= nb_slots)
+    app.cry_slot = 0;
+  
+  slot = app.cry_slot++;
+  return action_start_record(slot);
 }
 
 void end_of_playback(void)
 {
-  printf_P(PSTR("End of playback\r\n"));
+  trace(TRACE_END_OF_PLAYBACK, 0);
   
   app.media_event = EVENT_END_OF_PLAYBACK;
   app.media_event_flag = 1;
@@ -218,25 +313,27 @@ void action_start_play(uint8_t partition, uint8_t slot)
   uint32_t start_block;
   uint16_t content_blocks;
   uint16_t sampling_rate = 0;
+  uint8_t codec = SLOTFS_CODEC_PCM_U8;
+  uint8_t nb_channels = 1;
   
-  if (app.state != STATE_IDLE)
-    stop_all();
+  stop_all();
 
-  printf_P(PSTR("Play partition %u slot %u\r\n"), partition, slot);
+  trace(TRACE_PLAY, (partition << 8) | slot);
 
   /* Read content info */
-  slotfs_get_partition_info(partition, &sampling_rate, NULL);
+  slotfs_get_slot_format(partition, slot, &sampling_rate, &codec, &nb_channels);
   slotfs_get_slot_info(partition, slot, &start_block, NULL, &content_blocks);
 
-  printf_P(PSTR("Sampling rate = %u\r\n"), sampling_rate);
-  printf_P(PSTR("Start block = %lu\r\n"), start_block);
-  printf_P(PSTR("Content blocks = %u\r\n"), content_blocks);
+  trace(TRACE_PLAY_RATE, sampling_rate);
+  trace(TRACE_PLAY_BLOCKS, content_blocks);
 
-  if (content_blocks > 0)
+  if ((codec != SLOTFS_CODEC_PCM_U8) || (nb_channels != 1))
+  {
+    trace(TRACE_BAD_FORMAT, (codec << 8) | nb_channels);
+  }
+  else if (content_blocks > 0)
   {
     /* Start the playback */
-    printf_P(PSTR("Start playing...\r\n"));
-    
     player_set_option(PLAYER_OPTION_SAMPLING_RATE, sampling_rate);
     player_set_option(PLAYER_OPTION_LOOP_MODE, 0);
     
@@ -244,7 +341,7 @@ void action_start_play(uint8_t partition, uint8_t slot)
   }
   else
   {
-    printf_P(PSTR("Empty slot\r\n"));
+    trace(TRACE_EMPTY_SLOT, 0);
   }
 }
 
@@ -257,7 +354,7 @@ uint8_t handle_idle_state(void)
     if (app.key_event & EVENT_KEY_PRESSED)
     {
       uint8_t keycode = app.key_event & KEYCODE_MASK;
-      printf("P %i\r\n", keycode);
+      trace(TRACE_IDLE_KEY, keycode);
 
       switch(keycode)
       {
@@ -271,6 +368,12 @@ uint8_t handle_idle_state(void)
           next_state = STATE_SAME;
           break;
           
+        case KEYCODE_M3:
+          stop_all();
+          action_start_listening();
+          next_state = STATE_LISTENING;
+          break;
+          
         case KEYCODE_1:
         case KEYCODE_2:
         case KEYCODE_3:
@@ -328,7 +431,7 @@ uint8_t handle_record_select_slot(void)
     {
       uint8_t keycode = app.key_event & KEYCODE_MASK;
       
-      printf("R %i\r\n", keycode);
+      trace(TRACE_RECORD_KEY, keycode);
 
       switch(keycode)
       {
@@ -341,13 +444,14 @@ uint8_t handle_record_select_slot(void)
         case KEYCODE_7:
         case KEYCODE_8:
         case KEYCODE_9:
-          PORTD &= ~_BV(PORTD6);
-          action_start_record(keycode - KEYCODE_1);
-          next_state = STATE_RECORDING;
+          if (action_start_record(keycode - KEYCODE_1))
+            next_state = STATE_RECORDING;
+          else
+            next_state = STATE_IDLE;
           break;
           
         default:
-          printf("Record cancelled\r\n");
+          trace(TRACE_RECORD_CANCEL, 0);
           next_state = STATE_IDLE;
           break;
       }
@@ -363,7 +467,14 @@ uint8_t handle_recording(void)
   
   if (app.media_event_flag)
   {
-    recorder_stop(NULL);
+    action_stop_record();
+    
+    /* Wait for the next cry */
+    if (app.listening)
+    {
+      action_start_listening();
+      return STATE_LISTENING;
+    }
     return STATE_IDLE;
   }
   
@@ -372,6 +483,7 @@ uint8_t handle_recording(void)
     if (app.key_event & EVENT_KEY_RELEASED)
     {
       action_stop_record();
+      app.listening = 0;
       next_state = STATE_IDLE;
     }
   }
@@ -379,12 +491,87 @@ uint8_t handle_recording(void)
   return next_state;
 }
 
+uint8_t handle_listening_state(void)
+{
+  uint8_t next_state;
+  
+  if (app.media_event_flag && (app.media_event == EVENT_CRY))
+  {
+    /* Keep listening if the slot cannot hold the recording */
+    if (action_record_cry())
+    {
+      app.listening = 1;
+      return STATE_RECORDING;
+    }
+    return STATE_SAME;
+  }
+  
+  if (app.key_event_flag)
+  {
+    if (app.key_event & EVENT_KEY_PRESSED)
+    {
+      listener_stop();
+      
+      /* M3 again stops listening */
+      if ((app.key_event & KEYCODE_MASK) == KEYCODE_M3)
+        return STATE_IDLE;
+      
+      next_state = handle_idle_state();
+      if (next_state == STATE_SAME)
+        return STATE_IDLE;
+      return next_state;
+    }
+  }
+  
+  return STATE_SAME;
+}
+
+void handle_card_event(uint8_t card_event)
+{
+  switch(card_event)
+  {
+    case CARD_EVENT_REMOVED:
+      /* Stop the pipeline, nothing can be read or written anymore */
+      stop_all();
+      set_next_state(STATE_NO_CARD);
+      break;
+      
+    case CARD_EVENT_INSERTED:
+      /* Mount the new card */
+      if (slotfs_init())
+      {
+        set_next_state(STATE_IDLE);
+        
+        if (app.pending_key)
+        {
+          cli();
+          app.key_event = app.pending_key;
+          app.key_event_flag = 1;
+          sei();
+          app.pending_key = 0;
+        }
+      }
+      break;
+  }
+  
+  update_leds();
+}
+
+void update_leds(void)
+{
+  /* Green: card ready, red: no usable card or a cry being recorded */
+  leds_set(LED_GREEN, app.state != STATE_NO_CARD);
+  leds_set(LED_RED, ((app.state == STATE_NO_CARD) && !cardmon_is_busy()) ||
+                    ((app.state == STATE_RECORDING) && app.listening));
+}
+
 void set_next_state(uint8_t next_state)
 {
   if (next_state != STATE_SAME)
   {
-    printf("State %i => %i\r\n", app.state, next_state);
+    trace(TRACE_STATE, (app.state << 8) | next_state);
     app.state = next_state;
+    update_leds();
   }
 }
 
@@ -400,33 +587,51 @@ void init_from_eeprom(void)
 
 int application_main(void)
 {
-  hardware_init();
-
-  /* Init the filesystem */
-  slotfs_init();
-
-  /* Init the player */
-  player_init();
-
-  /* Switch on the green led */
-  leds_set(LED_GREEN, 1);
-
-  /* Init the application state */
-  app.state = STATE_IDLE;
+  uint8_t last_card_poll = 0;
+  uint8_t card_event;
+  
+  /* Init the application state, the filesystem is mounted once the
+     card is ready */
+  app.state = STATE_NO_CARD;
   app.partition = 0;
 
   app.key_event_flag = 0;
   app.key_event = 0;
+  app.pending_key = 0;
   app.media_event_flag = 0;
   app.media_event = 0;
+  app.listening = 0;
+  app.cry_slot = 0;
   
   init_from_eeprom();
 
+  /* Keyboard and DAC first */
+  hardware_init();
+
+  /* Init the player, the recordings skip the quiet buffers */
+  player_init();
+  recorder_set_option(RECORDER_OPTION_SPARSE_LEVEL, RECORD_SPARSE_LEVEL);
+
+  /* Immediate feedback while the card initializes in the background */
+  chime_start(NULL);
+  cardmon_init(CARD_DEBOUNCING, CARD_RETRY_POLLS);
+  handle_card_event(CARD_EVENT_NONE);
+
   /* Mainloop */
   while(1)
   {
     uint8_t next_state;
     
+    /* Monitor the card, only with the pin while the pipeline uses it.
+       The card init runs at each loop until it is done */
+    if (cardmon_is_busy() || ((uint8_t)(app.ticks - last_card_poll) >= CARD_POLLING_TICKS))
+    {
+      last_card_poll = app.ticks;
+      
+      cardmon_update((app.state != STATE_PLAYING) && (app.state != STATE_RECORDING), &card_event);
+      handle_card_event(card_event);
+    }
+    
     if ((app.key_event_flag) || (app.media_event_flag))
     {
       /* Handle events */
@@ -451,6 +656,17 @@ int application_main(void)
           next_state = handle_recording();
           set_next_state(next_state);
           break;
+          
+        case STATE_LISTENING:
+          next_state = handle_listening_state();
+          set_next_state(next_state);
+          break;
+          
+        case STATE_NO_CARD:
+          /* Wait for a card, keep the last key pressed meanwhile */
+          if (app.key_event_flag && (app.key_event & EVENT_KEY_PRESSED))
+            app.pending_key = app.key_event;
+          break;
       }
 
       /* Acknowledge the events */
@@ -460,6 +676,12 @@ int application_main(void)
       app.media_event = 0;
       app.media_event_flag = 0;
     }
+    
+    /* Send the traces while idle, then wait for the next interrupt */
+    trace_flush();
+    
+    if (!cardmon_is_busy())
+      sleep_mode();
   }
 
   return 0;
@@ -0,0 +1,144 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Benchmark application
+*
+* Runs the audio pipeline through each DAC sampling rate, then records and
+* listens for a cry, writing the current phase to GPIOR0 so that bench/ can
+* attribute the measured cycles. Meant to run in simavr, not on the board.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "listener.h"
+#include "player.h"
+#include "recorder.h"
+
+#include "sd_raw.h"
+#include "stats.h"
+
+#include "usart.h"
+
+#include "bench.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+static const uint16_t play_rates[] PROGMEM = { 8000, 16000, 22050, 44100 };
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+volatile uint8_t end_of_media;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void set_phase(uint8_t phase)
+{
+  GPIOR0 = phase;
+}
+
+void end_of_playback(void)
+{
+  end_of_media = 1;
+}
+
+void end_of_record(void* opaque)
+{
+  end_of_media = 1;
+}
+
+void wait_end_of_media(void)
+{
+  while (!end_of_media)
+    sleep_mode();
+}
+
+int application_main(void)
+{
+  uint8_t i;
+  
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  usart_init(38400);
+  stats_init();
+  
+  set_phase(BENCH_PHASE_IDLE);
+  
+  if (!sd_raw_init())
+  {
+    printf_P(PSTR("MMC/SD initialization failed\r\n"));
+    set_phase(BENCH_PHASE_DONE);
+    return 1;
+  }
+  
+  player_init();
+  
+  /* Playback at each rate */
+  for(i = 0; i < sizeof(play_rates) / sizeof(play_rates[0]); i++)
+  {
+    end_of_media = 0;
+    player_set_option(PLAYER_OPTION_SAMPLING_RATE, pgm_read_word(&play_rates[i]));
+    
+    set_phase(BENCH_PHASE_PLAY_8000 + i);
+    player_start(BENCH_PLAY_SECTOR, BENCH_NB_SECTORS, &end_of_playback);
+    wait_end_of_media();
+    player_stop();
+    set_phase(BENCH_PHASE_IDLE);
+  }
+  
+  /* Recording */
+  end_of_media = 0;
+  
+  set_phase(BENCH_PHASE_RECORD_8000);
+  recorder_start(BENCH_RECORD_SECTOR, BENCH_NB_SECTORS, &end_of_record, NULL);
+  wait_end_of_media();
+  recorder_stop(NULL);
+  set_phase(BENCH_PHASE_IDLE);
+  
+  /* Cry detection, on buffers of one sector as the recording */
+  set_phase(BENCH_PHASE_LISTEN_8000);
+  listener_start(NULL, NULL);
+  while (listener_get_buffers() < BENCH_NB_SECTORS)
+    sleep_mode();
+  listener_stop();
+  set_phase(BENCH_PHASE_DONE);
+  
+  printf_P(PSTR("Bench done\r\n"));
+  stats_print();
+  usart_flush();
+  
+  /* Sleeping with the interrupts disabled ends the simulation */
+  cli();
+  sleep_cpu();
+  
+  return 0;
+}
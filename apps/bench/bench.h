@@ -0,0 +1,45 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Benchmark phases, written to GPIOR0 for the simulator */
+enum {
+  BENCH_PHASE_IDLE,
+  BENCH_PHASE_PLAY_8000,
+  BENCH_PHASE_PLAY_16000,
+  BENCH_PHASE_PLAY_22050,
+  BENCH_PHASE_PLAY_44100,
+  BENCH_PHASE_RECORD_8000,
+  BENCH_PHASE_LISTEN_8000,
+  BENCH_PHASE_DONE,
+  
+  BENCH_NB_PHASES,
+};
+
+/* Blocks used on the card (sounds/babyphone.image) */
+#define BENCH_PLAY_SECTOR    (99)   /* Partition 1, slot 0 */
+#define BENCH_RECORD_SECTOR  (2948) /* Partition 2, after the journal */
+#define BENCH_NB_SECTORS     (32)
+
+#endif /* BENCH_H */
@@ -12,6 +12,7 @@
 ******************************************************************************/
 #include <stdio.h>
 #include <string.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/sleep.h>
 
@@ -27,16 +28,33 @@
 #include "slotfs.h"
 
 /* Audio */
+#include "monitor.h"
+#include "passthrough.h"
 #include "player.h"
 #include "recorder.h"
+#include "ring.h"
 
 #include "dac.h"
 #include "adc.h"
 #include "buffer.h"
+#include "interrupts.h"
 
 #include "delay.h"
+#include "stats.h"
+#include "trace.h"
 
-#include "LUFA/Drivers/Peripheral/SerialStream.h"
+#include "upload.h"
+#include "usart.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define SHELL_BAUDRATE (500000) /* Exact with U2X at 16 MHz */
+
+/* Partition of the recordings, and the one of the black box ring */
+#define RECORD_PARTITION (2)
+#define RING_PARTITION   (3)
+#define CAPTURE_RATE     (8000)
 
 /*****************************************************************************
 * Globals
@@ -44,7 +62,7 @@
 uint8_t IsPlaying = 0;
 uint8_t IsRecording = 0;
 
-char keycode2char[] =
+const char keycode2char[] PROGMEM =
 {
   0,
   '1',
@@ -80,7 +98,7 @@ uint32_t strtolong(const char* str);
 
 void buffer_event(void)
 {
-  printf("B");
+  trace(TRACE_BUFFER_EVENT, empty_buffer_flag | buffer_full_flag);
   
   /* Acknowledge the event */
   empty_buffer_flag = 0;
@@ -91,8 +109,14 @@ void end_of_playback(void)
 {
   printf_P(PSTR("End of playback\r\n"));
   
+  if (player_get_read_errors())
+    printf_P(PSTR("Read errors = %u\r\n"), player_get_read_errors());
+  
   player_stop();
   IsPlaying = 0;
+  
+  if (!IsRecording)
+    buffer_set_duplex(0);
 }
 
 void play(uint32_t start_sector, uint16_t nb_sectors)
@@ -113,6 +137,8 @@ void play_slot(uint8_t partition, uint8_t slot)
   uint32_t start_block;
   uint16_t content_blocks;
   uint16_t sampling_rate = 0;
+  uint8_t codec = SLOTFS_CODEC_PCM_U8;
+  uint8_t nb_channels = 1;
 
   if (IsPlaying)
     player_stop();
@@ -120,14 +146,18 @@ void play_slot(uint8_t partition, uint8_t slot)
   IsPlaying = 1;
 
   /* Read content info */
-  slotfs_get_partition_info(partition, &sampling_rate, NULL);
+  slotfs_get_slot_format(partition, slot, &sampling_rate, &codec, &nb_channels);
   slotfs_get_slot_info(partition, slot, &start_block, NULL, &content_blocks);
 
-  printf("Sampling rate = %u\r\n", sampling_rate);
-  printf("Start block = %lu\r\n", start_block);
-  printf("Content blocks = %u\r\n", content_blocks);
+  printf_P(PSTR("Sampling rate = %u\r\n"), sampling_rate);
+  printf_P(PSTR("Start block = %lu\r\n"), start_block);
+  printf_P(PSTR("Content blocks = %u\r\n"), content_blocks);
 
-  if (content_blocks > 0)
+  if ((codec != SLOTFS_CODEC_PCM_U8) || (nb_channels != 1))
+  {
+    printf_P(PSTR("Unsupported format: codec %u, %u channels\r\n"), codec, nb_channels);
+  }
+  else if (content_blocks > 0)
   {
     /* Start the playback */
     printf_P(PSTR("Start playing...\r\n"));
@@ -147,15 +177,21 @@ void end_of_record(void* opaque)
 {
   uint16_t nb_written_blocks;
   
-  printf_P(PSTR("End of record slot %i\r\n"), (uint8_t)opaque);
+  printf_P(PSTR("End of record slot %i\r\n"), (uint8_t)(uintptr_t)opaque);
   
   recorder_stop(&nb_written_blocks);
   IsRecording = 0;
   
-  printf("Written blocks = %u\r\n", nb_written_blocks);
+  if (!IsPlaying)
+    buffer_set_duplex(0);
+  
+  printf_P(PSTR("Written blocks = %u\r\n"), nb_written_blocks);
+  
+  if (recorder_get_write_errors())
+    printf_P(PSTR("Write errors = %u\r\n"), recorder_get_write_errors());
   
   /* Update the slot header */
-  slotfs_update_slot_content_size(2, (uint8_t)opaque, nb_written_blocks);
+  slotfs_update_slot_content_size(2, (uint8_t)(uintptr_t)opaque, nb_written_blocks);
 }
 
 void record(uint32_t start_sector, uint16_t nb_sectors)
@@ -176,6 +212,8 @@ void record_slot(uint8_t slot)
   uint32_t start_block;
   uint16_t max_content_blocks;
   uint16_t sampling_rate = 0;
+  uint8_t codec = SLOTFS_CODEC_PCM_U8;
+  uint8_t nb_channels = 1;
   
   uint8_t partition = 2;
 
@@ -184,25 +222,136 @@ void record_slot(uint8_t slot)
   
   IsRecording = 1;
 
-  /* Read content position and max size */
-  slotfs_get_partition_info(partition, &sampling_rate, NULL);
+  /* The recorder writes 8-bit mono at the capture rate */
+  slotfs_get_slot_format(partition, slot, &sampling_rate, &codec, &nb_channels);
+  if ((codec != SLOTFS_CODEC_PCM_U8) || (nb_channels != 1) ||
+      (sampling_rate && (sampling_rate != CAPTURE_RATE)))
+  {
+    printf_P(PSTR("Unsupported format: codec %u, %u channels, %u Hz\r\n"), codec, nb_channels, sampling_rate);
+    IsRecording = 0;
+    return;
+  }
+
+  /* Read content position and max size, from the largest free extent of a dynamic partition */
+  if (!slotfs_allocate_slot(partition, slot))
+  {
+    printf_P(PSTR("No free blocks for slot %u\r\n"), slot);
+    IsRecording = 0;
+    return;
+  }
   slotfs_get_slot_info(partition, slot, &start_block, &max_content_blocks, NULL);
 
-  printf("Sampling rate = %u\r\n", sampling_rate);
-  printf("Start block = %lu\r\n", start_block);
-  printf("Max content blocks = %u\r\n", max_content_blocks);
+  printf_P(PSTR("Sampling rate = %u\r\n"), sampling_rate);
+  printf_P(PSTR("Start block = %lu\r\n"), start_block);
+  printf_P(PSTR("Max content blocks = %u\r\n"), max_content_blocks);
 
   if (max_content_blocks > 0)
   {
     /* Start the recording */
     printf_P(PSTR("Start recording...\r\n"));
 
-    recorder_start(start_block, max_content_blocks, &end_of_record, (void*)slot);
+    recorder_start(start_block, max_content_blocks, &end_of_record, (void*)(uintptr_t)slot);
   }
   else
   {
     printf_P(PSTR("No blocks in slot\r\n"));
+    IsRecording = 0;
+  }
+}
+
+/* Region of the black box recording: its own partition after the header,
+   away from the slots of the recordings */
+uint8_t get_ring(t_ring* ring)
+{
+  uint32_t start_block, nb_blocks;
+  
+  if (slotfs_get_nb_partitions() <= RING_PARTITION)
+    return 0;
+  
+  slotfs_get_partition_area(RING_PARTITION, &start_block, &nb_blocks);
+  
+  return ring_init(ring, start_block, nb_blocks);
+}
+
+void end_of_ring(void* opaque)
+{
+  printf_P(PSTR("Ring recording stopped\r\n"));
+  
+  recorder_stop(NULL);
+  IsRecording = 0;
+  
+  if (!IsPlaying)
+    buffer_set_duplex(0);
+  
+  if (recorder_get_write_errors())
+    printf_P(PSTR("Write errors = %u\r\n"), recorder_get_write_errors());
+}
+
+void record_ring(void)
+{
+  t_ring ring;
+  
+  if (IsRecording)
+    recorder_stop(NULL);
+  IsRecording = 0;
+  
+  if (!get_ring(&ring))
+  {
+    printf_P(PSTR("No room for a ring\r\n"));
+    return;
+  }
+  
+  printf_P(PSTR("Ring of %u chunks of %u sectors\r\n"), ring.nb_chunks, RING_AUDIO_SECTORS);
+  
+  /* Goes on until stopped, the next ring recording resumes after it */
+  IsRecording = 1;
+  recorder_set_option(RECORDER_OPTION_LOOP_MODE, 1);
+  recorder_start(ring.start_sector, ring.nb_chunks * RING_CHUNK_SECTORS, &end_of_ring, NULL);
+  recorder_set_option(RECORDER_OPTION_LOOP_MODE, 0);
+}
+
+/* Play the newest seconds of the ring */
+void play_last(uint16_t seconds)
+{
+  t_ring ring;
+  t_ring_head head;
+  uint32_t address;
+  uint32_t nb_sectors;
+  
+  if (IsPlaying)
+    player_stop();
+  
+  if (!get_ring(&ring) || !ring_find_head(&ring, &head))
+  {
+    printf_P(PSTR("Empty ring\r\n"));
+    return;
+  }
+  
+  nb_sectors = ring_get_last(&ring, &head, ((uint32_t)seconds * CAPTURE_RATE + 511) >> 9, &address);
+  printf_P(PSTR("Newest chunk %u seq %lu, %lu sectors from %lu\r\n"), head.chunk, head.seq, nb_sectors, address >> 9);
+  
+  IsPlaying = 1;
+  player_set_option(PLAYER_OPTION_SAMPLING_RATE, CAPTURE_RATE);
+  player_set_option(PLAYER_OPTION_LOOP_MODE, 0);
+  player_start_ring(&ring, address, nb_sectors, &end_of_playback);
+}
+
+/* Release the audio buffers */
+void stop_audio(void)
+{
+  if (IsPlaying)
+  {
+    player_stop();
+    IsPlaying = 0;
+  }
+  
+  if (IsRecording)
+  {
+    recorder_stop(NULL);
+    IsRecording = 0;
   }
+  
+  buffer_set_duplex(0);
 }
 
 void fill(uint32_t start_sector, uint16_t nb_sectors)
@@ -236,12 +385,13 @@ void erase(uint32_t start_sector, uint16_t nb_sectors)
   printf_P(PSTR("End of erasing (%i)\r\n"), res);
 }
 
-int application_main()
+int application_main(void)
 {
     /* we will just use ordinary idle mode */
     set_sleep_mode(SLEEP_MODE_IDLE);
 
-    SerialStream_Init(38400, false);
+    usart_init(SHELL_BAUDRATE);
+    stats_init();
 
     while(1)
     {
@@ -262,15 +412,38 @@ int application_main()
 
         /* provide a simple shell */
         char buffer[24];
+        uint8_t prompt = 1;
         while(1)
         {
-            /* print prompt */
-            uart_putc('>');
-            uart_putc(' ');
+            if(prompt)
+            {
+                /* send the traces of the last command, and print prompt */
+                trace_flush();
+                uart_putc('>');
+                uart_putc(' ');
+                prompt = 0;
+            }
 
-            /* read command */
+            /* read command, sleeping between the received bytes so that
+               the audio keeps running */
             char* command = buffer;
-            if(read_line(command, sizeof(buffer)) < 1)
+            if(!read_line(command, sizeof(buffer)))
+            {
+                /* a byte received after read_line() wakes us up at once */
+                cli();
+                if(!usart_rx_available())
+                {
+                    sleep_enable();
+                    sei();
+                    sleep_cpu();
+                    sleep_disable();
+                }
+                sei();
+                continue;
+            }
+
+            prompt = 1;
+            if(command[0] == '\0')
                 continue;
 
             /* execute command */
@@ -308,7 +481,7 @@ int application_main()
             }
             else if(strncmp_P(command, PSTR("adc"), 3) == 0)
             {
-              set_buffer_event_handler(&buffer_event);
+              set_buffer_event_handler(STREAM_CAPTURE, &buffer_event);
             
               adc_init(0);
               adc_start(&pcm_buffer[0], &pcm_buffer[PCM_BUFFER_SIZE], PCM_BUFFER_SIZE);
@@ -326,6 +499,49 @@ int application_main()
               uint32_t slot = strtolong(command);
               record_slot((uint8_t)slot);
             }
+            else if(strncmp_P(command, PSTR("delslot "), 8) == 0)
+            {
+              /* Free the blocks of a slot of the record partition */
+              stop_audio();
+              slotfs_delete_slot(RECORD_PARTITION, (uint8_t)strtolong(command + 8));
+            }
+            else if(strncmp_P(command, PSTR("preroll "), 8) == 0)
+            {
+              /* Recording kept before the voice activity trigger, up to
+                 one capture buffer */
+              uint32_t preroll_ms = strtolong(command + 8);
+              if(preroll_ms > RECORDER_MAX_PREROLL_MS)
+                printf_P(PSTR("Pre-roll above %u ms\r\n"), RECORDER_MAX_PREROLL_MS);
+              else
+                recorder_set_option(RECORDER_OPTION_PREROLL_MS, preroll_ms);
+            }
+            else if(strncmp_P(command, PSTR("autostop "), 9) == 0)
+            {
+              /* Silence which ends a recording, 0 to record the whole slot */
+              recorder_set_option(RECORDER_OPTION_AUTO_STOP_MS, strtolong(command + 9));
+            }
+            else if(strncmp_P(command, PSTR("sparse "), 7) == 0)
+            {
+              /* Quiet level of the samples not written, 0 to write them all */
+              recorder_set_option(RECORDER_OPTION_SPARSE_LEVEL, strtolong(command + 7));
+            }
+            else if(strncmp_P(command, PSTR("eraseunused "), 12) == 0)
+            {
+              /* Erase the end of the slot after a recording, 0 to leave it */
+              recorder_set_option(RECORDER_OPTION_ERASE_UNUSED, strtolong(command + 12));
+            }
+            else if(strncmp_P(command, PSTR("ring\0"), 5) == 0)
+            {
+              /* Black box: record the last minutes over the ring partition */
+              stop_audio();
+              record_ring();
+            }
+            else if(strncmp_P(command, PSTR("last "), 5) == 0)
+            {
+              /* Play the last seconds of the ring, once stopped */
+              stop_audio();
+              play_last((uint16_t)strtolong(command + 5));
+            }
             else if(strncmp_P(command, PSTR("erase"), 5) == 0)
             {
               erase(0, 64);
@@ -347,6 +563,106 @@ int application_main()
               uint32_t slot = strtolong(command);
               play_slot(1, (uint8_t)slot);
             }
+            else if(strncmp_P(command, PSTR("duplex "), 7) == 0)
+            {
+              /* duplex <playback slot> <record slot> */
+              uint16_t sampling_rate = 0;
+
+              command += 7;
+              char* slot = strchr(command, ' ');
+              if(!slot)
+                continue;
+
+              /* The capture runs on a divided playback tick */
+              slotfs_get_slot_format(1, (uint8_t)strtolong(command), &sampling_rate, NULL, NULL);
+              if(sampling_rate % 8000)
+              {
+                printf_P(PSTR("Playback rate %u is not a multiple of 8000\r\n"), sampling_rate);
+                continue;
+              }
+
+              stop_audio();
+              buffer_set_duplex(1);
+              play_slot(1, (uint8_t)strtolong(command));
+              
+              /* The slot lookup uses the card under the playback refills */
+              buffer_event_hold();
+              record_slot((uint8_t)strtolong(slot + 1));
+              buffer_event_release();
+            }
+            else if(strncmp_P(command, PSTR("upload "), 7) == 0)
+            {
+              /* upload <partition> <slot> [number of frames] */
+              command += 7;
+              char* slot = strchr(command, ' ');
+              if(!slot)
+                continue;
+              char* nb_frames = strchr(slot + 1, ' ');
+
+              /* The upload receives into the audio buffers */
+              stop_audio();
+              upload_slot((uint8_t)strtolong(command), (uint8_t)strtolong(slot + 1),
+                          nb_frames ? (uint16_t)strtolong(nb_frames + 1) : 0);
+            }
+            else if(strncmp_P(command, PSTR("listen"), 6) == 0)
+            {
+              /* listen [gain in 1/16] [gate threshold] */
+              uint8_t c;
+              char* arg = strchr(command, ' ');
+
+              stop_audio();
+              passthrough_start(8000);
+              if(arg)
+              {
+                passthrough_set_gain((uint8_t)strtolong(arg + 1));
+                arg = strchr(arg + 1, ' ');
+                if(arg)
+                  passthrough_set_gate((uint8_t)strtolong(arg + 1));
+              }
+              printf_P(PSTR("Listening, any key to stop\r\n"));
+
+              while(!usart_getc(&c))
+              {
+                cli();
+                if(!usart_rx_available())
+                {
+                    sleep_enable();
+                    sei();
+                    sleep_cpu();
+                    sleep_disable();
+                }
+                sei();
+              }
+              passthrough_stop();
+            }
+            else if(strncmp_P(command, PSTR("monitor\0"), 8) == 0)
+            {
+              uint8_t c;
+
+              stop_audio();
+              printf_P(PSTR("Monitoring, any key to stop\r\n"));
+              usart_flush();
+
+              /* Stream the microphone until a byte is received */
+              monitor_start();
+              while(!usart_getc(&c))
+              {
+                monitor_poll();
+
+                cli();
+                if(!usart_rx_available())
+                {
+                    sleep_enable();
+                    sei();
+                    sleep_cpu();
+                    sleep_disable();
+                }
+                sei();
+              }
+              monitor_stop();
+
+              printf_P(PSTR("\r\nEnd of monitoring, %u frames dropped\r\n"), monitor_get_drops());
+            }
             else if(strncmp_P(command, PSTR("ls\0"), 3) == 0)
             {
               /* Display the partitions content */
@@ -378,12 +694,24 @@ int application_main()
                 for(j = 0; j< nb_slots; j++)
                 {
                   slotfs_get_slot_info(i, j, &start_block, &max_content_blocks, &nb_content_blocks);
+                  slotfs_get_slot_format(i, j, &sampling_rate, NULL, NULL);
 
-                  printf("Slot %02i: %4lu ", j, start_block);
-                  printf("%u/%u\r\n", nb_content_blocks, max_content_blocks);
+                  printf_P(PSTR("Slot %02i: %4lu "), j, start_block);
+                  printf_P(PSTR("%u/%u"), nb_content_blocks, max_content_blocks);
+                  if (sampling_rate)
+                    printf_P(PSTR(" %u Hz"), sampling_rate);
+                  printf_P(PSTR("\r\n"));
                 }
               }
             }
+            else if(strncmp_P(command, PSTR("stats reset"), 11) == 0)
+            {
+              stats_reset();
+            }
+            else if(strncmp_P(command, PSTR("stats\0"), 6) == 0)
+            {
+              stats_print();
+            }
             else if(strncmp_P(command, PSTR("kbd\0"), 4) == 0)
             {
               /* Matrix keyboad test loop */
@@ -398,10 +726,10 @@ int application_main()
                 keyboard_update(&event);
 
                 if (event & EVENT_KEY_PRESSED)
-                  printf("P %i %c\r\n", event & KEYCODE_MASK, keycode2char[event & KEYCODE_MASK]);
+                  printf_P(PSTR("P %i %c\r\n"), event & KEYCODE_MASK, pgm_read_byte(&keycode2char[event & KEYCODE_MASK]));
 
                 if (event & EVENT_KEY_RELEASED)
-                  printf(" R %i\r\n", event & KEYCODE_MASK);
+                  printf_P(PSTR(" R %i\r\n"), event & KEYCODE_MASK);
 
                 event = 0;
               }
@@ -435,14 +763,23 @@ int application_main()
     return 0;
 }
 
+/* Non-blocking line editor: consumes the received bytes and returns 1 once
+   a whole line is in buffer, 0 while it is still being typed */
 uint8_t read_line(char* buffer, uint8_t buffer_length)
 {
-    memset(buffer, 0, buffer_length);
+    static uint8_t read_length = 0;
+    uint8_t c;
+
+    if(read_length == 0)
+        memset(buffer, 0, buffer_length);
 
-    uint8_t read_length = 0;
     while(read_length < buffer_length - 1)
     {
-        uint8_t c = uart_getc();
+        if(!usart_getc(&c))
+            return 0;
+
+        if(c == '\r')
+            c = '\n';
 
         if(c == 0x08 || c == 0x7f)
         {
@@ -473,7 +810,9 @@ uint8_t read_line(char* buffer, uint8_t buffer_length)
         }
     }
 
-    return read_length;
+    /* whole line, or buffer full */
+    read_length = 0;
+    return 1;
 }
 
 uint32_t strtolong(const char* str)
@@ -113,7 +113,7 @@ void uart_puts_p(PGM_P str)
 
 uint8_t uart_getc()
 {
-    uint8_t b = fgetc(stdout);
+    uint8_t b = fgetc(stdin);
     if(b == '\r')
         b = '\n';
 
@@ -0,0 +1,312 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Slot upload over the serial port
+*
+* XMODEM-1K style frames, one SD block each:
+*   STX seq ~seq data[512] crc_hi crc_lo
+* with the CRC-16 of XMODEM over the data. The receive interrupt parses the
+* frames straight into two block buffers, pcm_buffer and the block cache
+* of sd_raw which the multiple block write leaves idle, while the main loop
+* streams the previous block to the card, so the sender keeps two frames
+* in flight and the line never idles.
+*
+* Replies, two bytes each:
+*   ACK seq        blocks up to seq written, the sender may send more
+*   NAK seq        frame corrupted, resend from seq
+*   CAN 0          upload aborted by the receiver
+* A frame received again after a lost ACK is acknowledged again, as with
+* XMODEM, once the blocks before it are written.
+* The sender ends with EOT once all the frames are acknowledged, the
+* receiver then updates the slot length and acknowledges the EOT. CAN from
+* the sender aborts the upload.
+*
+* A slot of a dynamic partition gets the largest free extent before the
+* upload, if it holds the announced number of blocks, and is trimmed to
+* the blocks received.
+*
+* tools/upload.py is the host side.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+#include "buffer.h"
+#include "delay.h"
+#include "sd_raw.h"
+#include "slotfs.h"
+#include "usart.h"
+
+#include "upload.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define UPLOAD_STX (0x02)
+#define UPLOAD_EOT (0x04)
+#define UPLOAD_ACK (0x06)
+#define UPLOAD_NAK (0x15)
+#define UPLOAD_CAN (0x18)
+
+#define UPLOAD_BLOCK_SIZE   (512)
+#define UPLOAD_POLL_US      (100)
+#define UPLOAD_TIMEOUT_POLL (30000) /* 3 s without a frame */
+
+#if (2 * PCM_BUFFER_SIZE < UPLOAD_BLOCK_SIZE)
+#error "pcm_buffer does not hold a block"
+#endif
+
+enum {
+  FRAME_START,
+  FRAME_SEQ,
+  FRAME_NSEQ,
+  FRAME_DATA,
+  FRAME_CRC_HI,
+  FRAME_CRC_LO,
+};
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static volatile struct {
+  /* Frame parser, in the receive interrupt */
+  uint8_t state;
+  uint8_t seq;
+  uint8_t discard;
+  uint16_t pos;
+  uint16_t crc;
+  uint16_t frame_crc;
+  
+  /* Next frame to store, and the buffer receiving it */
+  uint8_t expected;
+  uint8_t half;
+  uint8_t* block[2];
+  
+  /* Events for the main loop */
+  uint8_t full[2];
+  uint8_t nak;
+  uint8_t duplicate;
+  uint8_t end;
+} upload;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void upload_rx(uint8_t c);
+static void upload_reply(uint8_t code, uint8_t seq);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+uint8_t upload_slot(uint8_t partition, uint8_t slot, uint16_t nb_frames)
+{
+  uint32_t start_block;
+  uint16_t max_content_blocks = 0;
+  uint16_t nb_blocks = 0;
+  uint16_t idle = 0;
+  uint8_t nb_slots = 0;
+  uint8_t half = 0;
+  uint8_t error = 0;
+  
+  if (partition < slotfs_get_nb_partitions())
+    slotfs_get_partition_info(partition, NULL, &nb_slots);
+  
+  if ((slot < nb_slots) && slotfs_allocate_slot(partition, slot))
+    slotfs_get_slot_info(partition, slot, &start_block, &max_content_blocks, NULL);
+  
+  if ((max_content_blocks == 0) || (max_content_blocks < nb_frames))
+  {
+    printf_P(PSTR("No blocks in slot for %u frames\r\n"), nb_frames);
+    if ((slot < nb_slots) && slotfs_is_dynamic(partition))
+      slotfs_delete_slot(partition, slot);
+    return 0;
+  }
+  
+  if (!sd_raw_write_blocks_start(start_block))
+  {
+    printf_P(PSTR("Write error\r\n"));
+    return 0;
+  }
+  
+  memset((void*)&upload, 0x00, sizeof(upload));
+  upload.block[0] = pcm_buffer;
+  upload.block[1] = sd_raw_write_blocks_buffer();
+  printf_P(PSTR("Upload ready, %u blocks max\r\n"), max_content_blocks);
+  usart_flush();
+  usart_set_rx_handler(&upload_rx);
+  
+  while (1)
+  {
+    if (upload.full[half])
+    {
+      /* Stream the block, the other half keeps receiving */
+      if ((nb_blocks == max_content_blocks)
+        || !sd_raw_write_blocks_next(upload.block[half]))
+      {
+        error = 1;
+        break;
+      }
+      
+      upload.full[half] = 0;
+      half ^= 1;
+      upload_reply(UPLOAD_ACK, (uint8_t)nb_blocks++);
+      idle = 0;
+    }
+    else if (upload.nak)
+    {
+      upload.nak = 0;
+      upload_reply(UPLOAD_NAK, upload.expected);
+    }
+    else if (upload.duplicate)
+    {
+      /* Our ACK was lost: acknowledge the written blocks again, the ones
+         still in the buffers are acknowledged once written */
+      upload.duplicate = 0;
+      if (nb_blocks && ((uint8_t)nb_blocks == upload.expected))
+        upload_reply(UPLOAD_ACK, (uint8_t)(nb_blocks - 1));
+      idle = 0;
+    }
+    else if (upload.end)
+    {
+      break;
+    }
+    else if (++idle == UPLOAD_TIMEOUT_POLL)
+    {
+      error = 1;
+      break;
+    }
+    else
+    {
+      delay_us(UPLOAD_POLL_US);
+    }
+  }
+  
+  usart_set_rx_handler(NULL);
+  
+  if (!sd_raw_write_blocks_stop())
+    error = 1;
+  
+  /* The slot holds what was written, even if the upload did not end. The
+     extent of a dynamic slot is trimmed to it */
+  if (nb_blocks || slotfs_is_dynamic(partition))
+    slotfs_update_slot_content_size(partition, slot, nb_blocks);
+  
+  if (error || (upload.end != UPLOAD_EOT))
+  {
+    if (error)
+      upload_reply(UPLOAD_CAN, 0);
+    usart_flush();
+    printf_P(PSTR("Upload aborted after %u blocks\r\n"), nb_blocks);
+    return 0;
+  }
+  
+  upload_reply(UPLOAD_ACK, (uint8_t)nb_blocks);
+  usart_flush();
+  printf_P(PSTR("Uploaded %u blocks\r\n"), nb_blocks);
+  
+  return 1;
+}
+
+static void upload_reply(uint8_t code, uint8_t seq)
+{
+  usart_putc(code);
+  usart_putc(seq);
+}
+
+/* Receive interrupt: one byte of the frame stream */
+static void upload_rx(uint8_t c)
+{
+  switch (upload.state)
+  {
+    case FRAME_START:
+      if (c == UPLOAD_STX)
+        upload.state = FRAME_SEQ;
+      else if ((c == UPLOAD_EOT) || (c == UPLOAD_CAN))
+        upload.end = c;
+      break;
+      
+    case FRAME_SEQ:
+      upload.seq = c;
+      upload.state = FRAME_NSEQ;
+      break;
+      
+    case FRAME_NSEQ:
+      if (c != (uint8_t)~upload.seq)
+      {
+        /* Not a frame header, hunt for the next one */
+        upload.state = FRAME_START;
+        break;
+      }
+      
+      /* Frames after a corrupted one, or beyond the two in flight, are
+         dropped and sent again */
+      upload.discard = (upload.seq != upload.expected) || upload.full[upload.half];
+      upload.pos = 0;
+      upload.crc = 0;
+      upload.state = FRAME_DATA;
+      break;
+      
+    case FRAME_DATA:
+      if (!upload.discard)
+        upload.block[upload.half][upload.pos] = c;
+      upload.crc = _crc_xmodem_update(upload.crc, c);
+      if (++upload.pos == UPLOAD_BLOCK_SIZE)
+        upload.state = FRAME_CRC_HI;
+      break;
+      
+    case FRAME_CRC_HI:
+      upload.frame_crc = (uint16_t)c << 8;
+      upload.state = FRAME_CRC_LO;
+      break;
+      
+    case FRAME_CRC_LO:
+      upload.state = FRAME_START;
+      if (upload.discard)
+      {
+        /* One of the two frames in flight before the expected one */
+        if ((uint8_t)(upload.expected - upload.seq - 1) < 2)
+          upload.duplicate = 1;
+        break;
+      }
+      
+      if ((upload.frame_crc | c) == upload.crc)
+      {
+        upload.full[upload.half] = 1;
+        upload.half ^= 1;
+        upload.expected++;
+      }
+      else
+      {
+        upload.nak = 1;
+      }
+      break;
+  }
+}
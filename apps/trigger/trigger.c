@@ -34,7 +34,7 @@
 
 #include "delay.h"
 #include "sd_raw.h"
-#include "LUFA/Drivers/Peripheral/SerialStream.h"
+#include "usart.h"
 
 /*****************************************************************************
 * Constants
@@ -138,7 +138,7 @@ int application_main(void)
 {
   set_sleep_mode(SLEEP_MODE_IDLE);
 
-  SerialStream_Init(38400, false);
+  usart_init(38400);
   
   /* Init the sd card */
   while(1)
@@ -22,7 +22,7 @@
 
 /*****************************************************************************
 * Hardware resources used:
-*   Timer0 A & B interrupts
+*   Timer0 A & B interrupts, Timer0 compare A as the ADC trigger
 *   ATmega32U4: ADC input ADC0 (PF0)
 *   ATmega328P: ADC input ADC0 (PC0)
 ******************************************************************************/
@@ -37,7 +37,11 @@
 #include <avr/pgmspace.h>
 
 #include "adc.h"
+#include "buffer.h"
 #include "interrupts.h"
+#include "stats.h"
+#include "trace.h"
+#include "vad.h"
 
 /*****************************************************************************
 * Definitions
@@ -51,8 +55,29 @@ static struct {
   uint8_t* read_ptr;
   uint8_t* end_ptr;
   uint8_t  current_buffer;
-  uint8_t  threshold;
   uint8_t  triggered;
+  uint8_t  wrapped;
+  uint8_t  discard;
+  uint16_t size;
+  
+  /* Voice activity detection */
+  uint8_t  vad;
+  uint8_t  vad_count;
+  uint16_t vad_sum;
+  uint16_t stop_blocks;
+  uint8_t  last;
+  uint8_t  ended;
+  
+  /* Pre-roll: samples before the trigger committed with the recording */
+  uint16_t preroll;
+  uint16_t skip;
+  uint8_t  queued_flag;
+  
+  /* Data of the buffer full events */
+  uint8_t* full_start;
+  uint16_t full_length;
+  uint8_t* preroll_start;
+  uint16_t preroll_length;
 } adc;
 
 /*****************************************************************************
@@ -62,6 +87,11 @@ t_adc_buffer adc_buffer_pool[2];
 
 volatile uint8_t buffer_full_flag;
 
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void adc_trigger(void);
+
 /*****************************************************************************
 * Functions
 ******************************************************************************/
@@ -73,11 +103,14 @@ void adc_init(uint8_t vad)
   PORTB &= ~_BV(PORTB0);
 
   /* Init the context */
-  adc.threshold = 64;
+  adc.vad = vad;
   adc.triggered = 0;
   
   if (!vad)
     adc.triggered = 1; /* Voice activity detection */
+  
+  adc.stop_blocks = 0;
+  adc.preroll = 0;
 
   /* Init the buffer pool */
   memset(adc_buffer_pool, 0x00, sizeof(adc_buffer_pool));
@@ -90,10 +123,24 @@ void adc_shutdown(void)
 
 }
 
+/* Silence after a voice which ends the recording, 0 to never stop */
+void adc_set_auto_stop(uint16_t samples)
+{
+  adc.stop_blocks = samples >> VAD_BLOCK_SHIFT;
+}
+
+/* Samples before the trigger to record, up to the size of one buffer */
+void adc_set_preroll(uint16_t samples)
+{
+  adc.preroll = samples;
+}
+
 void adc_enable(void)
 {
-  /* Initialize the ADC on ADC0 */
-  ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0); /* Enable the ADC, prescaler 128 */
+  /* Initialize the ADC on ADC0: conversions of 26us (prescaler 32), started by
+     Timer0 compare A so that the sample interrupt does not wait for them */
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADPS2) | _BV(ADPS0);
+  ADCSRB = _BV(ADTS1) | _BV(ADTS0);
   ADMUX |= _BV(REFS0) | _BV(ADLAR); /* AVCC ref with cap on AREF, left justify, mux on ADC0 */
 
 #ifdef __AVR_ATmega32U4__
@@ -108,7 +155,8 @@ void adc_enable(void)
 void adc_disable(void)
 {
   /* Disable the ADC */
-  ADCSRA &= _BV(ADEN);
+  ADCSRA &= ~_BV(ADEN);
+  ADCSRB = 0;
 }
 
 void adc_start(uint8_t* buffer0, uint8_t* buffer1, uint16_t size)
@@ -123,112 +171,210 @@ void adc_start(uint8_t* buffer0, uint8_t* buffer1, uint16_t size)
   adc.current_buffer = 0;
   adc.read_ptr = adc_buffer_pool[0].start;
   adc.end_ptr = adc_buffer_pool[0].end;
+  adc.size = size;
+  adc.wrapped = 0;
+  adc.discard = 2;
+  
+  /* The older samples are overwritten while the pre-roll is written */
+  if (adc.preroll > size)
+    adc.preroll = size;
+  adc.skip = 0;
+  adc.queued_flag = 0;
+  
+  vad_init(adc.stop_blocks);
+  adc.vad_count = 0;
+  adc.vad_sum = 0;
+  adc.last = 0;
+  adc.ended = 0;
   
   buffer_full_flag = 0;
   
   /* Enable the ADC block */
   adc_enable();
   
-  /* Setup a periodic interrupt to update the sample value */
-  set_sample_timer_handler(&adc_timer_handler);
-    
-  TCCR0A = _BV(WGM01); /* CTC mode */
-  
-#if (F_CPU == 16000000)
-  TCCR0B = _BV(CS01); /* Fclk / 8 */
-  OCR0A = 250 - 1; /* 8000 Hz */
-#else
-#error F_CPU not supported
-#endif
-  
-  /* Setup the buffer full interrupt */
-  OCR0B = 1;
-  
-  /* Enable the sample timer interrupt */
-  TIMSK0 |= _BV(OCIE0A) | _BV(OCIE0B);
-  
-  /* Enable interrupts */
-  sei();
+  /* Setup a periodic interrupt to read the sample value */
+  sample_timer_start(STREAM_CAPTURE, 8000, &adc_timer_handler);
 }
 
 void adc_stop(void)
 {
   /* Stop the sample timer interrupt */
-  TCCR0A = TCCR0B = OCR0A = TIMSK0 = 0;
+  sample_timer_stop(STREAM_CAPTURE);
   
   /* Disable the ADC block */
   adc_disable();
   
   /* Disable the led */
   PORTB &= ~_BV(PORTB0);
-  
-  set_sample_timer_handler(NULL);
 }
 
-void adc_timer_handler(void)
+/* Data to store for a buffer full event */
+uint8_t* adc_get_buffer(uint8_t flag, uint16_t* length)
 {
-  uint8_t sample = 0;
+  if (flag == ADC_FLAG_PREROLL)
+  {
+    *length = adc.preroll_length;
+    return adc.preroll_start;
+  }
   
-  /* Start a conversion */
-  ADCSRA |= _BV(ADSC);
-
-  /* Wait for the end of the conversion */
-  while (ADCSRA & _BV(ADSC));
+  *length = adc.full_length;
+  return adc.full_start;
+}
 
-  /* Clear the interrupt flag */
-  ADCSRA |= _BV(ADIF); 
+/* End of a buffer full event, the buffer filled meanwhile is notified */
+void adc_release_buffer(void)
+{
+  uint8_t sreg = SREG;
+  cli();
+  
+  buffer_full_flag = adc.queued_flag;
+  adc.queued_flag = 0;
+  
+  if (buffer_full_flag)
+    TIMSK0 |= _BV(OCIE0B);
+  
+  SREG = sreg;
+}
 
-  /* Read the sampled value */
-  sample = ADCH;
+/* Samples left to fill the buffer being recorded */
+uint16_t adc_get_samples_left(void)
+{
+  return (uint16_t)(adc.end_ptr - adc.read_ptr);
+}
 
-  if (adc.triggered)
+static void adc_trigger(void)
+{
+  uint16_t position = (uint16_t)(adc.read_ptr - adc_buffer_pool[adc.current_buffer].start);
+  uint16_t preroll = adc.preroll;
+  
+  /* Nothing recorded yet before the current buffer */
+  if (!adc.wrapped && (preroll > position))
+    preroll = position;
+  
+  if (preroll > position)
+  {
+    /* The oldest samples are at the end of the other buffer, notify them
+       first: it is overwritten once the current buffer is full */
+    adc.preroll_length = preroll - position;
+    adc.preroll_start = adc_buffer_pool[adc.current_buffer ^ 1].end - adc.preroll_length;
+    buffer_full_flag = ADC_FLAG_PREROLL;
+    
+    /* Enable the buffer event interrupt */
+    TIMSK0 |= _BV(OCIE0B);
+  }
+  else
   {
-    /* Store the sampled value in a buffer */
-    *adc.read_ptr = sample;
-    adc.read_ptr++;
+    /* The pre-roll starts within the current buffer */
+    adc.skip = position - preroll;
+  }
+  
+  adc.triggered = 1;
+}
 
-    /* Check the buffer end */
-    if (adc.read_ptr >= adc.end_ptr)
+void adc_timer_handler(void)
+{
+  /* Read the value converted since the previous tick */
+  uint8_t sample = ADCH;
+  
+  /* No conversion completed yet: the first one starts on the first tick,
+     or on the second one after an interrupt left pending by a previous run */
+  if (adc.discard)
+  {
+    adc.discard--;
+    return;
+  }
+  
+  if (adc.vad)
+  {
+    /* Level of the block for the voice activity detection */
+    adc.vad_sum += (sample < 128) ? (128 - sample) : (sample - 128);
+    
+    if (++adc.vad_count == VAD_BLOCK_SIZE)
     {
-      /* Check for buffer overflow */
-      if (buffer_full_flag != 0)
+      uint8_t state = vad_update((uint8_t)(adc.vad_sum >> VAD_BLOCK_SHIFT));
+      adc.vad_count = 0;
+      adc.vad_sum = 0;
+      
+      if (state == VAD_VOICE)
       {
-        printf("O");
-        adc_stop();
-
-        return;
+        if (!adc.triggered)
+          adc_trigger();
+        
+        /* Enable the led */
+        PORTB |= _BV(PORTB0);
       }
+      else
+      {
+        if (state == VAD_END)
+          adc.last = 1;
+        
+        /* Disable the led */
+        PORTB &= ~_BV(PORTB0);
+      }
+    }
+  }
+  
+  /* Store the sampled value in a buffer, until the trigger the buffers
+     are a ring holding the pre-roll */
+  *adc.read_ptr = sample;
+  adc.read_ptr++;
 
-      /* Store the current buffer */
-      buffer_full_flag = 0x80 + adc.current_buffer;
-
-      /* Switch the current buffer */
-      adc.current_buffer ^= 1;
-      if (adc.current_buffer)
+  /* Check the buffer end */
+  if (adc.read_ptr >= adc.end_ptr)
+  {
+    if (adc.triggered && !adc.ended)
+    {
+      uint8_t flag = 0x80 + adc.current_buffer;
+      
+      /* The silence lasted long enough: this buffer is the last one */
+      if (adc.last)
       {
-        adc.read_ptr = adc_buffer_pool[1].start;
-        adc.end_ptr = adc_buffer_pool[1].end;
+        flag |= ADC_FLAG_LAST;
+        adc.ended = 1;
       }
-      else
+      
+      /* Check for buffer overflow, a single buffer may wait behind the pre-roll */
+      if (buffer_full_flag == 0)
+      {
+        buffer_full_flag = flag;
+      }
+      else if ((buffer_full_flag == ADC_FLAG_PREROLL) && (adc.queued_flag == 0))
       {
-        adc.read_ptr = adc_buffer_pool[0].start;
-        adc.end_ptr = adc_buffer_pool[0].end;
+        adc.queued_flag = flag;
       }
+      else
+      {
+        /* The card did not keep up: the other buffer is still being
+           written, drop this one and fill it again */
+        stats.adc_overruns++;
+        trace(TRACE_ADC_OVERRUN, 0);
+        adc.read_ptr = adc_buffer_pool[adc.current_buffer].start;
+        adc.skip = 0;
 
+        return;
+      }
+      
+      /* Store the current buffer */
+      adc.full_start = adc_buffer_pool[adc.current_buffer].start + adc.skip;
+      adc.full_length = adc.size - adc.skip;
+      adc.skip = 0;
+      
       /* Enable the buffer event interrupt */
       TIMSK0 |= _BV(OCIE0B);
     }
-  }
-  else
-  {
-    if (  (sample < (128 - adc.threshold))
-       || (sample > (128 + adc.threshold)) )
+    
+    /* Switch the current buffer */
+    adc.wrapped = 1;
+    adc.current_buffer ^= 1;
+    if (adc.current_buffer)
     {
-      adc.triggered = 1;
-      
-      /* Enable the led */
-      PORTB |= _BV(PORTB0);
+      adc.read_ptr = adc_buffer_pool[1].start;
+      adc.end_ptr = adc_buffer_pool[1].end;
+    }
+    else
+    {
+      adc.read_ptr = adc_buffer_pool[0].start;
+      adc.end_ptr = adc_buffer_pool[0].end;
     }
   }
 }
-
@@ -23,10 +23,23 @@
 #ifndef ADC_H
 #define ADC_H
 
+/* Buffer full event for the samples before the trigger */
+#define ADC_FLAG_PREROLL (0x40)
+
+/* Last buffer before the auto-stop, added to a buffer full event */
+#define ADC_FLAG_LAST    (0x20)
+
 void adc_init(uint8_t vad);
 void adc_shutdown(void);
+void adc_set_preroll(uint16_t samples);
+void adc_set_auto_stop(uint16_t samples);
+void adc_enable(void);
+void adc_disable(void);
 void adc_start(uint8_t* buffer0, uint8_t* buffer1, uint16_t size);
 void adc_stop(void);
+uint8_t* adc_get_buffer(uint8_t flag, uint16_t* length);
+void adc_release_buffer(void);
+uint16_t adc_get_samples_left(void);
 
 extern volatile uint8_t buffer_full_flag;
 void adc_timer_handler(void);
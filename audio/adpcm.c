@@ -0,0 +1,125 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* IMA ADPCM encoder
+*
+* 16-bit samples to 4-bit codes, with the step tables of the IMA/DVI
+* reference. The decoder of tools/monitor.py mirrors it.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <avr/pgmspace.h>
+
+#include "adpcm.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define ADPCM_MAX_INDEX (88)
+
+static const int8_t index_table[8] PROGMEM = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const uint16_t step_table[ADPCM_MAX_INDEX + 1] PROGMEM = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void adpcm_init(t_adpcm_state* state)
+{
+  state->predictor = 0;
+  state->index = 0;
+}
+
+/* Returns the 4-bit code of the sample and updates the state */
+uint8_t adpcm_encode(t_adpcm_state* state, int16_t sample)
+{
+  uint16_t step = pgm_read_word(&step_table[state->index]);
+  int32_t predictor = state->predictor;
+  int32_t diff = (int32_t)sample - predictor;
+  uint16_t delta = step >> 3;
+  uint8_t code = 0;
+  int8_t index;
+  
+  if (diff < 0)
+  {
+    code = 8;
+    diff = -diff;
+  }
+  
+  /* Quantize the difference, rebuilding it as the decoder does */
+  if (diff >= step)
+  {
+    code |= 4;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step)
+  {
+    code |= 2;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step)
+  {
+    code |= 1;
+    delta += step;
+  }
+  
+  if (code & 8)
+    predictor -= delta;
+  else
+    predictor += delta;
+  
+  if (predictor > 32767)
+    predictor = 32767;
+  else if (predictor < -32768)
+    predictor = -32768;
+  
+  index = (int8_t)state->index + (int8_t)pgm_read_byte(&index_table[code & 7]);
+  if (index < 0)
+    index = 0;
+  else if (index > ADPCM_MAX_INDEX)
+    index = ADPCM_MAX_INDEX;
+  
+  state->predictor = (int16_t)predictor;
+  state->index = (uint8_t)index;
+  
+  return code;
+}
@@ -20,7 +20,56 @@
   this software.
 */
 
+/*****************************************************************************
+* PCM buffer pools
+*
+* A single stream uses the whole buffer as two halves of PCM_BUFFER_SIZE.
+* In duplex mode the buffer is split between the playback and the capture
+* streams, with halves of PCM_BUFFER_SIZE / 2: the deadlines are halved,
+* but both streams run at once. The mode is only changed while no stream
+* is running.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
 #include <stdint.h>
 #include "buffer.h"
 
-uint8_t pcm_buffer[2 * PCM_BUFFER_SIZE];
\ No newline at end of file
+/*****************************************************************************
+* Globals
+******************************************************************************/
+uint8_t pcm_buffer[2 * PCM_BUFFER_SIZE];
+
+t_pcm_pool pcm_pools[NB_STREAMS] =
+{
+  { pcm_buffer, PCM_BUFFER_SIZE }, /* STREAM_PLAYBACK */
+  { pcm_buffer, PCM_BUFFER_SIZE }, /* STREAM_CAPTURE */
+};
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void buffer_set_duplex(uint8_t duplex)
+{
+  if (duplex)
+  {
+    pcm_pools[STREAM_PLAYBACK].start = pcm_buffer;
+    pcm_pools[STREAM_PLAYBACK].size = PCM_BUFFER_SIZE / 2;
+    pcm_pools[STREAM_CAPTURE].start = pcm_buffer + PCM_BUFFER_SIZE;
+    pcm_pools[STREAM_CAPTURE].size = PCM_BUFFER_SIZE / 2;
+  }
+  else
+  {
+    pcm_pools[STREAM_PLAYBACK].start = pcm_buffer;
+    pcm_pools[STREAM_PLAYBACK].size = PCM_BUFFER_SIZE;
+    pcm_pools[STREAM_CAPTURE].start = pcm_buffer;
+    pcm_pools[STREAM_CAPTURE].size = PCM_BUFFER_SIZE;
+  }
+}
+
+uint8_t* buffer_get_half(uint8_t stream, uint8_t half)
+{
+  return pcm_pools[stream].start + (half & 0x1) * pcm_pools[stream].size;
+}
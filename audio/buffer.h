@@ -23,8 +23,30 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+/* Half of the buffer, a sector by default. The applications short of SRAM
+   can build with smaller halves, at the cost of shorter deadlines and of
+   sectors written in several parts */
+#ifndef PCM_BUFFER_SIZE
 #define PCM_BUFFER_SIZE (512)
+#endif
+
+/* Audio streams, each with its own buffer pool and handlers */
+enum {
+  STREAM_PLAYBACK,
+  STREAM_CAPTURE,
+  NB_STREAMS,
+};
+
+/* Double buffer of a stream: two halves of size bytes from start */
+typedef struct {
+  uint8_t* start;
+  uint16_t size;
+} t_pcm_pool;
 
 extern uint8_t pcm_buffer[2 * PCM_BUFFER_SIZE];
+extern t_pcm_pool pcm_pools[NB_STREAMS];
+
+void buffer_set_duplex(uint8_t duplex);
+uint8_t* buffer_get_half(uint8_t stream, uint8_t half);
 
 #endif /* BUFFER_H */
@@ -0,0 +1,207 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Startup chime
+*
+* A few notes synthesized from flash into the PCM buffers, so that the
+* device gives an audible feedback before the SD card is ready.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "chime.h"
+#include "interrupts.h"
+#include "buffer.h"
+#include "dac.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define CHIME_RATE (8000)
+#define SILENCE    (0x80)
+
+/* Samples of a step of the decay, 64ms */
+#define CHIME_STEP (512)
+
+/* Phase increments of a 16-bit accumulator at 8kHz */
+#define NOTE_C6 (8577)  /* 1047 Hz */
+#define NOTE_E6 (10805) /* 1319 Hz */
+#define NOTE_G6 (12845) /* 1568 Hz */
+#define NOTE_C7 (17146) /* 2093 Hz */
+
+/* One period of a sine wave */
+static const int8_t sine_table[32] PROGMEM =
+{
+  0, 20, 38, 56, 71, 83, 92, 98, 100, 98, 92, 83, 71, 56, 38, 20,
+  0, -20, -38, -56, -71, -83, -92, -98, -100, -98, -92, -83, -71, -56, -38, -20,
+};
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint16_t phase_step;
+  uint8_t nb_steps; /* Duration, in steps of 64ms */
+} t_chime_note;
+
+static const t_chime_note chime_notes[] PROGMEM =
+{
+  { NOTE_C6, 1 },
+  { NOTE_E6, 1 },
+  { NOTE_G6, 1 },
+  { NOTE_C7, 3 },
+  { 0, 0 },
+};
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  t_chime_notify_eof notify_eof;
+  uint8_t running;
+  uint8_t note;
+  uint8_t step;     /* Steps played in the current note */
+  uint16_t sample;  /* Samples played in the current step */
+  uint16_t phase;
+  uint8_t done;
+} chime;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void chime_fill(uint8_t* p);
+static void chime_buffer_handler(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void chime_start(t_chime_notify_eof notify_eof)
+{
+  memset(&chime, 0x00, sizeof(chime));
+  chime.notify_eof = notify_eof;
+  chime.running = 1;
+  
+  /* Synthesize the first two buffers */
+  dac_init(CHIME_RATE);
+  chime_fill(buffer_get_half(STREAM_PLAYBACK, 0));
+  chime_fill(buffer_get_half(STREAM_PLAYBACK, 1));
+  
+  /* Set the buffer event handler */
+  set_buffer_event_handler(STREAM_PLAYBACK, &chime_buffer_handler);
+  
+  /* Start the DAC */
+  dac_start(buffer_get_half(STREAM_PLAYBACK, 0), buffer_get_half(STREAM_PLAYBACK, 1),
+            pcm_pools[STREAM_PLAYBACK].size);
+}
+
+void chime_stop(void)
+{
+  if (!chime.running)
+    return;
+  
+  dac_stop();
+  
+  /* Reset the buffer event handler */
+  set_buffer_event_handler(STREAM_PLAYBACK, NULL);
+  
+  chime.running = 0;
+}
+
+static void chime_fill(uint8_t* p)
+{
+  uint16_t size = pcm_pools[STREAM_PLAYBACK].size;
+  
+  while (size)
+  {
+    uint16_t phase_step = pgm_read_word(&chime_notes[chime.note].phase_step);
+    uint8_t attenuation = chime.step;
+    uint16_t length = CHIME_STEP - chime.sample;
+    uint16_t i;
+    
+    if (phase_step == 0)
+    {
+      /* End of the chime */
+      memset(p, SILENCE, size);
+      chime.done = 1;
+      return;
+    }
+    
+    if (length > size)
+      length = size;
+    
+    /* Decaying sine wave: the amplitude is halved at each step, whatever
+       the size of the buffers */
+    for(i = 0; i < length; i++)
+    {
+      int8_t sample = (int8_t)pgm_read_byte(&sine_table[chime.phase >> 11]);
+      *p++ = SILENCE + (sample >> attenuation);
+      chime.phase += phase_step;
+    }
+    size -= length;
+    
+    /* Next step */
+    chime.sample += length;
+    if (chime.sample < CHIME_STEP)
+      continue;
+    
+    chime.sample = 0;
+    if (++chime.step >= pgm_read_byte(&chime_notes[chime.note].nb_steps))
+    {
+      chime.note++;
+      chime.step = 0;
+    }
+  }
+}
+
+static void chime_buffer_handler(void)
+{
+  if (empty_buffer_flag)
+  {
+    uint8_t* p = buffer_get_half(STREAM_PLAYBACK, empty_buffer_flag);
+    
+    /* Reset the flag */
+    empty_buffer_flag = 0;
+    
+    if (chime.done)
+    {
+      /* The last buffer has been played */
+      chime_stop();
+      
+      /* Notify the client */
+      if (chime.notify_eof)
+        chime.notify_eof();
+    }
+    else
+    {
+      chime_fill(p);
+    }
+  }
+}
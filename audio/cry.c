@@ -0,0 +1,293 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Cry detector
+*
+* Works on the 8 kHz capture stream, decimated by 2 with the sum of two
+* samples. Each frame of 64 decimated samples feeds a bank of Goertzel
+* filters 62.5 Hz apart: 312-625 Hz for the fundamental of a baby cry,
+* 125-187 Hz for the voice of an adult or a mains hum. A frame is a cry
+* frame when it is louder than the noise floor, the fundamental band holds
+* a quarter of its energy and the band of the adults less than half of
+* the fundamental band. The harmonics of the cry are the rest of the
+* energy.
+*
+* The cadence tells a cry from a beeper or from a voice: segments of cry
+* frames from CRY_MIN_SEGMENT to CRY_MAX_SEGMENT long, the breaths in
+* between shorter than CRY_MAX_PAUSE. The pitch of a cry moves along a
+* segment, the strongest bin must change, a beeper holds it. The cry is
+* reported once, when the CRY_SEGMENTS-th segment is long enough, then
+* again after CRY_REARM frames without a cry frame.
+*
+* 8 multiplies of 16x16 bits per pair of samples, about 200 of the 2000
+* cycles of a sample at 8 kHz on the ATmega328P. Runs from the buffer
+* event, not in the sample interrupt: bench/ measures it in the
+* listen_8000 phase, host/cry_bench checks the detections.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "cry.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define CRY_FRAME_SHIFT     (6) /* Decimated samples per frame, as a shift */
+
+/* Goertzel bins k of the 64-point frame at 4 kHz, coefficients
+   2 cos(2 pi k / 64) in Q14 */
+#define CRY_NB_LOW_BINS     (2)
+#define CRY_NB_BINS         (8)
+#define CRY_COEFF_SHIFT     (14)
+
+/* Frame test */
+#define CRY_MIN_FLOOR       (64)   /* rms of 2 steps of the ADC */
+#define CRY_FLOOR_MARGIN    (2)    /* 12 dB over the floor, as a shift */
+#define CRY_FLOOR_DOWN      (2)    /* 64 ms */
+#define CRY_FLOOR_UP        (7)    /* 2 s */
+
+/* Cadence, in frames of 16 ms */
+#define CRY_HANGOVER        (4)    /* 64 ms gaps in a segment */
+#define CRY_MIN_SEGMENT     (19)   /* 300 ms */
+#define CRY_MAX_SEGMENT     (188)  /* 3 s */
+#define CRY_MAX_PAUSE       (125)  /* 2 s */
+#define CRY_SEGMENTS        (3)
+#define CRY_REARM           (625)  /* 10 s */
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static const int16_t cry_coeffs[CRY_NB_BINS] PROGMEM = {
+  32138, 31357,                        /* 125, 187 Hz */
+  28899, 27246, 25330, 23170, 20788,   /* 312 to 562 Hz */
+  18205,                               /* 625 Hz */
+};
+
+static struct {
+  /* Frame in progress */
+  int16_t  s1[CRY_NB_BINS];
+  int16_t  s2[CRY_NB_BINS];
+  uint8_t  count;
+  uint16_t dc;
+  uint16_t dc_sum;
+  uint32_t energy;
+  
+  /* Mean square of the frames without a cry */
+  uint32_t floor;
+  
+  /* Cadence */
+  uint8_t  run;
+  uint8_t  gap;
+  uint8_t  peak;
+  uint8_t  pitch_min;
+  uint8_t  pitch_max;
+  uint8_t  pause;
+  uint8_t  segments;
+  uint8_t  detected;
+  uint16_t quiet;
+} cry;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static uint8_t cry_frame(void);
+static uint8_t cry_cadence(uint8_t is_cry);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void cry_init(void)
+{
+  memset(&cry, 0x00, sizeof(cry));
+  
+  /* Midscale of the sum of two samples */
+  cry.dc = 256;
+  cry.floor = CRY_MIN_FLOOR;
+}
+
+/* length: even number of 8 kHz samples. Returns 1 when a cry is detected */
+uint8_t cry_process(const uint8_t* samples, uint16_t length)
+{
+  uint8_t detected = 0;
+  
+  for (; length >= 2; length -= 2, samples += 2)
+  {
+    uint16_t pair = (uint16_t)samples[0] + samples[1];
+    int16_t x = ((int16_t)pair - (int16_t)cry.dc) >> 2;
+    uint8_t i;
+    
+    cry.dc_sum += pair;
+    cry.energy += (uint16_t)(x * x);
+    
+    for (i = 0; i < CRY_NB_BINS; i++)
+    {
+      int16_t coeff = (int16_t)pgm_read_word(&cry_coeffs[i]);
+      int16_t s0 = x + (int16_t)(((int32_t)coeff * cry.s1[i]) >> CRY_COEFF_SHIFT) - cry.s2[i];
+      cry.s2[i] = cry.s1[i];
+      cry.s1[i] = s0;
+    }
+    
+    if (++cry.count == (1 << CRY_FRAME_SHIFT))
+    {
+      if (cry_cadence(cry_frame()))
+        detected = 1;
+    }
+  }
+  
+  return detected;
+}
+
+/* Returns 1 for a cry frame, and starts the next frame */
+static uint8_t cry_frame(void)
+{
+  uint32_t low = 0;
+  uint32_t band = 0;
+  uint32_t peak_power = 0;
+  uint32_t energy = cry.energy;
+  uint8_t is_cry = 0;
+  uint8_t i;
+  
+  /* Squared magnitude of each bin */
+  for (i = 0; i < CRY_NB_BINS; i++)
+  {
+    int16_t s1 = cry.s1[i];
+    int16_t s2 = cry.s2[i];
+    int16_t coeff = (int16_t)pgm_read_word(&cry_coeffs[i]);
+    int32_t power = (int32_t)s1 * s1 + (int32_t)s2 * s2
+                  - (((int32_t)coeff * s1) >> CRY_COEFF_SHIFT) * s2;
+    
+    if (power < 0)
+      power = 0;
+    
+    if (i < CRY_NB_LOW_BINS)
+      low += power;
+    else
+      band += power;
+    
+    if ((i >= CRY_NB_LOW_BINS) && ((uint32_t)power > peak_power))
+    {
+      peak_power = power;
+      cry.peak = i;
+    }
+  }
+  
+  /* A quarter of the energy of one side of the spectrum, 32 x energy */
+  if ((energy > (cry.floor << CRY_FLOOR_MARGIN)) &&
+      (band >= (energy << 3)) &&
+      (band > (low << 1)))
+  {
+    is_cry = 1;
+  }
+  else
+  {
+    /* Noise floor, from the frames without a cry only */
+    if (energy < cry.floor)
+      cry.floor -= (cry.floor - energy) >> CRY_FLOOR_DOWN;
+    else
+      cry.floor += ((energy - cry.floor) >> CRY_FLOOR_UP) + 1;
+    
+    if (cry.floor < CRY_MIN_FLOOR)
+      cry.floor = CRY_MIN_FLOOR;
+  }
+  
+  /* Next frame, without the offset of this one */
+  memset(cry.s1, 0x00, sizeof(cry.s1));
+  memset(cry.s2, 0x00, sizeof(cry.s2));
+  cry.dc = cry.dc_sum >> CRY_FRAME_SHIFT;
+  cry.dc_sum = 0;
+  cry.energy = 0;
+  cry.count = 0;
+  
+  return is_cry;
+}
+
+/* Returns 1 on the frame which completes a cry */
+static uint8_t cry_cadence(uint8_t is_cry)
+{
+  uint8_t detected = 0;
+  
+  if (is_cry)
+  {
+    cry.gap = 0;
+    cry.pause = 0;
+    cry.quiet = 0;
+    if (cry.run < 0xFF)
+      cry.run++;
+    
+    /* Pitch range of the segment */
+    if ((cry.run == 1) || (cry.peak < cry.pitch_min))
+      cry.pitch_min = cry.peak;
+    if ((cry.run == 1) || (cry.peak > cry.pitch_max))
+      cry.pitch_max = cry.peak;
+    
+    if ((cry.run >= CRY_MIN_SEGMENT) && (cry.pitch_max > cry.pitch_min) &&
+        (cry.segments == CRY_SEGMENTS - 1) && !cry.detected)
+    {
+      cry.detected = 1;
+      detected = 1;
+    }
+  }
+  else
+  {
+    if (cry.run)
+    {
+      /* End of a segment after the hangover, a tone is too long or
+         too steady */
+      if (++cry.gap > CRY_HANGOVER)
+      {
+        if ((cry.run >= CRY_MIN_SEGMENT) && (cry.run <= CRY_MAX_SEGMENT) &&
+            (cry.pitch_max > cry.pitch_min))
+        {
+          if (cry.segments < CRY_SEGMENTS - 1)
+            cry.segments++;
+        }
+        else
+        {
+          cry.segments = 0;
+        }
+        cry.run = 0;
+        cry.gap = 0;
+      }
+    }
+    else if (cry.segments && (++cry.pause > CRY_MAX_PAUSE))
+    {
+      cry.segments = 0;
+      cry.pause = 0;
+    }
+    
+    /* Ready for the next cry after a while */
+    if (cry.detected && (++cry.quiet >= CRY_REARM))
+    {
+      cry.detected = 0;
+      cry.segments = 0;
+    }
+  }
+  
+  return detected;
+}
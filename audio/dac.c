@@ -22,7 +22,7 @@
 
 /*****************************************************************************
 * Hardware resources used:
-*   Timer0 A & B interrupts
+*   Timer0 A & B interrupts, shared with the capture (interrupts.c)
 *   ATmega32U4: Timer4 Fast PWM on A output (PC7)
 *   ATmega328P: Timer2 Fast PWM on B output (PD3)
 ******************************************************************************/
@@ -35,8 +35,10 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 
+#include "buffer.h"
 #include "dac.h"
 #include "interrupts.h"
+#include "stats.h"
 
 /*****************************************************************************
 * Definitions
@@ -49,6 +51,7 @@ typedef struct dac_packet {
 static struct {
   uint16_t rate;
   uint8_t  current_buffer;
+  uint8_t  paused;
   uint8_t* read_ptr;
   uint8_t* end_ptr;
 } dac;
@@ -62,9 +65,6 @@ volatile uint8_t empty_buffer_flag;
 /*****************************************************************************
 * Local prototypes
 ******************************************************************************/
-void dac_start_pwm(void);
-void dac_stop_pwm(void);
-
 void dac_timer_handler(void);
 
 /*****************************************************************************
@@ -79,6 +79,7 @@ void dac_init(uint16_t rate)
   /* Init the buffer pool */
   memset(dac_buffer_pool, 0x00, sizeof(dac_buffer_pool));
   dac.current_buffer = 0;
+  dac.paused = 0;
   dac.read_ptr = NULL;
 }
 
@@ -134,75 +135,47 @@ void dac_start(uint8_t* buffer0, uint8_t* buffer1, uint16_t size)
   
   empty_buffer_flag = 0;
   
-  /* Setup a periodic interrupt to update the sample value */
-  set_sample_timer_handler(&dac_timer_handler);
-  
-  TCCR0A = _BV(WGM01); /* CTC mode */
-#if (F_CPU == 16000000)
-  switch(dac.rate)
-  {
-    case 44100:
-      TCCR0B = _BV(CS01); /* Fclk / 8 */
-      OCR0A = 45 - 1; /* 44444 Hz */
-      break;
-    
-    case 22050:
-      TCCR0B = _BV(CS01); /* Fclk / 8 */
-      OCR0A = 91 - 1; /* 21978 Hz */
-      break;
-    
-    case 16000:
-      TCCR0B = _BV(CS01); /* Fclk / 8 */
-      OCR0A = 125 - 1; /* 16000 Hz */
-      break;
-      
-    case 8000:
-    default:
-      TCCR0B = _BV(CS01); /* Fclk / 8 */
-      OCR0A = 250 - 1; /* 8000 Hz */
-      break;
-  }
-#else
-#error F_CPU not supported
-#endif
-  
-  /* Setup the buffer empty interrupt */
-  OCR0B = 1;
-  
-  /* Enable the sample timer interrupt */
-  TIMSK0 |= _BV(OCIE0A) | _BV(OCIE0B);
-  
   /* Start the PWM output */
   dac_start_pwm();
   
-  /* Enable interrupts */
-  sei();
+  /* Setup a periodic interrupt to update the sample value */
+  sample_timer_start(STREAM_PLAYBACK, dac.rate, &dac_timer_handler);
 }
 
 void dac_pause(void)
 {
-  TIMSK0 &= ~_BV(OCIE0A);
+  /* The sample tick keeps running for a capture */
+  dac.paused = 1;
 }
 
 void dac_resume(void)
 {
-  TIMSK0 |= _BV(OCIE0A);
+  dac.paused = 0;
 }
 
 void dac_stop(void)
 {
   /* Stop the sample timer interrupt */
-  TCCR0A = TCCR0B = OCR0A = TIMSK0 = 0;
+  sample_timer_stop(STREAM_PLAYBACK);
   
   /* Stop the PWM output */
   dac_start_pwm();
-  
-  set_sample_timer_handler(NULL);
+}
+
+/* Samples left in the buffer being played */
+uint16_t dac_get_samples_left(void)
+{
+  return (uint16_t)(dac.end_ptr - dac.read_ptr);
 }
 
 void dac_timer_handler(void)
 {
-  uint8_t l_sample = *dac.read_ptr++;
+  uint8_t l_sample;
+  
+  if (dac.paused)
+    return;
+  
+  l_sample = *dac.read_ptr++;
 #if defined(__AVR_ATmega32U4__)
   OCR4A = l_sample;
 #elif defined(__AVR_ATmega328P__)
@@ -212,6 +185,10 @@ void dac_timer_handler(void)
   /* Check the buffer end */
   if (dac.read_ptr >= dac.end_ptr)
   {
+    /* The next buffer has not been refilled yet */
+    if (empty_buffer_flag)
+      stats.dac_underruns++;
+    
     /* Notify the client */
     empty_buffer_flag = 0x80 + dac.current_buffer;
 
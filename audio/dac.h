@@ -38,6 +38,9 @@ void dac_start(uint8_t* buffer0, uint8_t* buffer1, uint16_t size);
 void dac_stop(void);
 void dac_pause(void);
 void dac_resume(void);
+void dac_start_pwm(void);
+void dac_stop_pwm(void);
+uint16_t dac_get_samples_left(void);
 
 extern volatile uint8_t empty_buffer_flag;
 void dac_timer_handler(void);
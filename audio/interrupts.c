@@ -20,6 +20,22 @@
   this software.
 */
 
+/*****************************************************************************
+* Sample tick and buffer events of the audio streams
+*
+* One Timer0 tick serves the playback and the capture streams. It runs at
+* the playback rate when a playback is active, and the capture handler is
+* called every capture_divider ticks.
+*
+* The buffer events of both streams share the Timer0 compare B interrupt.
+* When both are pending, the stream whose current half runs out first is
+* served first: a card access for the other one may not fit before its
+* deadline.
+*
+* Hardware resources used:
+*   Timer0 A & B interrupts
+******************************************************************************/
+
 /*****************************************************************************
 * Includes
 ******************************************************************************/
@@ -27,36 +43,197 @@
 #include <avr/interrupt.h>
 
 #include "interrupts.h"
+#include "buffer.h"
+#include "adc.h"
+#include "dac.h"
+#include "stats.h"
 
 /*****************************************************************************
 * Globals
 ******************************************************************************/
-handler_t sample_timer_handler = NULL;
-handler_t buffer_event_handler = NULL;
+static struct {
+  handler_t handlers[NB_STREAMS];
+  uint16_t rates[NB_STREAMS];
+  uint8_t capture_divider;
+  uint8_t capture_tick;
+} sample_timer;
+
+handler_t buffer_event_handlers[NB_STREAMS];
+
+/* Buffer event handler in progress, and event raised meanwhile */
+static volatile uint8_t buffer_event_running = 0;
+static volatile uint8_t buffer_event_pending = 0;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void sample_timer_update(void);
+static int8_t buffer_event_next(void);
 
 /*****************************************************************************
 * Functions
 ******************************************************************************/
 
-void set_sample_timer_handler(handler_t handler)
+void sample_timer_start(uint8_t stream, uint16_t rate, handler_t handler)
 {
-  sample_timer_handler = handler;
+  cli();
+  
+  sample_timer.handlers[stream] = handler;
+  sample_timer.rates[stream] = rate;
+  sample_timer_update();
+  
+  /* Enable interrupts */
+  sei();
+}
+
+void sample_timer_stop(uint8_t stream)
+{
+  uint8_t sreg = SREG;
+  cli();
+  
+  sample_timer.handlers[stream] = NULL;
+  sample_timer.rates[stream] = 0;
+  sample_timer_update();
+  
+  SREG = sreg;
+}
+
+static void sample_timer_update(void)
+{
+  uint16_t tick_rate = sample_timer.rates[STREAM_PLAYBACK];
+  uint8_t ocr;
+  
+  if (tick_rate == 0)
+    tick_rate = sample_timer.rates[STREAM_CAPTURE];
+  
+  if (tick_rate == 0)
+  {
+    /* Stop the sample timer interrupt */
+    TCCR0A = TCCR0B = OCR0A = TIMSK0 = 0;
+    return;
+  }
+  
+  /* The capture runs on a divided tick */
+  sample_timer.capture_divider = 1;
+  if (sample_timer.rates[STREAM_CAPTURE] && (tick_rate > sample_timer.rates[STREAM_CAPTURE]))
+    sample_timer.capture_divider = tick_rate / sample_timer.rates[STREAM_CAPTURE];
+  sample_timer.capture_tick = 0;
+  
+#if (F_CPU == 16000000)
+  switch(tick_rate)
+  {
+    case 44100:
+      ocr = 45 - 1; /* 44444 Hz */
+      break;
+    
+    case 22050:
+      ocr = 91 - 1; /* 21978 Hz */
+      break;
+    
+    case 16000:
+      ocr = 125 - 1; /* 16000 Hz */
+      break;
+      
+    case 8000:
+    default:
+      ocr = 250 - 1; /* 8000 Hz */
+      break;
+  }
+#else
+#error F_CPU not supported
+#endif
+  
+  /* Keep the phase of a stream already running at this rate */
+  if (!TCCR0B || (OCR0A != ocr))
+  {
+    TCCR0A = _BV(WGM01); /* CTC mode */
+    TCCR0B = _BV(CS01); /* Fclk / 8 */
+    OCR0A = ocr;
+    TCNT0 = 0;
+  }
+  
+  /* Setup the buffer event interrupt */
+  OCR0B = 1;
+  
+  /* Enable the sample timer interrupt */
+  TIMSK0 |= _BV(OCIE0A) | _BV(OCIE0B);
 }
 
 /* Sample timer interrupt */
 ISR(TIMER0_COMPA_vect)
 {
-  /* Call the handler */
-  if (sample_timer_handler)
-    sample_timer_handler();
+  /* Call the handlers */
+  if (sample_timer.handlers[STREAM_PLAYBACK])
+    sample_timer.handlers[STREAM_PLAYBACK]();
+  
+  if (sample_timer.handlers[STREAM_CAPTURE])
+  {
+    if (++sample_timer.capture_tick >= sample_timer.capture_divider)
+    {
+      sample_timer.capture_tick = 0;
+      sample_timer.handlers[STREAM_CAPTURE]();
+    }
+  }
+  
+  /* Timer0 restarted from 0 on the compare match: time since the tick */
+  if (TCNT0 > stats.sample_isr_max)
+    stats.sample_isr_max = TCNT0;
+}
+
+void set_buffer_event_handler(uint8_t stream, handler_t handler)
+{
+  buffer_event_handlers[stream] = handler;
+}
+
+/* Card accesses of the main loop while a stream runs: the buffer events
+   raised meanwhile wait for the release, as behind a running handler */
+void buffer_event_hold(void)
+{
+  cli();
+  buffer_event_running = 1;
+  sei();
 }
 
-void set_buffer_event_handler(handler_t handler)
+void buffer_event_release(void)
 {
-  buffer_event_handler = handler;
+  cli();
+  buffer_event_running = 0;
+  if (buffer_event_pending)
+  {
+    buffer_event_pending = 0;
+    TIMSK0 |= _BV(OCIE0B);
+  }
+  sei();
 }
 
-extern void buffer_refill_handler(void);
+/* Pending stream with the closest deadline, -1 if none */
+static int8_t buffer_event_next(void)
+{
+  uint8_t playback = empty_buffer_flag && buffer_event_handlers[STREAM_PLAYBACK];
+  uint8_t capture = buffer_full_flag && buffer_event_handlers[STREAM_CAPTURE];
+  
+  if (playback && capture)
+  {
+    uint16_t playback_ticks;
+    uint16_t capture_ticks;
+    
+    /* Ticks until the half in use is exhausted, then the stream breaks */
+    cli();
+    playback_ticks = dac_get_samples_left();
+    capture_ticks = adc_get_samples_left() * sample_timer.capture_divider;
+    sei();
+    
+    return (playback_ticks <= capture_ticks) ? STREAM_PLAYBACK : STREAM_CAPTURE;
+  }
+  
+  if (playback)
+    return STREAM_PLAYBACK;
+  
+  if (capture)
+    return STREAM_CAPTURE;
+  
+  return -1;
+}
 
 /* Buffer event interrupt */
 ISR(TIMER0_COMPB_vect)
@@ -64,12 +241,44 @@ ISR(TIMER0_COMPB_vect)
   /* Enable the buffer event interrupt */
   TIMSK0 &= ~_BV(OCIE0B);
   
+  /* A slow card access may still be in progress in the handler: do not
+     start another one on top of it, the running handler is called again */
+  if (buffer_event_running)
+  {
+    buffer_event_pending = 1;
+    return;
+  }
+  buffer_event_running = 1;
+  
   /* Re-enable the interrupts to allow the execution of TIMER0_COMPA_vect */
   // with sei() => glitches in the recording on buffer boundaries... (why ???)
   // without seit() => glitches during playback
   sei();
   
-  /* Call the handler */
-  if (buffer_event_handler)
-    buffer_event_handler();
-}
\ No newline at end of file
+  while(1)
+  {
+    uint8_t i;
+    
+    /* Serve each pending stream once, the closest deadline first */
+    for(i = 0; i < NB_STREAMS; i++)
+    {
+      int8_t stream = buffer_event_next();
+      uint16_t start;
+      
+      if (stream < 0)
+        break;
+      
+      start = stats_timestamp();
+      buffer_event_handlers[stream]();
+      stats_add_refill(start);
+    }
+    
+    cli();
+    if (!buffer_event_pending)
+      break;
+    buffer_event_pending = 0;
+    sei();
+  }
+  
+  buffer_event_running = 0;
+}
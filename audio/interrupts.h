@@ -22,5 +22,8 @@
 
 typedef void (*handler_t)(void);
 
-void set_sample_timer_handler(handler_t handler);
-void set_buffer_event_handler(handler_t handler);
\ No newline at end of file
+void sample_timer_start(uint8_t stream, uint16_t rate, handler_t handler);
+void sample_timer_stop(uint8_t stream);
+void set_buffer_event_handler(uint8_t stream, handler_t handler);
+void buffer_event_hold(void);
+void buffer_event_release(void);
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Cry listener
+*
+* Captures the microphone without recording it and runs the cry detector
+* on each buffer, in the buffer event interrupt. The client is notified
+* from the interrupt at each detected cry, the capture goes on until
+* listener_stop().
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "adc.h"
+#include "buffer.h"
+#include "cry.h"
+#include "interrupts.h"
+
+#include "listener.h"
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  t_listener_notify_cry notify_cry;
+  void* opaque;
+  uint16_t buffers;
+} listener;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void listener_buffer_handler(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void listener_start(t_listener_notify_cry notify_cry, void* opaque)
+{
+  t_pcm_pool* pool = &pcm_pools[STREAM_CAPTURE];
+  
+  listener.notify_cry = notify_cry;
+  listener.opaque = opaque;
+  listener.buffers = 0;
+  
+  cry_init();
+  
+  /* The detector needs every sample, no voice activity trigger */
+  adc_init(0);
+  
+  set_buffer_event_handler(STREAM_CAPTURE, &listener_buffer_handler);
+  
+  adc_start(pool->start, pool->start + pool->size, pool->size);
+}
+
+void listener_stop(void)
+{
+  adc_stop();
+  adc_shutdown();
+  
+  set_buffer_event_handler(STREAM_CAPTURE, NULL);
+}
+
+/* Buffers analyzed since the start */
+uint16_t listener_get_buffers(void)
+{
+  uint8_t sreg = SREG;
+  uint16_t buffers;
+  
+  cli();
+  buffers = listener.buffers;
+  SREG = sreg;
+  
+  return buffers;
+}
+
+static void listener_buffer_handler(void)
+{
+  uint8_t* p;
+  uint16_t length;
+  uint8_t detected;
+  
+  if (!buffer_full_flag)
+    return;
+  
+  p = adc_get_buffer(buffer_full_flag, &length);
+  detected = cry_process(p, length);
+  adc_release_buffer();
+  
+  listener.buffers++;
+  
+  if (detected && listener.notify_cry)
+    listener.notify_cry(listener.opaque);
+}
@@ -0,0 +1,229 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Live microphone stream over the serial port
+*
+* Each buffer of ADC samples is DC-blocked and ADPCM-encoded in place, in
+* the buffer event interrupt, then sent as one frame by monitor_poll():
+*   0x5A 0xA5 seq drops_lo drops_hi predictor_lo predictor_hi index
+*   data[PCM_BUFFER_SIZE / 2] crc_hi crc_lo
+* The data holds the PCM_BUFFER_SIZE IMA ADPCM codes of a buffer, low
+* nibble first, decoded from the predictor and index of the header. The
+* CRC-16 of XMODEM covers the frame after the sync bytes. A frame still
+* being sent when the next one is ready is cut short and counted in drops,
+* so the host sees a gap in seq.
+*
+* 8000 samples/s at 4 bits need 4310 bytes/s with the framing of buffers
+* of 256 samples: 115200 baud and above. tools/monitor.py is the host side.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+
+#include "adc.h"
+#include "adpcm.h"
+#include "buffer.h"
+#include "interrupts.h"
+#include "usart.h"
+
+#include "monitor.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define MONITOR_SYNC0       (0x5A)
+#define MONITOR_SYNC1       (0xA5)
+#define MONITOR_HEADER_SIZE (8)
+#define MONITOR_DATA_SIZE   (PCM_BUFFER_SIZE / 2)
+#define MONITOR_FRAME_SIZE  (MONITOR_HEADER_SIZE + MONITOR_DATA_SIZE + 2)
+
+/* DC blocker pole, 1 - 2^-6: -3 dB at 20 Hz for 8000 Hz */
+#define DC_BLOCK_SHIFT (6)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+struct {
+  /* Frame being sent */
+  uint8_t header[MONITOR_HEADER_SIZE];
+  uint8_t* data;
+  uint16_t crc;
+  uint16_t tx_pos;
+  
+  uint8_t seq;
+  uint16_t drops;
+  
+  /* Encoder */
+  t_adpcm_state adpcm;
+  int16_t dc_input;
+  int32_t dc_output;
+} monitor;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+void monitor_buffer_handler(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void monitor_start(void)
+{
+  memset(&monitor, 0x00, sizeof(monitor));
+  monitor.tx_pos = MONITOR_FRAME_SIZE;
+  adpcm_init(&monitor.adpcm);
+  
+  /* No voice activity detection: stream everything */
+  adc_init(0);
+  
+  set_buffer_event_handler(STREAM_CAPTURE, &monitor_buffer_handler);
+  
+  adc_start(pcm_buffer, pcm_buffer + PCM_BUFFER_SIZE, PCM_BUFFER_SIZE);
+}
+
+void monitor_stop(void)
+{
+  adc_stop();
+  adc_shutdown();
+  
+  set_buffer_event_handler(STREAM_CAPTURE, NULL);
+  
+  /* Complete the frame in progress */
+  while (monitor.tx_pos < MONITOR_FRAME_SIZE)
+    monitor_poll();
+}
+
+uint16_t monitor_get_drops(void)
+{
+  return monitor.drops;
+}
+
+/* Feed the transmit ring with the frame, from the main loop */
+void monitor_poll(void)
+{
+  while (1)
+  {
+    uint8_t sreg = SREG;
+    uint16_t pos;
+    uint8_t c;
+    
+    /* The buffer event interrupt may start the next frame meanwhile */
+    cli();
+    pos = monitor.tx_pos;
+    if (pos >= MONITOR_FRAME_SIZE)
+    {
+      SREG = sreg;
+      break;
+    }
+    
+    if (pos < MONITOR_HEADER_SIZE)
+      c = monitor.header[pos];
+    else if (pos < MONITOR_HEADER_SIZE + MONITOR_DATA_SIZE)
+      c = monitor.data[pos - MONITOR_HEADER_SIZE];
+    else if (pos == MONITOR_HEADER_SIZE + MONITOR_DATA_SIZE)
+      c = (uint8_t)(monitor.crc >> 8);
+    else
+      c = (uint8_t)monitor.crc;
+    
+    if (usart_putc(c))
+      monitor.tx_pos = pos + 1;
+    SREG = sreg;
+    
+    if (monitor.tx_pos == pos)
+      break;
+  }
+}
+
+/* Remove the offset of the microphone bias, as a 16-bit sample */
+static int16_t monitor_dc_block(uint8_t sample)
+{
+  int16_t input = ((int16_t)sample - 128) << 8;
+  int32_t output = monitor.dc_output;
+  
+  /* y[n] = x[n] - x[n-1] + (1 - 2^-k) y[n-1] */
+  output += (int32_t)input - monitor.dc_input - (output >> DC_BLOCK_SHIFT);
+  monitor.dc_input = input;
+  monitor.dc_output = output;
+  
+  if (output > 32767)
+    return 32767;
+  if (output < -32768)
+    return -32768;
+  return (int16_t)output;
+}
+
+void monitor_buffer_handler(void)
+{
+  uint8_t* p;
+  uint16_t i;
+  uint16_t crc = 0;
+  
+  if (!buffer_full_flag)
+    return;
+  
+  p = pcm_buffer + (buffer_full_flag & 0x1) * PCM_BUFFER_SIZE;
+  
+  /* The link did not keep up: cut the previous frame short */
+  if (monitor.tx_pos < MONITOR_FRAME_SIZE)
+  {
+    monitor.tx_pos = MONITOR_FRAME_SIZE;
+    monitor.drops++;
+  }
+  
+  monitor.header[0] = MONITOR_SYNC0;
+  monitor.header[1] = MONITOR_SYNC1;
+  monitor.header[2] = monitor.seq++;
+  monitor.header[3] = (uint8_t)monitor.drops;
+  monitor.header[4] = (uint8_t)(monitor.drops >> 8);
+  monitor.header[5] = (uint8_t)monitor.adpcm.predictor;
+  monitor.header[6] = (uint8_t)((uint16_t)monitor.adpcm.predictor >> 8);
+  monitor.header[7] = monitor.adpcm.index;
+  
+  /* Encode in place, two samples per byte */
+  for(i = 0; i < PCM_BUFFER_SIZE; i += 2)
+  {
+    uint8_t code = adpcm_encode(&monitor.adpcm, monitor_dc_block(p[i]));
+    code |= adpcm_encode(&monitor.adpcm, monitor_dc_block(p[i + 1])) << 4;
+    p[i / 2] = code;
+  }
+  
+  for(i = 2; i < MONITOR_HEADER_SIZE; i++)
+    crc = _crc_xmodem_update(crc, monitor.header[i]);
+  for(i = 0; i < MONITOR_DATA_SIZE; i++)
+    crc = _crc_xmodem_update(crc, p[i]);
+  
+  monitor.data = p;
+  monitor.crc = crc;
+  
+  /* Reset the flag */
+  buffer_full_flag = 0;
+  
+  /* Start sending */
+  monitor.tx_pos = 0;
+}
@@ -0,0 +1,146 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Live ADC to DAC passthrough
+*
+* One sample tick serves both directions: Timer0 compare A triggers the ADC
+* conversion in hardware, so the sampling instant does not depend on the
+* interrupt latency, and the sample interrupt outputs the result of the
+* previous conversion to the PWM. The latency is one sample period; with
+* both sides on the same clock no jitter buffer is needed.
+*
+* The samples go through a noise gate, open while the input stayed above
+* the threshold within the hold time, and a gain in 1/16 steps.
+*
+* Hardware resources used:
+*   Timer0 A interrupt, Timer0 compare A as the ADC trigger
+*   ADC input ADC0, PWM output as in dac.c
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "adc.h"
+#include "buffer.h"
+#include "dac.h"
+#include "interrupts.h"
+
+#include "passthrough.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define SILENCE (0x80)
+
+#define PASSTHROUGH_GAIN_UNITY    (16)
+#define PASSTHROUGH_GATE_HOLD_MS  (100)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  uint8_t gain;
+  uint8_t gate_threshold;
+  uint16_t gate_hold;
+  uint16_t gate_remaining;
+} passthrough;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+void passthrough_timer_handler(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void passthrough_start(uint16_t rate)
+{
+  memset(&passthrough, 0x00, sizeof(passthrough));
+  passthrough.gain = PASSTHROUGH_GAIN_UNITY;
+  passthrough.gate_hold = (uint16_t)((uint32_t)rate * PASSTHROUGH_GATE_HOLD_MS / 1000);
+  
+  /* Conversions started by Timer0 compare A */
+  adc_enable();
+  dac_start_pwm();
+  
+  sample_timer_start(STREAM_PLAYBACK, rate, &passthrough_timer_handler);
+}
+
+void passthrough_stop(void)
+{
+  /* Stop the sample timer interrupt */
+  sample_timer_stop(STREAM_PLAYBACK);
+  
+  adc_disable();
+  
+  /* Back to the idle level */
+  dac_start_pwm();
+}
+
+/* Gain in 1/16 steps, 16 for unity */
+void passthrough_set_gain(uint8_t gain)
+{
+  passthrough.gain = gain;
+}
+
+/* Gate threshold in steps from the midscale, 0 to disable the gate */
+void passthrough_set_gate(uint8_t threshold)
+{
+  passthrough.gate_threshold = threshold;
+}
+
+void passthrough_timer_handler(void)
+{
+  int16_t sample = (int16_t)ADCH - 128;
+  uint8_t level = (sample < 0) ? -sample : sample;
+  
+  /* Noise gate */
+  if (level >= passthrough.gate_threshold)
+    passthrough.gate_remaining = passthrough.gate_hold;
+  else if (passthrough.gate_remaining)
+    passthrough.gate_remaining--;
+  
+  if (!passthrough.gate_remaining)
+  {
+    sample = 0;
+  }
+  else
+  {
+    sample = (sample * passthrough.gain) / PASSTHROUGH_GAIN_UNITY;
+    if (sample > 127)
+      sample = 127;
+    else if (sample < -128)
+      sample = -128;
+  }
+  
+#if defined(__AVR_ATmega32U4__)
+  OCR4A = (uint8_t)(sample + SILENCE);
+#elif defined(__AVR_ATmega328P__)
+  OCR2B = (uint8_t)(sample + SILENCE);
+#endif
+}
@@ -35,16 +35,40 @@
 #include "interrupts.h"
 #include "buffer.h"
 #include "dac.h"
+#include "sparse.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define SILENCE (0x80)
+
+/* Give up the playback after this number of consecutive read errors */
+#define MAX_CONSECUTIVE_READ_ERRORS (8)
 
 /*****************************************************************************
 * Globals
 ******************************************************************************/
 struct {
   t_notify_eof notify_eof;
-  uint32_t start_sector;
-  uint32_t current_sector;
-  uint32_t end_sector;
+  uint32_t start_address;
+  uint32_t current_address;
+  uint32_t end_address;
   uint8_t eof;
+  uint8_t consecutive_errors;
+  uint16_t read_errors;
+  
+  /* Ring mode: bytes left to play, read across the chunk markers */
+  t_ring ring;
+  uint32_t remaining;
+  
+  /* Sparse recording: samples read, next gap and silence left to play */
+  uint8_t sparse;
+  uint8_t nb_gaps;
+  uint8_t gap_index;
+  uint32_t nb_bytes;
+  uint32_t played;
+  t_sparse_gap gap;
+  uint32_t gap_left;
 } player;
 
 struct {
@@ -56,6 +80,13 @@ struct {
 * Local prototypes
 ******************************************************************************/
 void buffer_empty_handler(void);
+uint8_t player_read(uint32_t address, uint8_t* buffer, uint16_t length);
+static void player_begin(t_notify_eof notify_eof);
+static void player_fill(uint8_t* buffer);
+static void player_rewind(void);
+static void player_next_gap(void);
+static void player_fill_sparse(uint8_t* buffer, uint16_t size);
+static uint8_t player_at_end(void);
 
 /*****************************************************************************
 * Functions
@@ -85,11 +116,49 @@ void player_set_option(uint8_t option, uint32_t value)
 void player_start(uint32_t start_sector, uint16_t nb_sectors, t_notify_eof notify_eof)
 {
   /* Init the player context */
-  player.start_sector = start_sector;
-  player.current_sector = start_sector;
-  player.end_sector = start_sector + nb_sectors;
+  player.start_address = start_sector << 9;
+  player.current_address = player.start_address;
+  player.end_address = (start_sector + nb_sectors) << 9;
+  player.ring.nb_chunks = 0;
+  
+  /* A sparse recording starts with its header */
+  player.sparse = 0;
+  if (nb_sectors > 1)
+  {
+    t_sparse_header header;
+    
+    if (sd_raw_read(player.start_address, (uint8_t*)&header, sizeof(header)) &&
+        (memcmp_P(header.magic, PSTR(SPARSE_MAGIC), sizeof(header.magic)) == 0))
+    {
+      player.sparse = 1;
+      player.nb_bytes = header.nb_bytes;
+      player.nb_gaps = header.nb_gaps;
+    }
+  }
+  player_rewind();
+  
+  player_begin(notify_eof);
+}
+
+/* Play nb_sectors of audio of a ring from address, see ring.c */
+void player_start_ring(const t_ring* ring, uint32_t address, uint32_t nb_sectors, t_notify_eof notify_eof)
+{
+  player.ring = *ring;
+  player.current_address = address;
+  player.remaining = nb_sectors << 9;
+  player.sparse = 0;
+  
+  player_begin(notify_eof);
+}
+
+static void player_begin(t_notify_eof notify_eof)
+{
+  t_pcm_pool* pool = &pcm_pools[STREAM_PLAYBACK];
+  
   player.eof = 0;
   player.notify_eof = notify_eof;
+  player.consecutive_errors = 0;
+  player.read_errors = 0;
 
   /* Init the DAC */
   if (player_options.sampling_rate == 0)
@@ -98,14 +167,14 @@ void player_start(uint32_t start_sector, uint16_t nb_sectors, t_notify_eof notif
     dac_init(player_options.sampling_rate);
 
   /* Do some pre-buffering */
-  sd_raw_read(player.current_sector << 9, pcm_buffer, PCM_BUFFER_SIZE * 2);
-  player.current_sector += 2;
+  player_fill(pool->start);
+  player_fill(pool->start + pool->size);
 
   /* Set the buffer event handler */
-  set_buffer_event_handler(&buffer_empty_handler);
+  set_buffer_event_handler(STREAM_PLAYBACK, &buffer_empty_handler);
 
   /* Start the DAC */
-  dac_start(pcm_buffer, pcm_buffer + PCM_BUFFER_SIZE, PCM_BUFFER_SIZE);
+  dac_start(pool->start, pool->start + pool->size, pool->size);
 }
 
 void player_stop(void)
@@ -113,37 +182,166 @@ void player_stop(void)
   dac_stop();
   
   /* Reset the buffer event handler */
-  set_buffer_event_handler(NULL);
+  set_buffer_event_handler(STREAM_PLAYBACK, NULL);
   
   /* Reset the context */
-  player.current_sector = 0;
-  player.end_sector = 0;
+  player.current_address = 0;
+  player.end_address = 0;
   player.eof = 0;
   player.notify_eof = NULL;
 }
 
+uint16_t player_get_read_errors(void)
+{
+  return player.read_errors;
+}
+
+uint8_t player_read(uint32_t address, uint8_t* buffer, uint16_t length)
+{
+  if (sd_raw_read(address, buffer, length))
+  {
+    player.consecutive_errors = 0;
+    return 1;
+  }
+
+  /* Play silence instead of the missing samples */
+  memset(buffer, SILENCE, length);
+
+  player.read_errors++;
+  if (player.consecutive_errors < 0xFF)
+    player.consecutive_errors++;
+
+  return 0;
+}
+
+/* Back to the beginning of the content */
+static void player_rewind(void)
+{
+  player.current_address = player.start_address;
+  
+  if (player.sparse)
+  {
+    player.current_address += 512;
+    player.played = 0;
+    player.gap_index = 0;
+    player.gap_left = 0;
+    player_next_gap();
+  }
+}
+
+/* Sparse recording: read the gap entry at gap_index, none after the last */
+static void player_next_gap(void)
+{
+  if ((player.gap_index >= player.nb_gaps) ||
+      !sd_raw_read(player.start_address + SPARSE_GAP_OFFSET + player.gap_index * sizeof(t_sparse_gap),
+                   (uint8_t*)&player.gap, sizeof(t_sparse_gap)))
+  {
+    player.gap.at = 0xFFFFFFFF;
+    player.gap.length = 0;
+  }
+}
+
+/* Sparse recording: the written samples with the gaps in between */
+static void player_fill_sparse(uint8_t* buffer, uint16_t size)
+{
+  while (size)
+  {
+    uint32_t length;
+    
+    if (!player.gap_left && (player.played == player.gap.at))
+    {
+      /* Start of a gap */
+      player.gap_left = player.gap.length;
+      player.gap_index++;
+      player_next_gap();
+      continue;
+    }
+    
+    if (player.gap_left)
+    {
+      length = (player.gap_left < size) ? player.gap_left : size;
+      memset(buffer, SILENCE, length);
+      player.gap_left -= length;
+    }
+    else
+    {
+      /* Up to the next gap or the end */
+      length = ((player.gap.at < player.nb_bytes) ? player.gap.at : player.nb_bytes) - player.played;
+      if (length > size)
+        length = size;
+      
+      if (length == 0)
+      {
+        memset(buffer, SILENCE, size);
+        break;
+      }
+      
+      player_read(player.current_address, buffer, (uint16_t)length);
+      player.current_address += length;
+      player.played += length;
+    }
+    
+    buffer += length;
+    size -= (uint16_t)length;
+  }
+}
+
+/* Read the next buffer of the pool */
+static void player_fill(uint8_t* buffer)
+{
+  uint16_t size = pcm_pools[STREAM_PLAYBACK].size;
+  
+  if (player.sparse)
+  {
+    player_fill_sparse(buffer, size);
+    return;
+  }
+  
+  player_read(player.current_address, buffer, size);
+  player.current_address += size;
+  
+  if (player.ring.nb_chunks)
+  {
+    player.current_address = ring_next_address(&player.ring, player.current_address);
+    player.remaining = (player.remaining > size) ? player.remaining - size : 0;
+  }
+}
+
+/* Nothing left to play */
+static uint8_t player_at_end(void)
+{
+  if (player.ring.nb_chunks)
+    return (player.remaining == 0);
+  
+  if (player.sparse)
+    return (player.played >= player.nb_bytes) && !player.gap_left && (player.gap.at != player.played);
+  
+  return (player.current_address >= player.end_address);
+}
+
 void buffer_empty_handler(void)
 {
   uint8_t* p;
-  uint32_t rd_address = player.current_sector << 9;
   
   if (empty_buffer_flag)
   {
       //printf("E");
     
-      p = (uint8_t*)pcm_buffer + (empty_buffer_flag & 0x1) * PCM_BUFFER_SIZE;
-      sd_raw_read(rd_address, p, PCM_BUFFER_SIZE);
-      player.current_sector++;
+      p = buffer_get_half(STREAM_PLAYBACK, empty_buffer_flag);
+      player_fill(p);
       
       /* Reset the flag */
       empty_buffer_flag = 0;
       
-      /* Detect end of file */
-      if ((player.eof == 0) && (player.current_sector >= player.end_sector))
+      /* Detect end of file, or a card which does not answer anymore */
+      if ((player.eof == 0) &&
+          (player_at_end() ||
+           (player.consecutive_errors >= MAX_CONSECUTIVE_READ_ERRORS)))
       {
-        if (player_options.loop_mode)
+        if (player_options.loop_mode && !player.ring.nb_chunks &&
+            (player.consecutive_errors < MAX_CONSECUTIVE_READ_ERRORS))
         {
-          player.current_sector = player.start_sector;
+          player_rewind();
         }
         else
         {
@@ -23,6 +23,8 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include "ring.h"
+
 typedef void (*t_notify_eof)(void);
 
 enum {
@@ -33,6 +35,8 @@ enum {
 void player_init(void);
 void player_set_option(uint8_t option, uint32_t value);
 void player_start(uint32_t start_sector, uint16_t nb_sectors, t_notify_eof notify_eof);
+void player_start_ring(const t_ring* ring, uint32_t address, uint32_t nb_sectors, t_notify_eof notify_eof);
 void player_stop(void);
+uint16_t player_get_read_errors(void);
 
 #endif /* PLAYER_H */
\ No newline at end of file
@@ -37,6 +37,28 @@
 #include "buffer.h"
 #include "adc.h"
 #include "delay.h"
+#include "ring.h"
+#include "sparse.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+
+#define SILENCE (0x80)
+
+/* Give up the recording after this number of consecutive write errors */
+#define MAX_CONSECUTIVE_WRITE_ERRORS (8)
+
+/* Samples recorded before the voice activity trigger */
+#define DEFAULT_PREROLL_MS (RECORDER_MAX_PREROLL_MS)
+
+/* Silence after the voice which ends the recording */
+#define DEFAULT_AUTO_STOP_MS (2000)
+#define CAPTURE_RATE (8000)
+
+/* Sparse mode: gaps kept until the end of the recording, the following
+   quiet buffers are written */
+#define RECORDER_MAX_GAPS (4)
 
 /*****************************************************************************
 * Globals
@@ -44,42 +66,138 @@
 struct {
   t_recorder_notify_eof notify_eof;
   void* opaque;
-  uint32_t start_sector;
-  uint32_t current_sector;
-  uint32_t end_sector;
+  uint32_t start_address;
+  uint32_t current_address;
+  uint32_t end_address;
   uint8_t eof;
   uint8_t loop_mode;
+  uint8_t consecutive_errors;
+  uint16_t write_errors;
+  
+  /* Loop mode: ring of chunks, the addresses are the ones of the chunk */
+  t_ring ring;
+  uint16_t chunk;
+  uint32_t seq;
+  
+  /* Sparse mode: the samples follow the header sector */
+  uint8_t sparse;
+  uint8_t nb_gaps;
+  t_sparse_gap gaps[RECORDER_MAX_GAPS];
 } recorder;
 
+struct {
+  uint16_t preroll_ms;
+  uint16_t auto_stop_ms;
+  uint8_t loop_mode;
+  uint8_t sparse_level;
+  uint8_t erase_unused;
+} recorder_options = { DEFAULT_PREROLL_MS, DEFAULT_AUTO_STOP_MS, 0, 0, 0 };
+
 /*****************************************************************************
 * Local prototypes
 ******************************************************************************/
 void buffer_full_handler(void);
+static void recorder_enter_chunk(uint8_t nb_sectors);
+static uint8_t recorder_skip_quiet(const uint8_t* p, uint16_t length);
+static void recorder_write_sparse_header(void);
 
 /*****************************************************************************
 * Functions
 ******************************************************************************/
 
+void recorder_set_option(uint8_t option, uint32_t value)
+{
+  switch(option)
+  {
+    case RECORDER_OPTION_PREROLL_MS:
+      recorder_options.preroll_ms = (value > RECORDER_MAX_PREROLL_MS ? RECORDER_MAX_PREROLL_MS : (uint16_t)value);
+      break;
+      
+    case RECORDER_OPTION_AUTO_STOP_MS:
+      recorder_options.auto_stop_ms = (uint16_t)value;
+      break;
+      
+    case RECORDER_OPTION_LOOP_MODE:
+      recorder_options.loop_mode = (value > 0 ? 1 : 0);
+      break;
+      
+    case RECORDER_OPTION_SPARSE_LEVEL:
+      recorder_options.sparse_level = (value > 0x7F ? 0x7F : (uint8_t)value);
+      break;
+      
+    case RECORDER_OPTION_ERASE_UNUSED:
+      recorder_options.erase_unused = (value > 0 ? 1 : 0);
+      break;
+  }
+}
+
+/* Loop mode: write the audio sectors of the current chunk, from the
+   given one */
+static void recorder_enter_chunk(uint8_t nb_sectors)
+{
+  recorder.start_address = ring_chunk_address(&recorder.ring, recorder.chunk) + 512;
+  recorder.current_address = recorder.start_address + ((uint32_t)nb_sectors << 9);
+  recorder.end_address = recorder.start_address + ((uint32_t)RING_AUDIO_SECTORS << 9);
+}
+
 void recorder_start(uint32_t start_sector, uint16_t max_sectors, t_recorder_notify_eof notify_eof, void* opaque)
 {
+  t_pcm_pool* pool = &pcm_pools[STREAM_CAPTURE];
+  
   /* Init the recorder context */
-  recorder.start_sector = start_sector;
-  recorder.current_sector = start_sector;
-  recorder.end_sector = start_sector + max_sectors;
+  recorder.start_address = start_sector << 9;
+  recorder.current_address = recorder.start_address;
+  recorder.end_address = (start_sector + max_sectors) << 9;
   recorder.notify_eof = notify_eof;
   recorder.opaque = opaque;
   recorder.eof = 0;
+  recorder.consecutive_errors = 0;
+  recorder.write_errors = 0;
   
-  recorder.loop_mode = 0;
+  recorder.loop_mode = recorder_options.loop_mode &&
+                       ring_init(&recorder.ring, start_sector, max_sectors);
   
-  /* Init the ADC */
-  adc_init(1);
+  if (recorder.loop_mode)
+  {
+    t_ring_head head;
+    uint8_t nb_sectors = 0;
+    
+    /* Resume after the newest audio, within its chunk if not full */
+    recorder.chunk = 0;
+    recorder.seq = 0;
+    if (ring_find_head(&recorder.ring, &head))
+    {
+      recorder.seq = head.seq;
+      if (head.nb_sectors < RING_AUDIO_SECTORS)
+        nb_sectors = head.nb_sectors;
+      else
+        recorder.seq++;
+      recorder.chunk = (uint16_t)(recorder.seq % recorder.ring.nb_chunks);
+    }
+    recorder_enter_chunk(nb_sectors);
+    
+    /* Everything is recorded, sector aligned */
+    adc_init(0);
+  }
+  else
+  {
+    /* Init the ADC */
+    adc_init(1);
+    adc_set_preroll((uint16_t)((uint32_t)recorder_options.preroll_ms * CAPTURE_RATE / 1000));
+    adc_set_auto_stop((uint16_t)((uint32_t)recorder_options.auto_stop_ms * CAPTURE_RATE / 1000));
+  }
+  
+  /* Sparse mode: keep the first sector for the header */
+  recorder.sparse = !recorder.loop_mode && recorder_options.sparse_level && (max_sectors > 1);
+  recorder.nb_gaps = 0;
+  if (recorder.sparse)
+    recorder.current_address += 512;
 
   /* Set the buffer event handler */
-  set_buffer_event_handler(&buffer_full_handler);
+  set_buffer_event_handler(STREAM_CAPTURE, &buffer_full_handler);
 
   /* Start the ADC */
-  adc_start(pcm_buffer, pcm_buffer + PCM_BUFFER_SIZE, PCM_BUFFER_SIZE);
+  adc_start(pool->start, pool->start + pool->size, pool->size);
 }
 
 void recorder_stop(uint16_t* nb_written_sectors)
@@ -88,45 +206,174 @@ void recorder_stop(uint16_t* nb_written_sectors)
   adc_stop();
   adc_shutdown();
   
-  /* Pad the remaining sectors with silence */
-  memset(pcm_buffer, 0x00, PCM_BUFFER_SIZE);
-  for(uint32_t sector = recorder.current_sector; sector < recorder.end_sector; sector++)
+  t_pcm_pool* pool = &pcm_pools[STREAM_CAPTURE];
+  
+  if (recorder.loop_mode)
+  {
+    /* Mark the chunk in progress, the next recording resumes in it */
+    uint8_t nb_sectors = (uint8_t)((recorder.current_address - recorder.start_address) >> 9);
+    if (nb_sectors && !ring_write_marker(&recorder.ring, recorder.chunk, recorder.seq, nb_sectors))
+      recorder.write_errors++;
+    
+    /* The marker of the last chunk is still in the write buffer */
+    if (!sd_raw_sync())
+      recorder.write_errors++;
+  }
+  else if (recorder.sparse)
   {
-    uint32_t wr_address = sector << 9;
-    sd_raw_write(wr_address, pcm_buffer, PCM_BUFFER_SIZE);
+    /* The gaps stand for the silence, up to the end of the slot */
+    recorder_write_sparse_header();
+  }
+  else
+  {
+    /* Only the last sector is completed with silence, the content size
+       of the slot ends there */
+    uint16_t length = (uint16_t)(recorder.current_address & 511);
+    
+    if (length)
+    {
+      length = 512 - length;
+      memset(pool->start, SILENCE, length);
+      if (!sd_raw_write(recorder.current_address, pool->start, length))
+        recorder.write_errors++;
+    }
+    
+    /* The rest of the slot in a single erase command, if asked for */
+    if (recorder_options.erase_unused)
+    {
+      uint32_t first_sector = (recorder.current_address + 511) >> 9;
+      uint32_t end_sector = recorder.end_address >> 9;
+      
+      if ((first_sector < end_sector) && !sd_raw_erase_blocks(first_sector, end_sector - first_sector))
+        recorder.write_errors++;
+    }
   }
   
   /* Reset the buffer event handler */
-  set_buffer_event_handler(NULL);
+  set_buffer_event_handler(STREAM_CAPTURE, NULL);
   
-  /* Return the number of written sectors */
+  /* Return the number of written sectors, the last one may be partial */
   if (nb_written_sectors)
-    *nb_written_sectors = (uint16_t)(recorder.current_sector - recorder.start_sector);
+    *nb_written_sectors = (uint16_t)((recorder.current_address - recorder.start_address + 511) >> 9);
+}
+
+uint16_t recorder_get_write_errors(void)
+{
+  return recorder.write_errors;
+}
+
+/* Sparse mode: a quiet buffer extends or opens a gap instead of being
+   written, as long as there is room for the gap */
+static uint8_t recorder_skip_quiet(const uint8_t* p, uint16_t length)
+{
+  uint8_t level = recorder_options.sparse_level;
+  uint32_t at = recorder.current_address - recorder.start_address - 512;
+  t_sparse_gap* gap;
+  
+  for (uint16_t i = 0; i < length; i++)
+  {
+    /* Within the level around the mid-scale */
+    if ((uint8_t)(p[i] - (0x80 - level)) > (uint8_t)(2 * level))
+      return 0;
+  }
+  
+  gap = &recorder.gaps[recorder.nb_gaps];
+  if (recorder.nb_gaps && (gap[-1].at == at))
+  {
+    gap--;
+  }
+  else
+  {
+    if (recorder.nb_gaps == RECORDER_MAX_GAPS)
+      return 0;
+    
+    recorder.nb_gaps++;
+    gap->at = at;
+    gap->length = 0;
+  }
+  
+  gap->length += length;
+  return 1;
+}
+
+/* Sparse mode: header and gap list in the first sector, with the
+   capture buffers as the ADC is stopped */
+static void recorder_write_sparse_header(void)
+{
+  t_pcm_pool* pool = &pcm_pools[STREAM_CAPTURE];
+  t_sparse_header* header = (t_sparse_header*)pool->start;
+  
+  memset(pool->start, 0x00, 512);
+  memcpy_P(header->magic, PSTR(SPARSE_MAGIC), sizeof(header->magic));
+  header->nb_bytes = recorder.current_address - recorder.start_address - 512;
+  header->nb_gaps = recorder.nb_gaps;
+  memcpy(pool->start + SPARSE_GAP_OFFSET, recorder.gaps, recorder.nb_gaps * sizeof(t_sparse_gap));
+  
+  if (!sd_raw_write(recorder.start_address, pool->start, 512))
+    recorder.write_errors++;
 }
 
 void buffer_full_handler(void)
 {
   uint8_t* p;
-  uint32_t wr_address = recorder.current_sector << 9;
+  uint16_t length;
+  uint8_t last;
   
   if (buffer_full_flag)
   {
       //printf("F");
       
-      /* Write data in raw sector */
-      p = (uint8_t*)pcm_buffer + (buffer_full_flag & 0x1) * PCM_BUFFER_SIZE;
-      sd_raw_write(wr_address, p, PCM_BUFFER_SIZE);
-      recorder.current_sector++;
+      /* Write data in raw sector, the pre-roll moves the following buffers
+         off the sector boundaries */
+      p = adc_get_buffer(buffer_full_flag, &length);
+      last = buffer_full_flag & ADC_FLAG_LAST;
+      
+      if (recorder.sparse && recorder_skip_quiet(p, length))
+      {
+        /* Nothing to write */
+      }
+      else
+      {
+        if (length > recorder.end_address - recorder.current_address)
+          length = (uint16_t)(recorder.end_address - recorder.current_address);
+        
+        if (sd_raw_write(recorder.current_address, p, length))
+        {
+          /* Only a write which starts a sector reaches the card, the
+             others are merged in the block cache */
+          if (((recorder.current_address & 511) == 0) ||
+              ((recorder.current_address & 511) + length > 512))
+            recorder.consecutive_errors = 0;
+        }
+        else
+        {
+          /* The samples are lost, keep going on the next buffer */
+          recorder.write_errors++;
+          if (recorder.consecutive_errors < 0xFF)
+            recorder.consecutive_errors++;
+        }
+        recorder.current_address += length;
+      }
       
       /* Reset the flag */
-      buffer_full_flag = 0;
+      adc_release_buffer();
       
-      /* Detect end of file */
-      if ((recorder.eof == 0) && (recorder.current_sector >= recorder.end_sector))
+      /* Detect end of file, the silence after the voice, or a card which
+         does not answer anymore */
+      if ((recorder.eof == 0) &&
+          (last ||
+           (recorder.current_address >= recorder.end_address) ||
+           (recorder.consecutive_errors >= MAX_CONSECUTIVE_WRITE_ERRORS)))
       {
-        if (recorder.loop_mode)
+        if (recorder.loop_mode && !last && (recorder.consecutive_errors < MAX_CONSECUTIVE_WRITE_ERRORS))
         {
-          recorder.current_sector = recorder.start_sector;
+          /* Chunk complete: mark it and go on with the next one */
+          if (!ring_write_marker(&recorder.ring, recorder.chunk, recorder.seq, RING_AUDIO_SECTORS))
+            recorder.write_errors++;
+          
+          recorder.seq++;
+          recorder.chunk = (uint16_t)(recorder.seq % recorder.ring.nb_chunks);
+          recorder_enter_chunk(0);
         }
         else
         {
@@ -23,9 +23,26 @@
 #ifndef RECORDER_H
 #define RECORDER_H
 
+#include "buffer.h"
+
 typedef void (*t_recorder_notify_eof)(void* opaque);
 
+enum {
+  RECORDER_OPTION_PREROLL_MS,
+  RECORDER_OPTION_AUTO_STOP_MS,
+  RECORDER_OPTION_LOOP_MODE,
+  RECORDER_OPTION_SPARSE_LEVEL,
+  RECORDER_OPTION_ERASE_UNUSED,
+};
+
+/* The pre-roll is kept in the capture buffer which is not being filled:
+   one buffer at most, PCM_BUFFER_SIZE samples at 8000 Hz. That is 64 ms
+   with the default halves of a sector */
+#define RECORDER_MAX_PREROLL_MS (PCM_BUFFER_SIZE / 8)
+
+void recorder_set_option(uint8_t option, uint32_t value);
 void recorder_start(uint32_t start_sector, uint16_t max_sectors, t_recorder_notify_eof notify_eof, void* opaque);
 void recorder_stop(uint16_t* nb_written_sectors);
+uint16_t recorder_get_write_errors(void);
 
 #endif /* RECORDER_H */
\ No newline at end of file
@@ -0,0 +1,216 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Ring of audio chunks on the card
+*
+* The region is cut in chunks of RING_CHUNK_SECTORS sectors. The first
+* sector of a chunk holds a marker, written once the audio sectors behind
+* it are: the sequence number of the chunk and its number of audio
+* sectors. The recording goes on at the chunk after the newest one, with
+* the next sequence number, so the chunk of sequence seq is always
+* seq % nb_chunks.
+*
+* From chunk 0 the sequence numbers rise up to the newest chunk, then
+* fall to older or missing markers. The newest chunk is found with a
+* binary search on "marker valid and seq >= seq of chunk 0", in
+* log2(nb_chunks) + 1 marker reads.
+*
+* The chunk after the newest one may have been overwritten in part by a
+* recording stopped by a reset, its marker being the old one: it is not
+* played back.
+*
+* A marker is built in the write buffer of sd_raw, without reading its
+* sector, and stays there: the write of the next audio sector puts it on
+* the card. The buffer refill which ends a chunk writes two sectors, the
+* last two audio ones, instead of reading one and writing three. A reset
+* before the marker is written loses the chunk.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "sd_raw.h"
+
+#include "ring.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define RING_MAGIC "RING"
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  char     magic[4];
+  uint32_t seq;
+  uint8_t  nb_sectors;
+  uint8_t  check;
+} t_ring_marker;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static uint8_t ring_marker_check(const t_ring_marker* marker);
+static uint8_t ring_read_marker(const t_ring* ring, uint16_t chunk, t_ring_marker* marker);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Returns 0 when the region does not hold two chunks */
+uint8_t ring_init(t_ring* ring, uint32_t start_sector, uint32_t nb_sectors)
+{
+  ring->start_sector = start_sector;
+  ring->nb_chunks = (uint16_t)(nb_sectors / RING_CHUNK_SECTORS);
+  
+  return (ring->nb_chunks >= 2);
+}
+
+/* Byte address of the marker of a chunk */
+uint32_t ring_chunk_address(const t_ring* ring, uint16_t chunk)
+{
+  return (ring->start_sector + (uint32_t)chunk * RING_CHUNK_SECTORS) << 9;
+}
+
+static uint8_t ring_marker_check(const t_ring_marker* marker)
+{
+  const uint8_t* p = (const uint8_t*)&marker->seq;
+  
+  return p[0] ^ p[1] ^ p[2] ^ p[3] ^ marker->nb_sectors ^ 0x5A;
+}
+
+uint8_t ring_write_marker(const t_ring* ring, uint16_t chunk, uint32_t seq, uint8_t nb_sectors)
+{
+  t_ring_marker marker;
+  
+  memcpy_P(marker.magic, PSTR(RING_MAGIC), sizeof(marker.magic));
+  marker.seq = seq;
+  marker.nb_sectors = nb_sectors;
+  marker.check = ring_marker_check(&marker);
+  
+  /* On the card with the next write, after the audio sectors */
+  return sd_raw_write_padded(ring_chunk_address(ring, chunk), (uint8_t*)&marker, sizeof(marker));
+}
+
+/* Returns 0 for a missing marker or a read error */
+static uint8_t ring_read_marker(const t_ring* ring, uint16_t chunk, t_ring_marker* marker)
+{
+  if (!sd_raw_read(ring_chunk_address(ring, chunk), (uint8_t*)marker, sizeof(*marker)))
+    return 0;
+  
+  return !memcmp_P(marker->magic, PSTR(RING_MAGIC), sizeof(marker->magic)) &&
+         (marker->check == ring_marker_check(marker)) &&
+         (marker->nb_sectors <= RING_AUDIO_SECTORS) &&
+         ((uint16_t)(marker->seq % ring->nb_chunks) == chunk);
+}
+
+/* Returns 0 for an empty ring */
+uint8_t ring_find_head(const t_ring* ring, t_ring_head* head)
+{
+  t_ring_marker marker;
+  uint32_t first_seq;
+  uint16_t low = 0;
+  uint16_t high = ring->nb_chunks - 1;
+  
+  /* The recording starts at chunk 0 */
+  if (!ring_read_marker(ring, 0, &marker))
+    return 0;
+  
+  first_seq = marker.seq;
+  head->chunk = 0;
+  head->seq = marker.seq;
+  head->nb_sectors = marker.nb_sectors;
+  
+  /* Last chunk of the rising sequence */
+  while (low < high)
+  {
+    uint16_t middle = low + (high - low + 1) / 2;
+    
+    if (ring_read_marker(ring, middle, &marker) && (marker.seq >= first_seq))
+    {
+      low = middle;
+      head->chunk = middle;
+      head->seq = marker.seq;
+      head->nb_sectors = marker.nb_sectors;
+    }
+    else
+    {
+      high = middle - 1;
+    }
+  }
+  
+  return 1;
+}
+
+/* Address after a sector of audio: over the next marker, back to chunk 0
+   at the end of the region */
+uint32_t ring_next_address(const t_ring* ring, uint32_t address)
+{
+  uint32_t offset = address - (ring->start_sector << 9);
+  
+  if ((offset & (((uint32_t)RING_CHUNK_SECTORS << 9) - 1)) == 0)
+  {
+    if (offset >= ((uint32_t)ring->nb_chunks * RING_CHUNK_SECTORS) << 9)
+      offset = 0;
+    
+    offset += 512;
+  }
+  
+  return (ring->start_sector << 9) + offset;
+}
+
+/* Start address of the last nb_sectors of audio, returns the number of
+   sectors available up to nb_sectors. Only the newest chunk can be
+   partial, a recording resumes in it */
+uint32_t ring_get_last(const t_ring* ring, const t_ring_head* head, uint32_t nb_sectors, uint32_t* address)
+{
+  uint16_t chunk = head->chunk;
+  uint32_t available = head->nb_sectors;
+  
+  /* Complete chunks before the newest one, without the one after it */
+  uint32_t nb_older = head->seq;
+  if (nb_older > (uint32_t)ring->nb_chunks - 2)
+    nb_older = ring->nb_chunks - 2;
+  
+  while ((available < nb_sectors) && nb_older)
+  {
+    chunk = (chunk == 0) ? ring->nb_chunks - 1 : chunk - 1;
+    available += RING_AUDIO_SECTORS;
+    nb_older--;
+  }
+  
+  /* Skip the beginning of the oldest chunk played */
+  *address = ring_chunk_address(ring, chunk) + 512;
+  if (available > nb_sectors)
+  {
+    *address += (available - nb_sectors) << 9;
+    available = nb_sectors;
+  }
+  
+  return available;
+}
@@ -0,0 +1,49 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef RING_H
+#define RING_H
+
+/* Chunks of a marker sector followed by the audio sectors, 4 s at 8 kHz */
+#define RING_CHUNK_SECTORS  (64)
+#define RING_AUDIO_SECTORS  (RING_CHUNK_SECTORS - 1)
+
+typedef struct {
+  uint32_t start_sector;
+  uint16_t nb_chunks;
+} t_ring;
+
+/* Newest chunk written */
+typedef struct {
+  uint16_t chunk;
+  uint32_t seq;
+  uint8_t  nb_sectors;
+} t_ring_head;
+
+uint8_t ring_init(t_ring* ring, uint32_t start_sector, uint32_t nb_sectors);
+uint32_t ring_chunk_address(const t_ring* ring, uint16_t chunk);
+uint8_t ring_write_marker(const t_ring* ring, uint16_t chunk, uint32_t seq, uint8_t nb_sectors);
+uint8_t ring_find_head(const t_ring* ring, t_ring_head* head);
+uint32_t ring_next_address(const t_ring* ring, uint32_t address);
+uint32_t ring_get_last(const t_ring* ring, const t_ring_head* head, uint32_t nb_sectors, uint32_t* address);
+
+#endif /* RING_H */
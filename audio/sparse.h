@@ -0,0 +1,45 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+/* Sparse recording: the first sector of the recording holds the header
+   and the gap list, the samples which are not silence follow packed from
+   the second sector. The player inserts the gaps back */
+#define SPARSE_MAGIC      "SPRS"
+#define SPARSE_GAP_OFFSET (16)
+
+typedef struct {
+  char     magic[4];
+  uint32_t nb_bytes;     /* Samples written after the header sector */
+  uint8_t  nb_gaps;
+  uint8_t  reserved[7];
+} t_sparse_header;
+
+/* Silence inserted after nb_bytes written samples */
+typedef struct {
+  uint32_t at;
+  uint32_t length;
+} t_sparse_gap;
+
+#endif /* SPARSE_H */
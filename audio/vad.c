@@ -0,0 +1,161 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Voice activity detector
+*
+* Works on the mean absolute deviation from the midscale of a block of
+* samples: the caller only adds up |sample - 128| in the sample interrupt.
+*
+* The noise floor follows the quiet blocks at once and the louder ones
+* slowly, so a steady noise ends up as the floor. The voice starts after
+* VAD_ATTACK_BLOCKS blocks above the upper threshold, a single click
+* does not last that long. It ends after VAD_RELEASE_BLOCKS blocks below
+* the lower threshold, which keeps the gaps between words in the
+* recording. VAD_END is reported once the silence lasted stop_blocks.
+*
+* The floor is in 8.8 fixed point, the levels are integers.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "vad.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define VAD_ATTACK_BLOCKS   (3)   /* 24 ms */
+#define VAD_RELEASE_BLOCKS  (38)  /* 300 ms */
+
+/* Thresholds over the floor: on above 2 x floor + 4, off below 1.5 x floor + 2 */
+#define VAD_ON_MARGIN       (4)
+#define VAD_OFF_MARGIN      (2)
+
+/* Floor time constants in blocks, as shifts */
+#define VAD_FLOOR_DOWN      (2)   /* 32 ms */
+#define VAD_FLOOR_UP        (7)   /* 1 s */
+#define VAD_FLOOR_UP_VOICE  (9)   /* 4 s, for a noise which started as a voice */
+
+#define VAD_MIN_FLOOR       (1 << 8)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  uint16_t floor;
+  uint8_t  voice;
+  uint8_t  attack;
+  uint8_t  release;
+  uint8_t  ended;
+  uint16_t silence;
+  uint16_t stop_blocks;
+} vad;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* stop_blocks: blocks of silence after a voice until VAD_END, 0 for never */
+void vad_init(uint16_t stop_blocks)
+{
+  memset(&vad, 0x00, sizeof(vad));
+  vad.floor = VAD_MIN_FLOOR;
+  vad.stop_blocks = stop_blocks;
+}
+
+/* level: mean of |sample - 128| over the block */
+uint8_t vad_update(uint8_t level)
+{
+  uint16_t level_fp = (uint16_t)level << 8;
+  uint8_t noise = vad.floor >> 8;
+  
+  /* Noise floor, held while a voice may be starting */
+  if (level_fp < vad.floor)
+  {
+    vad.floor -= (vad.floor - level_fp) >> VAD_FLOOR_DOWN;
+  }
+  else if (vad.voice || !vad.attack)
+  {
+    uint16_t step = (level_fp - vad.floor) >> (vad.voice ? VAD_FLOOR_UP_VOICE : VAD_FLOOR_UP);
+    
+    /* Still rising once the difference is below the resolution */
+    if ((step == 0) && (level_fp > vad.floor))
+      step = 1;
+    vad.floor += step;
+  }
+  
+  if (vad.floor < VAD_MIN_FLOOR)
+    vad.floor = VAD_MIN_FLOOR;
+  
+  /* Hysteresis on the level, thresholds from the floor before this block */
+  if (level > 2 * noise + VAD_ON_MARGIN)
+  {
+    vad.release = 0;
+    if (!vad.voice && (++vad.attack >= VAD_ATTACK_BLOCKS))
+    {
+      vad.voice = 1;
+      vad.ended = 0;
+      vad.silence = 0;
+    }
+  }
+  else
+  {
+    vad.attack = 0;
+    
+    if (level < noise + (noise >> 1) + VAD_OFF_MARGIN)
+    {
+      if (vad.voice && (++vad.release >= VAD_RELEASE_BLOCKS))
+      {
+        vad.voice = 0;
+        vad.release = 0;
+        vad.silence = VAD_RELEASE_BLOCKS;
+      }
+    }
+    else
+    {
+      /* Between the thresholds: keep the current state */
+      vad.release = 0;
+    }
+  }
+  
+  if (vad.voice)
+    return VAD_VOICE;
+  
+  /* Auto-stop after a voice */
+  if (vad.silence && !vad.ended)
+  {
+    if (vad.silence < 0xFFFF)
+      vad.silence++;
+    
+    if (vad.stop_blocks && (vad.silence >= vad.stop_blocks))
+    {
+      vad.ended = 1;
+      return VAD_END;
+    }
+  }
+  
+  return VAD_SILENCE;
+}
@@ -0,0 +1,39 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef VAD_H
+#define VAD_H
+
+/* Blocks of 64 samples, 8 ms at 8 kHz */
+#define VAD_BLOCK_SHIFT (6)
+#define VAD_BLOCK_SIZE  (1 << VAD_BLOCK_SHIFT)
+
+enum {
+  VAD_SILENCE,
+  VAD_VOICE,
+  VAD_END, /* Silence for the auto-stop time after a voice */
+};
+
+void vad_init(uint16_t stop_blocks);
+uint8_t vad_update(uint8_t level);
+
+#endif /* VAD_H */
@@ -0,0 +1,580 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Cycle-accurate benchmark
+*
+* Runs apps/bench/bench.elf in simavr with the SD card model of host/ on
+* the SPI bus and a 440 Hz sine on ADC0. For each phase written by the
+* firmware to GPIOR0 it measures:
+*   - the cycles spent in the sample ISR (TIMER0_COMPA) and in the buffer
+*     refill ISR (TIMER0_COMPB), excluding the nested interrupts
+*   - the CPU load, i.e. the share of cycles not spent sleeping
+*   - the latency from the sample tick (compare match A) to the OCR2B write
+*     while playing, or to the ADC conversion start while recording
+*
+* Given a baseline file, the results are compared with it: any metric
+* above its baseline value by more than the tolerance is a regression, and
+* the exit status is 1. With -u the baseline is written instead. Without
+* one, the results are only reported.
+*
+* Baseline lines: <phase> <metric> <value>, after a comment line
+* "# <versions>" naming the toolchain and simulator which recorded it.
+* Cycle counts depend on both: the comparison warns when the versions
+* given with -V differ.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_io.h"
+#include "sim_interrupts.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+#include "avr_adc.h"
+
+#include "sim.h"
+#include "bench.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define MCU_NAME           "atmega328p"
+
+/* Data space addresses */
+#define GPIOR0_ADDR        (0x3e)
+#define OCR2B_ADDR         (0xb4)
+
+/* Interrupt vectors */
+#define VECTOR_TIMER0_COMPA  (14)
+#define VECTOR_TIMER0_COMPB  (15)
+
+#define MAX_NESTING        (8)
+#define MAX_CYCLES         SIM_MS(30000)
+
+/* ADC0 input: 440 Hz sine around midscale */
+#define ADC_VCC_MV         (5000)
+#define ADC_AMPLITUDE_MV   (2000)
+#define ADC_TONE_HZ        (440)
+
+/* Allowed increase of a metric over its baseline */
+#define DEFAULT_TOLERANCE  (2) /* % */
+
+enum {
+  ISR_SAMPLE,
+  ISR_REFILL,
+  NB_ISRS,
+};
+
+enum {
+  METRIC_SAMPLE_AVG,
+  METRIC_SAMPLE_MAX,
+  METRIC_REFILL_AVG,
+  METRIC_REFILL_MAX,
+  METRIC_LOAD,
+  METRIC_LATENCY_AVG,
+  METRIC_LATENCY_MAX,
+  NB_METRICS,
+};
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint32_t count;
+  uint64_t total;
+  uint32_t max;
+} t_stat;
+
+typedef struct {
+  uint64_t cycles;
+  uint64_t sleeping;
+  t_stat isr[NB_ISRS];
+  t_stat latency;
+} t_phase;
+
+typedef struct {
+  uint8_t isr;
+  uint64_t start;
+  uint64_t nested;
+} t_frame;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static const char* phase_names[BENCH_NB_PHASES] = {
+  "idle", "play_8000", "play_16000", "play_22050", "play_44100", "record_8000", "listen_8000", "done",
+};
+
+static const char* metric_names[NB_METRICS] = {
+  "sample_isr_avg", "sample_isr_max", "refill_isr_avg", "refill_isr_max",
+  "cpu_load_permille", "latency_avg", "latency_max",
+};
+
+static struct {
+  avr_t* avr;
+
+  uint8_t phase;
+  uint64_t phase_start;
+  t_phase phases[BENCH_NB_PHASES];
+
+  t_frame stack[MAX_NESTING];
+  uint8_t depth;
+
+  uint8_t tick_pending;
+  uint64_t tick;
+
+  uint8_t card_selected;
+  avr_irq_t* spi_input;
+  avr_irq_t* adc_input;
+} bench;
+
+/* Clock of the SD card model */
+uint64_t sim_cycles;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+static void usage(const char* name)
+{
+  fprintf(stderr,
+    "usage: %s [options] <bench.elf>\n"
+    "  -i <image>      SD card image (default ../sounds/babyphone.image)\n"
+    "  -b <file>       baseline to compare with, none by default\n"
+    "  -u              write the baseline instead (default baseline.txt)\n"
+    "  -T <percent>    allowed increase over the baseline (default %u)\n"
+    "  -V <versions>   toolchain and simulator versions of the run\n",
+    name, DEFAULT_TOLERANCE);
+  exit(2);
+}
+
+static uint8_t* load_file(const char* name, uint32_t* size)
+{
+  FILE* f = fopen(name, "rb");
+  uint8_t* data;
+  long length;
+
+  if (!f)
+  {
+    perror(name);
+    exit(2);
+  }
+
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  data = malloc(length ? length : 1);
+  if (!data || (fread(data, 1, length, f) != (size_t)length))
+  {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(2);
+  }
+
+  fclose(f);
+  *size = (uint32_t)length;
+  return data;
+}
+
+static void stat_add(t_stat* stat, uint64_t value)
+{
+  stat->count++;
+  stat->total += value;
+  if (value > stat->max)
+    stat->max = (uint32_t)value;
+}
+
+static uint32_t stat_avg(const t_stat* stat)
+{
+  return stat->count ? (uint32_t)((stat->total + stat->count / 2) / stat->count) : 0;
+}
+
+/* Phases */
+
+static void close_phase(void)
+{
+  bench.phases[bench.phase].cycles += bench.avr->cycle - bench.phase_start;
+  bench.phase_start = bench.avr->cycle;
+}
+
+static void gpior0_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+  avr->data[addr] = v;
+
+  if ((v < BENCH_NB_PHASES) && (v != bench.phase))
+  {
+    close_phase();
+    bench.phase = v;
+    bench.tick_pending = 0;
+  }
+}
+
+/* Interrupts */
+
+static void isr_running(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  uint8_t isr = (uint8_t)(uintptr_t)param;
+  uint64_t now = bench.avr->cycle;
+
+  if (value)
+  {
+    if (bench.depth < MAX_NESTING)
+    {
+      t_frame* frame = &bench.stack[bench.depth];
+      frame->isr = isr;
+      frame->start = now;
+      frame->nested = 0;
+    }
+    bench.depth++;
+  }
+  else if (bench.depth)
+  {
+    bench.depth--;
+    if (bench.depth < MAX_NESTING)
+    {
+      t_frame* frame = &bench.stack[bench.depth];
+      uint64_t elapsed = now - frame->start;
+
+      /* Only the cycles of this handler, the nested ones are counted apart */
+      stat_add(&bench.phases[bench.phase].isr[frame->isr], elapsed - frame->nested);
+
+      if (bench.depth)
+        bench.stack[bench.depth - 1].nested += elapsed;
+    }
+  }
+}
+
+/* Other vectors nesting in the audio ones (Timer1 tick) */
+static void other_running(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  uint64_t now = bench.avr->cycle;
+
+  if (value)
+  {
+    if (bench.depth < MAX_NESTING)
+    {
+      bench.stack[bench.depth].isr = NB_ISRS;
+      bench.stack[bench.depth].start = now;
+      bench.stack[bench.depth].nested = 0;
+    }
+    bench.depth++;
+  }
+  else if (bench.depth)
+  {
+    bench.depth--;
+    if (bench.depth && (bench.depth < MAX_NESTING))
+      bench.stack[bench.depth - 1].nested += now - bench.stack[bench.depth].start;
+  }
+}
+
+static void sample_tick(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  if (value)
+  {
+    bench.tick_pending = 1;
+    bench.tick = bench.avr->cycle;
+  }
+}
+
+static void sample_served(void)
+{
+  if (bench.tick_pending)
+  {
+    stat_add(&bench.phases[bench.phase].latency, bench.avr->cycle - bench.tick);
+    bench.tick_pending = 0;
+  }
+}
+
+/* DAC */
+
+static void ocr2b_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param)
+{
+  if ((bench.phase >= BENCH_PHASE_PLAY_8000) && (bench.phase <= BENCH_PHASE_PLAY_44100))
+    sample_served();
+}
+
+/* ADC */
+
+static void adc_trigger(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  double t = (double)bench.avr->cycle / bench.avr->frequency;
+  uint32_t mv = ADC_VCC_MV / 2 + (int32_t)(ADC_AMPLITUDE_MV * sin(2 * M_PI * ADC_TONE_HZ * t));
+
+  avr_raise_irq(bench.adc_input, mv);
+
+  if ((bench.phase == BENCH_PHASE_RECORD_8000) || (bench.phase == BENCH_PHASE_LISTEN_8000))
+    sample_served();
+}
+
+/* SD card on the SPI bus, selected by PB2 */
+
+static void card_select(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  bench.card_selected = !value;
+}
+
+static void spi_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+  sim_cycles = bench.avr->cycle;
+  avr_raise_irq(bench.spi_input, sdcard_transfer((uint8_t)value, bench.card_selected));
+}
+
+/* Results */
+
+static void get_metrics(const t_phase* phase, uint32_t metrics[NB_METRICS])
+{
+  metrics[METRIC_SAMPLE_AVG] = stat_avg(&phase->isr[ISR_SAMPLE]);
+  metrics[METRIC_SAMPLE_MAX] = phase->isr[ISR_SAMPLE].max;
+  metrics[METRIC_REFILL_AVG] = stat_avg(&phase->isr[ISR_REFILL]);
+  metrics[METRIC_REFILL_MAX] = phase->isr[ISR_REFILL].max;
+  metrics[METRIC_LOAD] = phase->cycles ?
+    (uint32_t)((phase->cycles - phase->sleeping) * 1000 / phase->cycles) : 0;
+  metrics[METRIC_LATENCY_AVG] = stat_avg(&phase->latency);
+  metrics[METRIC_LATENCY_MAX] = phase->latency.max;
+}
+
+static void report(void)
+{
+  printf("phase          sample isr       refill isr    load    latency\n");
+  printf("                avg    max      avg     max     %%     avg    max\n");
+
+  for (uint8_t i = BENCH_PHASE_PLAY_8000; i <= BENCH_PHASE_LISTEN_8000; i++)
+  {
+    uint32_t m[NB_METRICS];
+    get_metrics(&bench.phases[i], m);
+
+    printf("%-12s %5u %6u %8u %7u %5.1f %7u %6u\n", phase_names[i],
+           m[METRIC_SAMPLE_AVG], m[METRIC_SAMPLE_MAX],
+           m[METRIC_REFILL_AVG], m[METRIC_REFILL_MAX],
+           m[METRIC_LOAD] / 10.0,
+           m[METRIC_LATENCY_AVG], m[METRIC_LATENCY_MAX]);
+  }
+}
+
+static void write_baseline(const char* name, const char* versions)
+{
+  FILE* f = fopen(name, "w");
+
+  if (!f)
+  {
+    perror(name);
+    exit(2);
+  }
+
+  fprintf(f, "# %s\n", versions ? versions : "unknown versions");
+
+  for (uint8_t i = BENCH_PHASE_PLAY_8000; i <= BENCH_PHASE_LISTEN_8000; i++)
+  {
+    uint32_t m[NB_METRICS];
+    get_metrics(&bench.phases[i], m);
+
+    for (uint8_t j = 0; j < NB_METRICS; j++)
+      fprintf(f, "%s %s %u\n", phase_names[i], metric_names[j], m[j]);
+  }
+
+  fclose(f);
+  printf("Baseline written to %s\n", name);
+}
+
+static int compare_baseline(const char* name, const char* versions, uint32_t tolerance)
+{
+  FILE* f = fopen(name, "r");
+  char line[128], phase[32], metric[32];
+  unsigned long expected;
+  int regressions = 0;
+
+  if (!f)
+  {
+    fprintf(stderr, "%s: no baseline, record one with 'make baseline'\n", name);
+    return 2;
+  }
+
+  while (fgets(line, sizeof(line), f))
+  {
+    uint32_t m[NB_METRICS];
+    uint8_t i, j;
+
+    if (line[0] == '#')
+    {
+      line[strcspn(line, "\r\n")] = '\0';
+      printf("Baseline: %s\n", line + 2);
+      if (versions && strcmp(line + 2, versions))
+        printf("WARNING the baseline was recorded with other versions than %s\n", versions);
+      continue;
+    }
+
+    if (sscanf(line, "%31s %31s %lu", phase, metric, &expected) != 3)
+      continue;
+
+    for (i = 0; (i < BENCH_NB_PHASES) && strcmp(phase, phase_names[i]); i++);
+    for (j = 0; (j < NB_METRICS) && strcmp(metric, metric_names[j]); j++);
+    if ((i == BENCH_NB_PHASES) || (j == NB_METRICS))
+    {
+      fprintf(stderr, "%s: unknown entry %s %s\n", name, phase, metric);
+      continue;
+    }
+
+    get_metrics(&bench.phases[i], m);
+
+    /* At least one unit of slack for the small values */
+    if (m[j] > expected + (expected * tolerance + 99) / 100)
+    {
+      printf("REGRESSION %s %s: %u (baseline %lu)\n", phase, metric, m[j], expected);
+      regressions++;
+    }
+  }
+
+  fclose(f);
+
+  if (regressions)
+    return 1;
+
+  printf("No regression (tolerance %u%%)\n", tolerance);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  t_sdcard_config card_config = { 100000, 300, 1000, 0, 0 };
+  const char* image_name = "../sounds/babyphone.image";
+  const char* baseline_name = NULL;
+  const char* versions = NULL;
+  uint32_t tolerance = DEFAULT_TOLERANCE;
+  uint8_t update = 0;
+  elf_firmware_t firmware;
+  uint32_t image_size;
+  uint8_t* image;
+  int opt, state;
+  avr_t* avr;
+
+  while ((opt = getopt(argc, argv, "i:b:uT:V:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'i': image_name = optarg; break;
+      case 'b': baseline_name = optarg; break;
+      case 'u': update = 1; break;
+      case 'T': tolerance = strtoul(optarg, NULL, 0); break;
+      case 'V': versions = optarg; break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (optind != argc - 1)
+    usage(argv[0]);
+
+  image = load_file(image_name, &image_size);
+  sdcard_init(image, image_size, &card_config);
+
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[optind], &firmware))
+  {
+    fprintf(stderr, "%s: cannot load the firmware\n", argv[optind]);
+    return 2;
+  }
+  firmware.frequency = F_CPU;
+
+  avr = avr_make_mcu_by_name(MCU_NAME);
+  if (!avr)
+  {
+    fprintf(stderr, "simavr: no %s core\n", MCU_NAME);
+    return 2;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->vcc = avr->avcc = avr->aref = ADC_VCC_MV;
+  bench.avr = avr;
+
+  /* Phases */
+  avr_register_io_write(avr, GPIOR0_ADDR, gpior0_write, NULL);
+
+  /* Audio interrupts, and the Timer1 tick which may nest in them */
+  avr_irq_register_notify(avr_get_interrupt_irq(avr, VECTOR_TIMER0_COMPA) + AVR_INT_IRQ_RUNNING,
+                          isr_running, (void*)(uintptr_t)ISR_SAMPLE);
+  avr_irq_register_notify(avr_get_interrupt_irq(avr, VECTOR_TIMER0_COMPB) + AVR_INT_IRQ_RUNNING,
+                          isr_running, (void*)(uintptr_t)ISR_REFILL);
+  for (uint8_t v = 1; v < VECTOR_TIMER0_COMPA; v++)
+  {
+    avr_irq_t* irq = avr_get_interrupt_irq(avr, v);
+    if (irq)
+      avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, other_running, NULL);
+  }
+
+  /* Sample ticks and their outputs */
+  avr_irq_register_notify(avr_get_interrupt_irq(avr, VECTOR_TIMER0_COMPA) + AVR_INT_IRQ_PENDING,
+                          sample_tick, NULL);
+  avr_register_io_write(avr, OCR2B_ADDR, ocr2b_write, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_OUT_TRIGGER),
+                          adc_trigger, NULL);
+  bench.adc_input = avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0);
+
+  /* SD card */
+  bench.spi_input = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT),
+                          spi_output, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2),
+                          card_select, NULL);
+
+  /* Run until the firmware sleeps with the interrupts disabled */
+  do
+  {
+    uint64_t before = avr->cycle;
+    uint8_t sleeping = (avr->state == cpu_Sleeping);
+
+    state = avr_run(avr);
+
+    if (sleeping)
+      bench.phases[bench.phase].sleeping += avr->cycle - before;
+  } while ((state != cpu_Done) && (state != cpu_Crashed) && (avr->cycle < MAX_CYCLES));
+
+  close_phase();
+
+  if (bench.phase != BENCH_PHASE_DONE)
+  {
+    fprintf(stderr, "bench: stopped in phase %s\n", phase_names[bench.phase]);
+    return 2;
+  }
+
+  report();
+
+  if (update)
+  {
+    write_baseline(baseline_name ? baseline_name : "baseline.txt", versions);
+    return 0;
+  }
+
+  if (!baseline_name)
+    return 0;
+
+  return compare_baseline(baseline_name, versions, tolerance);
+}
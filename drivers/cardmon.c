@@ -0,0 +1,178 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* SD card presence monitor
+*
+* To be called periodically from the main loop, never while an interrupt
+* handler may access the card. The presence is sampled with a status
+* command when probing is allowed, otherwise with the card detect pin only.
+* A missing card is re-initialized in the background, one step per call,
+* until it answers again. After a failed init, the next attempt waits for
+* a number of calls so that a missing card does not keep the CPU busy.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "sd_raw.h"
+
+#include "cardmon.h"
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+enum {
+  STATE_PRESENT,
+  STATE_REMOVING,
+  STATE_ABSENT,
+  STATE_INSERTING,
+  STATE_INITIALIZING,
+};
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+struct {
+  uint8_t state;
+  uint8_t counter;
+  uint8_t threshold;
+  uint8_t retry_polls;
+  uint8_t backoff;
+} cardmon;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void cardmon_init(uint8_t debouncing_threshold, uint8_t retry_polls)
+{
+  cardmon.counter = 0;
+  cardmon.threshold = debouncing_threshold;
+  cardmon.retry_polls = retry_polls;
+  cardmon.backoff = 0;
+  
+  /* The contacts are settled at power up: start the card init right away */
+  if (sd_raw_init_start())
+    cardmon.state = STATE_INITIALIZING;
+  else
+    cardmon.state = STATE_ABSENT;
+}
+
+uint8_t cardmon_is_busy(void)
+{
+  return cardmon.state == STATE_INITIALIZING;
+}
+
+uint8_t cardmon_is_present(void)
+{
+  return (cardmon.state == STATE_PRESENT) || (cardmon.state == STATE_REMOVING);
+}
+
+void cardmon_update(uint8_t probe, uint8_t* event)
+{
+  uint8_t present;
+  
+  *event = CARD_EVENT_NONE;
+  
+  switch(cardmon.state)
+  {
+    case STATE_PRESENT:
+    case STATE_REMOVING:
+      present = (probe ? sd_raw_probe() : sd_raw_available());
+      
+      if (present)
+      {
+        cardmon.state = STATE_PRESENT;
+        cardmon.counter = 0;
+      }
+      else if (++cardmon.counter >= cardmon.threshold)
+      {
+        /* Card removed: forget about its content */
+        printf_P(PSTR("Card removed\r\n"));
+        sd_raw_invalidate();
+        
+        cardmon.state = STATE_ABSENT;
+        cardmon.counter = 0;
+        *event = CARD_EVENT_REMOVED;
+      }
+      else
+      {
+        cardmon.state = STATE_REMOVING;
+      }
+      break;
+      
+    case STATE_ABSENT:
+    case STATE_INSERTING:
+      if (cardmon.backoff)
+      {
+        /* Wait before retrying a card which failed to initialize */
+        cardmon.backoff--;
+      }
+      else if (!sd_raw_available())
+      {
+        cardmon.state = STATE_ABSENT;
+        cardmon.counter = 0;
+      }
+      else if (cardmon.counter < cardmon.threshold)
+      {
+        /* Let the contacts settle before talking to the card */
+        cardmon.state = STATE_INSERTING;
+        cardmon.counter++;
+      }
+      else if (probe)
+      {
+        if (sd_raw_init_start())
+          cardmon.state = STATE_INITIALIZING;
+      }
+      break;
+      
+    case STATE_INITIALIZING:
+      if (!probe)
+        break;
+      
+      switch(sd_raw_init_step())
+      {
+        case SD_RAW_INIT_DONE:
+          printf_P(PSTR("Card ready\r\n"));
+          
+          cardmon.state = STATE_PRESENT;
+          cardmon.counter = 0;
+          *event = CARD_EVENT_INSERTED;
+          break;
+          
+        case SD_RAW_INIT_FAILED:
+          printf_P(PSTR("MMC/SD initialization failed\r\n"));
+          
+          cardmon.state = STATE_ABSENT;
+          cardmon.counter = 0;
+          cardmon.backoff = cardmon.retry_polls;
+          break;
+      }
+      break;
+  }
+}
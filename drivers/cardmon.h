@@ -0,0 +1,44 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef CARDMON_H
+#define CARDMON_H
+
+enum {
+  CARD_EVENT_NONE,
+  CARD_EVENT_REMOVED,
+  CARD_EVENT_INSERTED,
+};
+
+/* The presence is debounced over debouncing_threshold calls, and a card
+   which fails to initialize is retried after retry_polls more calls.
+
+   On boards where the card detect pin is not wired (hardwired to present),
+   sd_raw_available() always reports a card: a removal while playing or
+   recording is only detected when the stream stops on its consecutive
+   error limit, then by the status command probe once idle. */
+void cardmon_init(uint8_t debouncing_threshold, uint8_t retry_polls);
+void cardmon_update(uint8_t probe, uint8_t* event);
+uint8_t cardmon_is_present(void);
+uint8_t cardmon_is_busy(void);
+
+#endif /* CARDMON_H */
@@ -25,12 +25,11 @@
 ******************************************************************************/
 #include <stdio.h>
 #include <string.h>
+#include <avr/io.h>
 #include <avr/pgmspace.h>
 
 #include "delay.h"
 
-#include "LUFA/Drivers/Peripheral/SerialStream.h"
-
 #include "keyboard.h"
 
 /*****************************************************************************
@@ -43,7 +42,7 @@
 #define NB_MATRIX_ROWS (4)
 #define NB_MATRIX_COLS (5)
 
-uint8_t keycode[] =
+static const uint8_t keycode[] PROGMEM =
 {
   /* Row 0 */
   KEYCODE_1,    // Col 0
@@ -198,7 +197,7 @@ uint8_t raw2keycode(uint8_t rawcode)
   uint8_t row = (rawcode >> 4);
   uint8_t col = (rawcode & 0x0F);
   
-  return keycode[row * NB_MATRIX_COLS + col];
+  return pgm_read_byte(&keycode[row * NB_MATRIX_COLS + col]);
 }
 
 void keyboard_update(uint8_t* event)
@@ -24,22 +24,111 @@
 * Includes
 ******************************************************************************/
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 
 #include "sd_raw.h"
 
+#include "slotfs.h"
+
 /*****************************************************************************
 * Constants
 ******************************************************************************/
-#define MAX_PARTITIONS (3)  /* Max in partition table = 62 */
-#define MAX_SLOTS      (12) /* Max in partition header = 62 */
+#define MAX_PARTITIONS (62) /* Max in partition table */
+#define MAX_SLOTS_V0   (62) /* Max in a version 0 partition header */
+#define MAX_SLOTS_V1   (31) /* Max in a version 1 partition header */
+
+/* Read-write partitions with a journal, the others are updated in place */
+#define MAX_JOURNALS      (4)
+#define JOURNAL_MAX_SLOTS (MAX_SLOTS_V1)
+
+#define JOURNAL_MAGIC "SJNL"
+
+/* Read-write partition with the slots allocated on recording, one at most */
+#define FLAG_DYNAMIC         (0x01)
+#define DYNAMIC_MAX_SLOTS    (16)
+#define DYNAMIC_MAX_CLUSTERS (255)
+
+#define NO_PARTITION (0xFF)
+
+/* Journal sector read back */
+enum {
+  JOURNAL_INVALID,     /* Never written or torn */
+  JOURNAL_VALID,
+  JOURNAL_READ_ERROR,  /* Unknown content */
+};
 
 /*****************************************************************************
 * Definitions
 ******************************************************************************/
 
+/* Partition table, entries of <start block, nb blocks> from offset 16 */
+typedef struct {
+  char     magic[10];
+  uint16_t nb_partitions;  /* 0 up to version 0: up to a null entry */
+  uint32_t reserved;
+} t_partition_table;
+
+/* Partition header, slot entries from offset 16 */
+typedef struct {
+  char     magic[6];
+  uint8_t  version;
+  uint8_t  read_only;
+  uint16_t sampling_rate;
+  uint16_t nb_journal;     /* Journal sectors after the header */
+  uint8_t  nb_slots;       /* Version 1 */
+  uint8_t  flags;          /* Version 1 */
+  uint16_t align_blocks;   /* Version 1: slot starts on multiples of it */
+} t_partition_header;
+
+/* Slot entry, version 0 entries are the first 8 bytes */
+typedef struct {
+  uint32_t offset;
+  uint16_t max_content_blocks;
+  uint16_t nb_content_blocks;
+  uint16_t sampling_rate;  /* 0 for the rate of the partition */
+  uint8_t  codec;
+  uint8_t  nb_channels;
+  uint32_t reserved;
+} t_slot_entry;
+
+#define SLOT_ENTRY_SIZE_V0 (8)
+#define SLOT_ENTRY_SIZE_V1 (sizeof(t_slot_entry))
+
+/* Content sizes of the slots of a read-write partition. The updates go to
+   the journal sectors in turn instead of the partition header, each entry
+   holds the whole table: the one with the highest sequence number is the
+   current state, an entry torn by a power loss fails its check */
+typedef struct {
+  char     magic[4];
+  uint32_t seq;
+  uint8_t  nb_slots;
+  uint8_t  check;
+  uint16_t nb_content_blocks[JOURNAL_MAX_SLOTS];
+} t_journal_entry;
+
+#define JOURNAL_HEAD_SIZE            (offsetof(t_journal_entry, nb_content_blocks))
+#define JOURNAL_ENTRY_SIZE(nb_slots) (JOURNAL_HEAD_SIZE + (nb_slots) * 2)
+
+/* Slot of a dynamic partition: a run of clusters of align_blocks blocks
+   after the journal. Its journal entries hold the extents of the slots then
+   the bitmap of the used clusters in place of the content sizes */
+typedef struct {
+  uint8_t  first_cluster;
+  uint8_t  nb_clusters;
+  uint16_t nb_content_blocks;
+} t_extent;
+
+typedef struct {
+  uint8_t partition;
+  uint8_t nb_journal;
+  uint8_t nb_slots;
+  uint8_t read_only;       /* Newest entry unknown, nothing is written */
+  uint32_t seq;            /* 0 before the first entry */
+} t_journal;
+
 /*****************************************************************************
 * Globals
 ******************************************************************************/
@@ -47,11 +136,39 @@
 struct {
   uint8_t no_partitions;
   uint8_t nb_partitions;
+  
+  uint8_t nb_journals;
+  t_journal journals[MAX_JOURNALS];
+  
+  /* Allocation state of the dynamic partition */
+  struct {
+    uint8_t partition;     /* NO_PARTITION without */
+    uint8_t nb_clusters;
+    uint16_t cluster_blocks;
+    uint32_t first_offset; /* Of the first cluster, from the partition start */
+    t_extent extents[DYNAMIC_MAX_SLOTS];
+    uint8_t bitmap[(DYNAMIC_MAX_CLUSTERS + 7) / 8];  /* Used clusters */
+  } dynamic;
 } slotfs;
 
 /*****************************************************************************
 * Local prototypes
 ******************************************************************************/
+static uint8_t read_header(uint32_t partition_address, t_partition_header* header);
+static uint32_t slot_entry_address(uint32_t partition_address, t_partition_header* header, uint8_t slot);
+static uint8_t read_slot_entry(uint8_t partition, uint8_t slot, t_slot_entry* entry);
+static uint32_t partition_nb_blocks(uint8_t partition);
+static void journal_recover(uint8_t partition);
+static t_journal* journal_find(uint8_t partition);
+static uint32_t journal_address(t_journal* journal, uint32_t seq);
+static uint8_t journal_check(t_journal* journal, t_journal_entry* entry);
+static uint8_t journal_read(t_journal* journal, uint8_t index, t_journal_entry* entry);
+static uint8_t byte_sum(const void* data, uint16_t length, uint8_t sum);
+static void dynamic_init(t_partition_header* header, uint8_t partition);
+static uint8_t dynamic_write(t_journal* journal);
+static void dynamic_mark(uint8_t first, uint8_t count, uint8_t used);
+static uint8_t dynamic_largest_free(uint8_t* first);
+static uint16_t dynamic_extent_blocks(const t_extent* extent);
 
 /*****************************************************************************
 * Functions
@@ -59,22 +176,22 @@ struct {
 
 uint8_t slotfs_init(void)
 {
-  char buffer[10 + 1];
-  uint32_t nb_bytes = 0;
+  t_partition_table table;
   
   memset(&slotfs, 0x00, sizeof(slotfs));
+  slotfs.dynamic.partition = NO_PARTITION;
   
   printf_P(PSTR("slotfs_init\r\n"));
   
-  nb_bytes = sd_raw_read(0, (uint8_t*)buffer, 10);
-  if (strncmp(buffer, "SLOTFS", 6) == 0)
+  sd_raw_read(0, (uint8_t*)&table, sizeof(table));
+  if (strncmp_P(table.magic, PSTR("SLOTFS"), 6) == 0)
   {
     printf_P(PSTR("SLOTFS\r\n"));
     
     /* Only one slotfs, without partition */
     slotfs.no_partitions = 1;
   }
-  else if (strncmp(buffer, "PARTITIONS", 10) == 0)
+  else if (strncmp_P(table.magic, PSTR("PARTITIONS"), 10) == 0)
   {
     uint8_t i;
     uint32_t start_block;
@@ -82,20 +199,23 @@ uint8_t slotfs_init(void)
     printf_P(PSTR("PARTITIONS\r\n"));
         
     slotfs.no_partitions = 0;
-        
-    /* Read the partition table */
-    for(i = 0; i < MAX_PARTITIONS; i++)
+    
+    /* Read the partition table, up to the count or a null entry */
+    if ((table.nb_partitions == 0) || (table.nb_partitions > MAX_PARTITIONS))
+      table.nb_partitions = MAX_PARTITIONS;
+    
+    for(i = 0; i < table.nb_partitions; i++)
     {
       sd_raw_read(16 + i * 8, (uint8_t*)&start_block, 4);
       
       if(start_block == 0)
       {
-        slotfs.nb_partitions = i;
         break;
       }
       else
       {
         printf_P(PSTR("Partition %i start %li\r\n"), i, start_block);
+        slotfs.nb_partitions = i + 1;
       }
     }
   }
@@ -104,6 +224,10 @@ uint8_t slotfs_init(void)
     return 0;
   }
   
+  /* Latest content sizes of the read-write partitions */
+  for(uint8_t i = 0; i < slotfs_get_nb_partitions(); i++)
+    journal_recover(i);
+  
   return 1;
 }
 
@@ -132,62 +256,532 @@ uint32_t slotfs_get_partition_start(uint8_t partition)
   return start_block;
 }
 
-void slotfs_get_partition_info(uint8_t partition, uint16_t *sampling_rate, uint8_t* nb_slots)
+static uint32_t partition_nb_blocks(uint8_t partition)
 {
-  uint8_t i;
-  uint32_t partition_address = slotfs_get_partition_start(partition) * 512;
-  uint32_t start_block;
+  uint32_t nb_blocks;
   
-  if (sampling_rate)
+  /* No size without partition table */
+  if (slotfs.no_partitions == 1)
   {
-    sd_raw_read(partition_address + 8, (uint8_t*)sampling_rate, 2);
+    return 0;
   }
   
-  if (nb_slots)
+  sd_raw_read(16 + partition * 8 + 4, (uint8_t*)&nb_blocks, 4);
+  
+  return nb_blocks;
+}
+
+/* Blocks after the header and the journal up to the end of the partition */
+void slotfs_get_partition_area(uint8_t partition, uint32_t *start_block, uint32_t *nb_blocks)
+{
+  t_partition_header header;
+  uint32_t first = 0;
+  uint32_t total = partition_nb_blocks(partition);
+  
+  if (read_header(slotfs_get_partition_start(partition) * 512, &header))
+    first = 1 + (uint32_t)header.nb_journal;
+  
+  if (start_block)
+    *start_block = slotfs_get_partition_start(partition) + first;
+  
+  if (nb_blocks)
+    *nb_blocks = (total > first) ? total - first : 0;
+}
+
+/* Header of a known version, the slot entries are in the same sector */
+static uint8_t read_header(uint32_t partition_address, t_partition_header* header)
+{
+  if (!sd_raw_read(partition_address, (uint8_t*)header, sizeof(t_partition_header)) ||
+      (header->version > SLOTFS_VERSION))
   {
-    for(i = 0; i < MAX_SLOTS; i++)
+    memset(header, 0x00, sizeof(t_partition_header));
+    return 0;
+  }
+  
+  if (header->version == 0)
+  {
+    uint32_t start_block;
+    
+    /* A full table has no end marker */
+    header->nb_slots = MAX_SLOTS_V0;
+    
+    for(uint8_t i = 0; i < MAX_SLOTS_V0; i++)
     {
-      sd_raw_read(partition_address + 16 + i * 8, (uint8_t*)&start_block, 4);
+      sd_raw_read(partition_address + 16 + i * SLOT_ENTRY_SIZE_V0, (uint8_t*)&start_block, 4);
       
       if(start_block == 0)
       {
-        *nb_slots = i;
+        header->nb_slots = i;
         break;
       }
-#ifdef DEBUG
-      else
-      {
-        printf_P(PSTR("Slot %i start %li\r\n"), i, start_block);
-      }
-#endif
     }
+    
+    header->align_blocks = 1;
+    header->flags = 0;
+  }
+  else if (header->nb_slots > MAX_SLOTS_V1)
+  {
+    header->nb_slots = MAX_SLOTS_V1;
   }
+  
+  if ((header->flags & FLAG_DYNAMIC) && (header->nb_slots > DYNAMIC_MAX_SLOTS))
+    header->nb_slots = DYNAMIC_MAX_SLOTS;
+  
+  return 1;
 }
 
-void slotfs_get_slot_info(uint8_t partition, uint8_t slot, uint32_t *start_block, uint16_t *max_content_blocks, uint16_t *nb_slot_blocks)
+static uint32_t slot_entry_address(uint32_t partition_address, t_partition_header* header, uint8_t slot)
+{
+  if (header->version == 0)
+    return partition_address + 16 + slot * SLOT_ENTRY_SIZE_V0;
+  
+  return partition_address + 16 + slot * SLOT_ENTRY_SIZE_V1;
+}
+
+/* Slot entry in the format of version 1 */
+static uint8_t read_slot_entry(uint8_t partition, uint8_t slot, t_slot_entry* entry)
 {
   uint32_t partition_address = slotfs_get_partition_start(partition) * 512;
-  uint32_t slot_entry_address = partition_address + 16 + slot * 8;
-  uint32_t slot_offset = 0;
+  t_partition_header header;
+  t_journal* journal;
   
-  if (start_block)
+  memset(entry, 0x00, sizeof(t_slot_entry));
+  
+  if (!read_header(partition_address, &header) || (slot >= header.nb_slots))
+    return 0;
+  
+  if (header.version == 0)
+  {
+    sd_raw_read(slot_entry_address(partition_address, &header, slot), (uint8_t*)entry, SLOT_ENTRY_SIZE_V0);
+    entry->codec = SLOTFS_CODEC_PCM_U8;
+    entry->nb_channels = 1;
+  }
+  else
+  {
+    sd_raw_read(slot_entry_address(partition_address, &header, slot), (uint8_t*)entry, SLOT_ENTRY_SIZE_V1);
+  }
+  
+  if (entry->sampling_rate == 0)
+    entry->sampling_rate = header.sampling_rate;
+  
+  if (partition == slotfs.dynamic.partition)
+  {
+    /* Extent allocated to the slot */
+    t_extent* extent = &slotfs.dynamic.extents[slot];
+    
+    entry->offset = 0;
+    if (extent->nb_clusters)
+      entry->offset = slotfs.dynamic.first_offset + (uint32_t)extent->first_cluster * slotfs.dynamic.cluster_blocks;
+    entry->max_content_blocks = dynamic_extent_blocks(extent);
+    entry->nb_content_blocks = extent->nb_content_blocks;
+    return 1;
+  }
+  
+  /* Newest content size */
+  journal = journal_find(partition);
+  if (journal && journal->seq && (slot < journal->nb_slots))
   {
-    sd_raw_read(slot_entry_address, (uint8_t*)&slot_offset, 4);
-    *start_block = slotfs_get_partition_start(partition) + slot_offset;
+    sd_raw_read(journal_address(journal, journal->seq) + offsetof(t_journal_entry, nb_content_blocks) + slot * 2,
+                (uint8_t*)&entry->nb_content_blocks, 2);
   }
   
+  return 1;
+}
+
+void slotfs_get_partition_info(uint8_t partition, uint16_t *sampling_rate, uint8_t* nb_slots)
+{
+  t_partition_header header;
+  
+  read_header(slotfs_get_partition_start(partition) * 512, &header);
+  
+  if (sampling_rate)
+    *sampling_rate = header.sampling_rate;
+  
+  if (nb_slots)
+    *nb_slots = header.nb_slots;
+}
+
+void slotfs_get_slot_info(uint8_t partition, uint8_t slot, uint32_t *start_block, uint16_t *max_content_blocks, uint16_t *nb_slot_blocks)
+{
+  t_slot_entry entry;
+  
+  read_slot_entry(partition, slot, &entry);
+  
+  if (start_block)
+    *start_block = slotfs_get_partition_start(partition) + entry.offset;
+  
   if (max_content_blocks)
-    sd_raw_read(slot_entry_address + 4, (uint8_t*)max_content_blocks, 2);
+    *max_content_blocks = entry.max_content_blocks;
   
   if (nb_slot_blocks)
-    sd_raw_read(slot_entry_address + 6, (uint8_t*)nb_slot_blocks, 2);
+    *nb_slot_blocks = entry.nb_content_blocks;
+}
+
+void slotfs_get_slot_format(uint8_t partition, uint8_t slot, uint16_t *sampling_rate, uint8_t *codec, uint8_t *nb_channels)
+{
+  t_slot_entry entry;
+  
+  read_slot_entry(partition, slot, &entry);
+  
+  if (sampling_rate)
+    *sampling_rate = entry.sampling_rate;
+  
+  if (codec)
+    *codec = entry.codec;
+  
+  if (nb_channels)
+    *nb_channels = entry.nb_channels;
 }
 
 void slotfs_update_slot_content_size(uint8_t partition, uint8_t slot, uint16_t nb_content_blocks)
 {
   uint32_t partition_address = slotfs_get_partition_start(partition) * 512;
-  uint32_t slot_entry_address = partition_address + 16 + slot * 8;
+  t_partition_header header;
+  t_journal* journal = journal_find(partition);
+  t_journal_entry entry;
+  uint32_t seq;
 
-  sd_raw_write(slot_entry_address + 6, (uint8_t*)&nb_content_blocks, 2);
-  sd_raw_sync();
-}
\ No newline at end of file
+  if (!read_header(partition_address, &header) || (slot >= header.nb_slots) ||
+      (journal && journal->read_only))
+    return;
+  
+  if (partition == slotfs.dynamic.partition)
+  {
+    /* Trim the extent to the content */
+    t_extent* extent = &slotfs.dynamic.extents[slot];
+    uint8_t nb_clusters = (uint8_t)(((uint32_t)nb_content_blocks + slotfs.dynamic.cluster_blocks - 1) / slotfs.dynamic.cluster_blocks);
+    
+    if (nb_clusters < extent->nb_clusters)
+    {
+      dynamic_mark(extent->first_cluster + nb_clusters, extent->nb_clusters - nb_clusters, 0);
+      extent->nb_clusters = nb_clusters;
+    }
+    
+    extent->nb_content_blocks = nb_content_blocks;
+    if (nb_content_blocks > dynamic_extent_blocks(extent))
+      extent->nb_content_blocks = dynamic_extent_blocks(extent);
+    
+    dynamic_write(journal);
+    return;
+  }
+  
+  if (!journal || (slot >= journal->nb_slots))
+  {
+    /* In place, in the partition header */
+    sd_raw_write(slot_entry_address(partition_address, &header, slot) + offsetof(t_slot_entry, nb_content_blocks),
+                 (uint8_t*)&nb_content_blocks, 2);
+    sd_raw_sync();
+    return;
+  }
+  
+  /* Current table, from the header before the first entry */
+  seq = journal->seq;
+  if (seq)
+  {
+    sd_raw_read(journal_address(journal, seq), (uint8_t*)&entry, JOURNAL_ENTRY_SIZE(journal->nb_slots));
+  }
+  else
+  {
+    for(uint8_t i = 0; i < journal->nb_slots; i++)
+      sd_raw_read(slot_entry_address(partition_address, &header, i) + offsetof(t_slot_entry, nb_content_blocks),
+                  (uint8_t*)&entry.nb_content_blocks[i], 2);
+  }
+  
+  /* Append the new table after the newest entry */
+  seq++;
+  memcpy_P(entry.magic, PSTR(JOURNAL_MAGIC), sizeof(entry.magic));
+  entry.seq = seq;
+  entry.nb_slots = journal->nb_slots;
+  entry.nb_content_blocks[slot] = nb_content_blocks;
+  entry.check = 0;
+  entry.check = journal_check(journal, &entry);
+  
+  if (sd_raw_write(journal_address(journal, seq), (uint8_t*)&entry, JOURNAL_ENTRY_SIZE(journal->nb_slots)) && sd_raw_sync())
+    journal->seq = seq;
+}
+
+static t_journal* journal_find(uint8_t partition)
+{
+  for(uint8_t i = 0; i < slotfs.nb_journals; i++)
+  {
+    if (slotfs.journals[i].partition == partition)
+      return &slotfs.journals[i];
+  }
+  
+  return NULL;
+}
+
+/* Entry of a sequence number, the journal sectors are used in turn */
+static uint32_t journal_address(t_journal* journal, uint32_t seq)
+{
+  return (slotfs_get_partition_start(journal->partition) + 1 + seq % journal->nb_journal) * 512;
+}
+
+/* Complement of the byte sum, computed with a null check field. The entry
+   of the dynamic partition is followed by the extents and the bitmap */
+static uint8_t journal_check(t_journal* journal, t_journal_entry* entry)
+{
+  uint8_t sum;
+  
+  if (journal->partition != slotfs.dynamic.partition)
+    return (uint8_t)~byte_sum(entry, JOURNAL_ENTRY_SIZE(entry->nb_slots), 0);
+  
+  sum = byte_sum(entry, JOURNAL_HEAD_SIZE, 0);
+  sum = byte_sum(slotfs.dynamic.extents, journal->nb_slots * sizeof(t_extent), sum);
+  sum = byte_sum(slotfs.dynamic.bitmap, (slotfs.dynamic.nb_clusters + 7) / 8, sum);
+  
+  return (uint8_t)~sum;
+}
+
+static uint8_t byte_sum(const void* data, uint16_t length, uint8_t sum)
+{
+  for(uint16_t i = 0; i < length; i++)
+    sum += ((const uint8_t*)data)[i];
+  
+  return sum;
+}
+
+/* Entry in a journal sector, the dynamic state is read in place */
+static uint8_t journal_read(t_journal* journal, uint8_t index, t_journal_entry* entry)
+{
+  uint32_t address = (slotfs_get_partition_start(journal->partition) + 1 + index) * 512;
+  uint8_t check;
+  
+  if (journal->partition != slotfs.dynamic.partition)
+  {
+    if (!sd_raw_read(address, (uint8_t*)entry, JOURNAL_ENTRY_SIZE(journal->nb_slots)))
+      return JOURNAL_READ_ERROR;
+  }
+  else
+  {
+    address += JOURNAL_HEAD_SIZE;
+    if (!sd_raw_read(address - JOURNAL_HEAD_SIZE, (uint8_t*)entry, JOURNAL_HEAD_SIZE) ||
+        !sd_raw_read(address, (uint8_t*)slotfs.dynamic.extents, journal->nb_slots * sizeof(t_extent)) ||
+        !sd_raw_read(address + journal->nb_slots * sizeof(t_extent), slotfs.dynamic.bitmap, (slotfs.dynamic.nb_clusters + 7) / 8))
+      return JOURNAL_READ_ERROR;
+  }
+  
+  check = entry->check;
+  entry->check = 0;
+  
+  if ((memcmp_P(entry->magic, PSTR(JOURNAL_MAGIC), sizeof(entry->magic)) == 0) &&
+      (entry->nb_slots == journal->nb_slots) &&
+      (check == journal_check(journal, entry)) &&
+      (entry->seq % journal->nb_journal == index))
+    return JOURNAL_VALID;
+  
+  return JOURNAL_INVALID;
+}
+
+/* Newest valid entry of the journal, one read per journal sector. A sector
+   which cannot be read may hold a newer entry: the partition is then kept
+   read-only, an older entry would show the newest recordings as free */
+static void journal_recover(uint8_t partition)
+{
+  uint32_t partition_address = slotfs_get_partition_start(partition) * 512;
+  t_partition_header header;
+  t_journal_entry entry;
+  t_journal* journal;
+  uint8_t newest = 0;
+  
+  if (!read_header(partition_address, &header) || (header.nb_journal == 0) || (header.nb_journal > 0xFF) ||
+      (slotfs.nb_journals == MAX_JOURNALS))
+    return;
+  
+  journal = &slotfs.journals[slotfs.nb_journals++];
+  journal->partition = partition;
+  journal->nb_journal = (uint8_t)header.nb_journal;
+  journal->nb_slots = (header.nb_slots < JOURNAL_MAX_SLOTS) ? header.nb_slots : JOURNAL_MAX_SLOTS;
+  journal->seq = 0;
+  journal->read_only = 0;
+  
+  if (header.flags & FLAG_DYNAMIC)
+    dynamic_init(&header, partition);
+  
+  for(uint8_t i = 0; i < journal->nb_journal; i++)
+  {
+    uint8_t result = journal_read(journal, i, &entry);
+    
+    if (result == JOURNAL_READ_ERROR)
+    {
+      journal->read_only = 1;
+    }
+    else if ((result == JOURNAL_VALID) && (entry.seq > journal->seq))
+    {
+      journal->seq = entry.seq;
+      newest = i;
+    }
+  }
+  
+  /* Back to the allocation of the newest entry, all free before the first */
+  if ((partition == slotfs.dynamic.partition) && journal->seq && !journal->read_only &&
+      (journal_read(journal, newest, &entry) != JOURNAL_VALID))
+    journal->read_only = 1;
+  
+  if ((partition == slotfs.dynamic.partition) && (!journal->seq || journal->read_only))
+  {
+    memset(slotfs.dynamic.extents, 0x00, sizeof(slotfs.dynamic.extents));
+    memset(slotfs.dynamic.bitmap, 0x00, sizeof(slotfs.dynamic.bitmap));
+  }
+  
+  if (journal->read_only)
+    printf_P(PSTR("Partition %i journal unreadable, read-only\r\n"), partition);
+  
+#ifdef DEBUG
+  printf_P(PSTR("Partition %i journal seq %li\r\n"), partition, journal->seq);
+#endif
+}
+
+/*****************************************************************************
+* Dynamic partition
+******************************************************************************/
+
+/* Clusters from the first multiple of align_blocks after the journal up to
+   the end of the partition. A second one keeps the slots of its header, as
+   does one without room for a cluster after its journal */
+static void dynamic_init(t_partition_header* header, uint8_t partition)
+{
+  uint32_t nb_blocks = partition_nb_blocks(partition);
+  uint32_t nb_clusters;
+  uint32_t first_offset;
+  
+  if ((slotfs.dynamic.partition != NO_PARTITION) || (header->align_blocks == 0))
+    return;
+  
+  first_offset = ((uint32_t)header->nb_journal + header->align_blocks) / header->align_blocks * header->align_blocks;
+  if (first_offset + header->align_blocks > nb_blocks)
+    return;
+  
+  nb_clusters = (nb_blocks - first_offset) / header->align_blocks;
+  if (nb_clusters > DYNAMIC_MAX_CLUSTERS)
+    nb_clusters = DYNAMIC_MAX_CLUSTERS;
+  
+  slotfs.dynamic.partition = partition;
+  slotfs.dynamic.nb_clusters = (uint8_t)nb_clusters;
+  slotfs.dynamic.cluster_blocks = header->align_blocks;
+  slotfs.dynamic.first_offset = first_offset;
+  
+#ifdef DEBUG
+  printf_P(PSTR("Partition %i: %i clusters of %i blocks\r\n"), partition, slotfs.dynamic.nb_clusters, slotfs.dynamic.cluster_blocks);
+#endif
+}
+
+/* Append the extents and the bitmap after the newest entry */
+static uint8_t dynamic_write(t_journal* journal)
+{
+  t_journal_entry entry;
+  uint32_t seq = journal->seq + 1;
+  uint32_t address = journal_address(journal, seq);
+  
+  memcpy_P(entry.magic, PSTR(JOURNAL_MAGIC), sizeof(entry.magic));
+  entry.seq = seq;
+  entry.nb_slots = journal->nb_slots;
+  entry.check = 0;
+  entry.check = journal_check(journal, &entry);
+  
+  /* Pieces of the same block, written back once by the sync */
+  if (sd_raw_write(address, (uint8_t*)&entry, JOURNAL_HEAD_SIZE) &&
+      sd_raw_write(address + JOURNAL_HEAD_SIZE, (uint8_t*)slotfs.dynamic.extents, journal->nb_slots * sizeof(t_extent)) &&
+      sd_raw_write(address + JOURNAL_HEAD_SIZE + journal->nb_slots * sizeof(t_extent), slotfs.dynamic.bitmap, (slotfs.dynamic.nb_clusters + 7) / 8) &&
+      sd_raw_sync())
+  {
+    journal->seq = seq;
+    return 1;
+  }
+  
+  return 0;
+}
+
+/* Blocks of an extent, as much as a slot entry holds */
+static uint16_t dynamic_extent_blocks(const t_extent* extent)
+{
+  uint32_t nb_blocks = (uint32_t)extent->nb_clusters * slotfs.dynamic.cluster_blocks;
+  
+  return (nb_blocks > 0xFFFF) ? 0xFFFF : (uint16_t)nb_blocks;
+}
+
+/* Set or clear the bits of a run of clusters, free runs merge by themselves */
+static void dynamic_mark(uint8_t first, uint8_t count, uint8_t used)
+{
+  for(uint8_t i = first; count; i++, count--)
+  {
+    if (used)
+      slotfs.dynamic.bitmap[i >> 3] |= (1 << (i & 7));
+    else
+      slotfs.dynamic.bitmap[i >> 3] &= ~(1 << (i & 7));
+  }
+}
+
+/* Length of the largest run of free clusters, the first one of that length */
+static uint8_t dynamic_largest_free(uint8_t* first)
+{
+  uint8_t largest = 0;
+  uint8_t run = 0;
+  
+  for(uint8_t i = 0; i < slotfs.dynamic.nb_clusters; i++)
+  {
+    if (slotfs.dynamic.bitmap[i >> 3] & (1 << (i & 7)))
+    {
+      run = 0;
+    }
+    else if (++run > largest)
+    {
+      largest = run;
+      *first = i + 1 - run;
+    }
+  }
+  
+  return largest;
+}
+
+uint8_t slotfs_is_dynamic(uint8_t partition)
+{
+  return (partition == slotfs.dynamic.partition);
+}
+
+/* Give the slot of a dynamic partition the largest free extent, its previous
+   content is dropped. The slots of the other partitions are fixed */
+uint8_t slotfs_allocate_slot(uint8_t partition, uint8_t slot)
+{
+  t_journal* journal = journal_find(partition);
+  t_extent* extent;
+  uint8_t first = 0;
+  
+  if (partition != slotfs.dynamic.partition)
+    return 1;
+  
+  if (!journal || journal->read_only || (slot >= journal->nb_slots))
+    return 0;
+  
+  extent = &slotfs.dynamic.extents[slot];
+  dynamic_mark(extent->first_cluster, extent->nb_clusters, 0);
+  
+  extent->nb_clusters = dynamic_largest_free(&first);
+  extent->first_cluster = first;
+  extent->nb_content_blocks = 0;
+  dynamic_mark(extent->first_cluster, extent->nb_clusters, 1);
+  
+  return dynamic_write(journal) && (extent->nb_clusters > 0);
+}
+
+/* Free the extent of the slot of a dynamic partition, empty the others */
+void slotfs_delete_slot(uint8_t partition, uint8_t slot)
+{
+  t_journal* journal = journal_find(partition);
+  t_extent* extent;
+  
+  if (partition != slotfs.dynamic.partition)
+  {
+    slotfs_update_slot_content_size(partition, slot, 0);
+    return;
+  }
+  
+  if (!journal || journal->read_only || (slot >= journal->nb_slots))
+    return;
+  
+  extent = &slotfs.dynamic.extents[slot];
+  dynamic_mark(extent->first_cluster, extent->nb_clusters, 0);
+  memset(extent, 0x00, sizeof(t_extent));
+  
+  dynamic_write(journal);
+}
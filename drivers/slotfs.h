@@ -20,12 +20,33 @@
   this software.
 */
 
+#ifndef SLOTFS_H
+#define SLOTFS_H
+
+/* Latest version of the partition header, version 0 is still read */
+#define SLOTFS_VERSION (1)
+
+/* Content of a slot */
+enum {
+  SLOTFS_CODEC_PCM_U8,  /* Unsigned 8-bit PCM */
+};
+
 uint8_t slotfs_init(void);
 
 uint32_t slotfs_get_nb_partitions(void);
 uint32_t slotfs_get_partition_start(uint8_t partition);
+void slotfs_get_partition_area(uint8_t partition, uint32_t *start_block, uint32_t *nb_blocks);
 
 void slotfs_get_partition_info(uint8_t partition, uint16_t *sampling_rate, uint8_t* nb_slots);
 void slotfs_get_slot_info(uint8_t partition, uint8_t slot, uint32_t *start_block, uint16_t *max_content_blocks, uint16_t *nb_slot_blocks);
+void slotfs_get_slot_format(uint8_t partition, uint8_t slot, uint16_t *sampling_rate, uint8_t *codec, uint8_t *nb_channels);
 
 void slotfs_update_slot_content_size(uint8_t partition, uint8_t slot, uint16_t nb_content_blocks);
+
+/* Slots of a dynamic read-write partition: allocated before a recording,
+   trimmed by the content size update */
+uint8_t slotfs_is_dynamic(uint8_t partition);
+uint8_t slotfs_allocate_slot(uint8_t partition, uint8_t slot);
+void slotfs_delete_slot(uint8_t partition, uint8_t slot);
+
+#endif /* SLOTFS_H */
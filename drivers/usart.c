@@ -0,0 +1,290 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/*****************************************************************************
+* Interrupt driven USART
+*
+* Transmit and receive go through RAM rings served by the UDRE and RX
+* interrupts, so usart_putc() and usart_getc() never wait for the line.
+* The baud rate generator always runs in double speed mode (U2X), which
+* gives exact rates up to 1 Mbaud at 16 MHz.
+*
+* usart_init() opens the port as stdin, stdout and stderr. A stdio write
+* only waits when the transmit ring is full, idling until the next UDRE
+* interrupt; with the interrupts masked it feeds the data register
+* itself. A stdio read sleeps until a byte is received.
+*
+* The ATmega328P uses USART0 (RXD on PD0, TXD on PD1), the ATmega32U4
+* its only USART1 (RXD on PD2, TXD on PD3).
+*
+* A receive handler can take the bytes over from the receive ring, for
+* protocols which must keep up with the line at high baud rates.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "usart.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#ifndef USART_TX_SIZE
+#define USART_TX_SIZE (16) /* Power of 2 */
+#endif
+
+#ifndef USART_RX_SIZE
+#define USART_RX_SIZE (16) /* Power of 2 */
+#endif
+
+#if defined(__AVR_ATmega32U4__)
+#define USART_UCSRA     UCSR1A
+#define USART_UCSRB     UCSR1B
+#define USART_UCSRC     UCSR1C
+#define USART_UBRR      UBRR1
+#define USART_UDR       UDR1
+#define USART_U2X       U2X1
+#define USART_UDRE      UDRE1
+#define USART_UCSZ0     UCSZ10
+#define USART_UCSZ1     UCSZ11
+#define USART_RXCIE     RXCIE1
+#define USART_RXEN      RXEN1
+#define USART_TXEN      TXEN1
+#define USART_UDRIE     UDRIE1
+#define USART_RX_PIN    PORTD2
+#define USART_TX_PIN    PORTD3
+#define USART_RX_VECT   USART1_RX_vect
+#define USART_UDRE_VECT USART1_UDRE_vect
+#else
+#define USART_UCSRA     UCSR0A
+#define USART_UCSRB     UCSR0B
+#define USART_UCSRC     UCSR0C
+#define USART_UBRR      UBRR0
+#define USART_UDR       UDR0
+#define USART_U2X       U2X0
+#define USART_UDRE      UDRE0
+#define USART_UCSZ0     UCSZ00
+#define USART_UCSZ1     UCSZ01
+#define USART_RXCIE     RXCIE0
+#define USART_RXEN      RXEN0
+#define USART_TXEN      TXEN0
+#define USART_UDRIE     UDRIE0
+#define USART_RX_PIN    PORTD0
+#define USART_TX_PIN    PORTD1
+#define USART_RX_VECT   USART_RX_vect
+#define USART_UDRE_VECT USART_UDRE_vect
+#endif
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static volatile struct {
+  uint8_t tx[USART_TX_SIZE];
+  uint8_t tx_head;
+  uint8_t tx_tail;
+  
+  uint8_t rx[USART_RX_SIZE];
+  uint8_t rx_head;
+  uint8_t rx_tail;
+  
+  uint16_t rx_overruns;
+  
+  usart_rx_handler_t rx_handler;
+} usart;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static int usart_stdio_put(char c, FILE* stream);
+static int usart_stdio_get(FILE* stream);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void usart_init(uint32_t baudrate)
+{
+  usart.tx_head = usart.tx_tail = 0;
+  usart.rx_head = usart.rx_tail = 0;
+  usart.rx_overruns = 0;
+  usart.rx_handler = NULL;
+  
+  /* Double speed, 8N1 */
+  USART_UCSRA = _BV(USART_U2X);
+  USART_UBRR = (uint16_t)((F_CPU / 4 / baudrate - 1) / 2);
+  USART_UCSRC = _BV(USART_UCSZ1) | _BV(USART_UCSZ0);
+  USART_UCSRB = _BV(USART_RXCIE) | _BV(USART_RXEN) | _BV(USART_TXEN);
+  
+  /* TX output, pull-up on RX */
+  DDRD |= _BV(USART_TX_PIN);
+  PORTD |= _BV(USART_RX_PIN);
+  
+  /* The first streams opened become stdin, stdout and stderr */
+  fdevopen(&usart_stdio_put, &usart_stdio_get);
+}
+
+uint8_t usart_putc(uint8_t c)
+{
+  uint8_t head = usart.tx_head;
+  
+  if ((uint8_t)(head - usart.tx_tail) >= USART_TX_SIZE)
+    return 0;
+  
+  usart.tx[head & (USART_TX_SIZE - 1)] = c;
+  usart.tx_head = head + 1;
+  
+  /* Start the transmission */
+  USART_UCSRB |= _BV(USART_UDRIE);
+  
+  return 1;
+}
+
+uint8_t usart_getc(uint8_t* c)
+{
+  uint8_t tail = usart.rx_tail;
+  
+  if (tail == usart.rx_head)
+    return 0;
+  
+  *c = usart.rx[tail & (USART_RX_SIZE - 1)];
+  usart.rx_tail = tail + 1;
+  
+  return 1;
+}
+
+uint8_t usart_rx_available(void)
+{
+  return (uint8_t)(usart.rx_head - usart.rx_tail);
+}
+
+void usart_flush(void)
+{
+  while (usart.tx_head != usart.tx_tail)
+    sleep_mode();
+}
+
+uint16_t usart_get_rx_overruns(void)
+{
+  return usart.rx_overruns;
+}
+
+/* The handler runs in the receive interrupt, NULL restores the ring */
+void usart_set_rx_handler(usart_rx_handler_t handler)
+{
+  usart.rx_handler = handler;
+}
+
+/* Move one byte of the ring to the data register, the caller has checked
+   that the ring is not empty */
+static void usart_tx_next(void)
+{
+  uint8_t tail = usart.tx_tail;
+  
+  USART_UDR = usart.tx[tail & (USART_TX_SIZE - 1)];
+  usart.tx_tail = tail + 1;
+}
+
+/* Data register empty interrupt */
+ISR(USART_UDRE_VECT)
+{
+  if (usart.tx_head == usart.tx_tail)
+    USART_UCSRB &= ~_BV(USART_UDRIE);
+  else
+    usart_tx_next();
+}
+
+/* Receive complete interrupt */
+ISR(USART_RX_VECT)
+{
+  uint8_t head = usart.rx_head;
+  uint8_t c = USART_UDR;
+  
+  if (usart.rx_handler)
+  {
+    usart.rx_handler(c);
+    return;
+  }
+  
+  if ((uint8_t)(head - usart.rx_tail) >= USART_RX_SIZE)
+  {
+    usart.rx_overruns++;
+    return;
+  }
+  
+  usart.rx[head & (USART_RX_SIZE - 1)] = c;
+  usart.rx_head = head + 1;
+}
+
+/* stdio */
+
+static int usart_stdio_put(char c, FILE* stream)
+{
+  while (!usart_putc(c))
+  {
+    if (!(SREG & _BV(SREG_I)))
+    {
+      /* No interrupt to empty the ring: do its job */
+      loop_until_bit_is_set(USART_UCSRA, USART_UDRE);
+      usart_tx_next();
+    }
+    else
+    {
+      /* Idle until the next UDRE interrupt makes room */
+      cli();
+      if ((uint8_t)(usart.tx_head - usart.tx_tail) >= USART_TX_SIZE)
+      {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+      }
+      sei();
+    }
+  }
+  
+  return 0;
+}
+
+static int usart_stdio_get(FILE* stream)
+{
+  uint8_t c;
+  
+  /* Sleep until the receive interrupt, without missing it */
+  cli();
+  while (!usart_getc(&c))
+  {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  sei();
+  
+  return c;
+}
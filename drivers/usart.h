@@ -0,0 +1,37 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef USART_H
+#define USART_H
+
+typedef void (*usart_rx_handler_t)(uint8_t c);
+
+void usart_init(uint32_t baudrate);
+uint8_t usart_putc(uint8_t c);
+uint8_t usart_getc(uint8_t* c);
+uint8_t usart_rx_available(void);
+void usart_flush(void);
+uint16_t usart_get_rx_overruns(void);
+void usart_set_rx_handler(usart_rx_handler_t handler);
+
+#endif /* USART_H */
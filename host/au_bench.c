@@ -0,0 +1,435 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: allocation unit benchmark
+*
+* Replays the card accesses of the firmware on the slots of an image, with
+* drivers/slotfs.c and a model of the card which charges the change of
+* allocation unit. The recorder writes every slot of the read-write
+* partitions in buffers of PCM_BUFFER_SIZE and updates its content size,
+* then the player reads every slot back the same way, both through the
+* single block cache of sd_raw. The image is loaded in memory, the file is
+* left unchanged.
+*
+*   au_bench [-v] [-a <blocks>] [-r <us>] [-R <us>] [-w <us>] [-W <us>]
+*            [-l <blocks>] <image> ...
+*
+*   -a  allocation unit, default 8192 blocks (4 MB)
+*   -r  block read time, default 300 us
+*   -R  extra time of a read in another allocation unit, default 1000 us
+*   -w  block write time, default 1000 us
+*   -W  extra time of a write in another allocation unit, default 50000 us
+*   -l  recording length, default 156 blocks (10 s at 8 kHz)
+*   -v  results of every slot
+*
+* Prints the allocation unit changes, the card time and the buffers late
+* on their period (the next one must be ready when one is done) of each
+* image, to compare a packed image with an aligned one of sounds/Makefile.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sd_raw.h"
+#include "slotfs.h"
+#include "buffer.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define RECORD_RATE (8000)
+#define NO_BLOCK    (0xFFFFFFFF)
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint32_t buffers;
+  uint32_t late;
+  uint32_t au_changes;
+  uint64_t us;
+  uint32_t max_us;
+} t_result;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+
+/* Card model */
+static struct {
+  uint8_t* image;
+  uint32_t nb_blocks;
+  
+  /* Block cache of sd_raw, written back on a change of block or a sync */
+  uint8_t block[512];
+  uint32_t cached;
+  uint8_t dirty;
+  
+  uint32_t au_blocks;
+  uint32_t read_us;
+  uint32_t read_au_us;
+  uint32_t write_us;
+  uint32_t write_au_us;
+  
+  /* Allocation units of the last read and of the last write */
+  uint32_t read_au;
+  uint32_t write_au;
+  
+  uint32_t au_changes;
+  uint64_t us;
+} card;
+
+static struct {
+  uint8_t verbose;
+  uint16_t record_blocks;
+  uint32_t errors;
+} bench;
+
+/*****************************************************************************
+* Card model
+******************************************************************************/
+
+static uint8_t card_flush(void)
+{
+  uint32_t au;
+  
+  if (!card.dirty)
+    return 1;
+  
+  au = card.cached / card.au_blocks;
+  card.us += card.write_us;
+  if (au != card.write_au)
+  {
+    card.us += card.write_au_us;
+    card.au_changes++;
+    card.write_au = au;
+  }
+  
+  memcpy(card.image + card.cached * 512, card.block, 512);
+  card.dirty = 0;
+  return 1;
+}
+
+/* Cache a block, read from the card unless it is overwritten as a whole */
+static uint8_t card_select(uint32_t block, uint8_t read)
+{
+  uint32_t au;
+  
+  if (block == card.cached)
+    return 1;
+  
+  if ((block >= card.nb_blocks) || !card_flush())
+    return 0;
+  
+  card.cached = block;
+  if (!read)
+    return 1;
+  
+  au = block / card.au_blocks;
+  card.us += card.read_us;
+  if (au != card.read_au)
+  {
+    card.us += card.read_au_us;
+    card.au_changes++;
+    card.read_au = au;
+  }
+  
+  memcpy(card.block, card.image + block * 512, 512);
+  return 1;
+}
+
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+  while (length)
+  {
+    uint16_t block_offset = offset & 511;
+    uint16_t n = (length < 512u - block_offset) ? length : 512u - block_offset;
+    
+    if (!card_select(offset >> 9, 1))
+      return 0;
+    
+    memcpy(buffer, card.block + block_offset, n);
+    offset += n;
+    buffer += n;
+    length -= n;
+  }
+  return 1;
+}
+
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+  while (length)
+  {
+    uint16_t block_offset = offset & 511;
+    uint16_t n = (length < 512u - block_offset) ? length : 512u - block_offset;
+    
+    if (!card_select(offset >> 9, n < 512))
+      return 0;
+    
+    memcpy(card.block + block_offset, buffer, n);
+    card.dirty = 1;
+    offset += n;
+    buffer += n;
+    length -= n;
+  }
+  return 1;
+}
+
+uint8_t sd_raw_sync(void)
+{
+  return card_flush();
+}
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Card time of each buffer against the period of a buffer at the rate */
+static void replay_buffer(t_result* result, uint64_t start_us, uint16_t rate)
+{
+  uint32_t us = (uint32_t)(card.us - start_us);
+  
+  result->buffers++;
+  result->us += us;
+  if (us > result->max_us)
+    result->max_us = us;
+  if ((uint64_t)us * rate > (uint64_t)PCM_BUFFER_SIZE * 1000000)
+    result->late++;
+}
+
+static void print_result(const char* what, const t_result* result)
+{
+  printf("  %-6s %6u buffers, %5u late, max %6u us, %4u AU changes, %8.1f ms\n",
+         what, result->buffers, result->late, result->max_us, result->au_changes, result->us / 1000.0);
+}
+
+static void add_result(t_result* total, const t_result* result)
+{
+  total->buffers += result->buffers;
+  total->late += result->late;
+  total->au_changes += result->au_changes;
+  total->us += result->us;
+  if (result->max_us > total->max_us)
+    total->max_us = result->max_us;
+}
+
+/* As the recorder: blocks of the capture buffers, then the content size */
+static void replay_record(uint8_t partition, uint8_t slot, t_result* result)
+{
+  static uint8_t samples[PCM_BUFFER_SIZE];
+  uint32_t start_block;
+  uint16_t max_content_blocks;
+  uint16_t nb_blocks;
+  uint32_t au_changes = card.au_changes;
+  
+  if (!slotfs_allocate_slot(partition, slot))
+    return;
+  slotfs_get_slot_info(partition, slot, &start_block, &max_content_blocks, NULL);
+  
+  nb_blocks = (bench.record_blocks < max_content_blocks) ? bench.record_blocks : max_content_blocks;
+  memset(samples, 0x80, sizeof(samples));
+  
+  for (uint16_t i = 0; i < nb_blocks * (512 / PCM_BUFFER_SIZE); i++)
+  {
+    uint64_t start_us = card.us;
+    
+    if (!sd_raw_write((start_block << 9) + i * PCM_BUFFER_SIZE, samples, PCM_BUFFER_SIZE))
+      bench.errors++;
+    replay_buffer(result, start_us, RECORD_RATE);
+  }
+  
+  sd_raw_sync();
+  slotfs_update_slot_content_size(partition, slot, nb_blocks);
+  
+  result->au_changes += card.au_changes - au_changes;
+}
+
+/* As the player: the sparse header, then the buffers of the content */
+static void replay_play(uint8_t partition, uint8_t slot, t_result* result)
+{
+  static uint8_t samples[PCM_BUFFER_SIZE];
+  uint32_t start_block;
+  uint16_t nb_blocks;
+  uint16_t rate = 0;
+  uint32_t au_changes = card.au_changes;
+  
+  slotfs_get_slot_format(partition, slot, &rate, NULL, NULL);
+  slotfs_get_slot_info(partition, slot, &start_block, NULL, &nb_blocks);
+  if (rate == 0)
+    rate = 8000;
+  
+  if (nb_blocks > 1)
+    sd_raw_read(start_block << 9, samples, 16);
+  
+  for (uint32_t i = 0; i < nb_blocks * (512 / PCM_BUFFER_SIZE); i++)
+  {
+    uint64_t start_us = card.us;
+    
+    if (!sd_raw_read((start_block << 9) + i * PCM_BUFFER_SIZE, samples, PCM_BUFFER_SIZE))
+      bench.errors++;
+    replay_buffer(result, start_us, rate);
+  }
+  
+  result->au_changes += card.au_changes - au_changes;
+}
+
+static uint8_t load_image(const char* name)
+{
+  FILE* f = fopen(name, "rb");
+  long size;
+  
+  if (!f || fseek(f, 0, SEEK_END) || ((size = ftell(f)) < 512) || fseek(f, 0, SEEK_SET))
+  {
+    perror(name);
+    if (f)
+      fclose(f);
+    return 0;
+  }
+  
+  free(card.image);
+  card.nb_blocks = (uint32_t)(size / 512);
+  card.image = malloc(card.nb_blocks * 512);
+  if (!card.image || (fread(card.image, 512, card.nb_blocks, f) != card.nb_blocks))
+  {
+    fprintf(stderr, "%s: cannot read the image\n", name);
+    fclose(f);
+    return 0;
+  }
+  
+  fclose(f);
+  return 1;
+}
+
+static void run_image(const char* name)
+{
+  t_result record = { 0 }, play = { 0 };
+  
+  if (!load_image(name))
+  {
+    bench.errors++;
+    return;
+  }
+  
+  card.cached = NO_BLOCK;
+  card.dirty = 0;
+  card.read_au = NO_BLOCK;
+  card.write_au = NO_BLOCK;
+  card.au_changes = 0;
+  card.us = 0;
+  
+  if (!slotfs_init())
+  {
+    fprintf(stderr, "%s: no slotfs\n", name);
+    bench.errors++;
+    return;
+  }
+  
+  printf("%s: %u blocks\n", name, card.nb_blocks);
+  
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    for (uint8_t i = 0; i < slotfs_get_nb_partitions(); i++)
+    {
+      uint8_t nb_slots = 0;
+      uint8_t read_only;
+      
+      slotfs_get_partition_info(i, NULL, &nb_slots);
+      /* Read-only flag of the partition header */
+      sd_raw_read(slotfs_get_partition_start(i) * 512 + 7, &read_only, 1);
+      
+      for (uint8_t j = 0; j < nb_slots; j++)
+      {
+        t_result result = { 0 };
+        
+        if (pass == 0)
+        {
+          if (read_only)
+            continue;
+          replay_record(i, j, &result);
+          add_result(&record, &result);
+        }
+        else
+        {
+          replay_play(i, j, &result);
+          add_result(&play, &result);
+        }
+        
+        if (bench.verbose && result.buffers)
+        {
+          char what[16];
+          
+          snprintf(what, sizeof(what), "%c%u.%02u", pass ? 'P' : 'R', i, j);
+          print_result(what, &result);
+        }
+      }
+    }
+  }
+  
+  print_result("record", &record);
+  print_result("play", &play);
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+  
+  card.au_blocks = 8192;
+  card.read_us = 300;
+  card.read_au_us = 1000;
+  card.write_us = 1000;
+  card.write_au_us = 50000;
+  bench.record_blocks = 156;
+  
+  while ((opt = getopt(argc, argv, "a:r:R:w:W:l:vh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a': card.au_blocks = strtoul(optarg, NULL, 0); break;
+      case 'r': card.read_us = strtoul(optarg, NULL, 0); break;
+      case 'R': card.read_au_us = strtoul(optarg, NULL, 0); break;
+      case 'w': card.write_us = strtoul(optarg, NULL, 0); break;
+      case 'W': card.write_au_us = strtoul(optarg, NULL, 0); break;
+      case 'l': bench.record_blocks = strtoul(optarg, NULL, 0); break;
+      case 'v': bench.verbose = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-v] [-a <blocks>] [-r <us>] [-R <us>] [-w <us>] [-W <us>] [-l <blocks>] <image> ...\n", argv[0]);
+        return 2;
+    }
+  }
+  
+  if (card.au_blocks == 0)
+    card.au_blocks = 1;
+  
+  for (int i = optind; i < argc; i++)
+    run_image(argv[i]);
+  
+  free(card.image);
+  
+  return bench.errors ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: cry detector benchmark
+*
+* Feeds audio/cry.c with labelled WAV clips, as the 8 kHz capture stream
+* of the firmware in buffers of 256 samples, and checks the detections
+* against the labels. The label is the start of the file name: cry_*.wav
+* must be detected, any other clip must not. tools/cry_clips.py writes a
+* set of synthetic clips.
+*
+*   cry_bench [-v] <clip.wav> ...
+*
+* Prints the time of the first detection of each clip and the host time
+* per frame, exits with 1 when a clip is misclassified.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "cry.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define CAPTURE_RATE  (8000)
+#define BUFFER_SIZE   (256)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  uint8_t verbose;
+  uint32_t clips;
+  uint32_t errors;
+  uint64_t frames;
+  uint64_t ns;
+} bench;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Unsigned 8-bit mono samples of a PCM WAV file at the capture rate,
+   NULL if the file cannot be read */
+static uint8_t* load_clip(const char* name, uint32_t* nb_samples)
+{
+  FILE* f = fopen(name, "rb");
+  uint8_t* wav;
+  uint8_t* samples = NULL;
+  uint32_t size, pos = 12;
+  uint16_t channels = 0, bits = 0;
+  uint32_t rate = 0;
+  long length;
+
+  if (!f)
+  {
+    perror(name);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  wav = malloc(length ? length : 1);
+  if (!wav || (fread(wav, 1, length, f) != (size_t)length))
+  {
+    fprintf(stderr, "%s: read error\n", name);
+    fclose(f);
+    free(wav);
+    return NULL;
+  }
+  fclose(f);
+  size = (uint32_t)length;
+
+  if ((size < 12) || memcmp(wav, "RIFF", 4) || memcmp(wav + 8, "WAVE", 4))
+  {
+    fprintf(stderr, "%s: not a WAV file\n", name);
+    free(wav);
+    return NULL;
+  }
+
+  while (pos + 8 <= size)
+  {
+    uint32_t chunk_size;
+    memcpy(&chunk_size, wav + pos + 4, 4);
+
+    if (!memcmp(wav + pos, "fmt ", 4))
+    {
+      memcpy(&channels, wav + pos + 10, 2);
+      memcpy(&rate, wav + pos + 12, 4);
+      memcpy(&bits, wav + pos + 22, 2);
+    }
+    else if (!memcmp(wav + pos, "data", 4))
+    {
+      uint32_t frame = channels * bits / 8;
+      uint32_t nb_input;
+
+      if (!frame || !rate || ((bits != 8) && (bits != 16)))
+        break;
+
+      if (chunk_size > size - pos - 8)
+        chunk_size = size - pos - 8;
+      nb_input = chunk_size / frame;
+
+      /* Nearest sample at the capture rate, as the ADC of the simulator */
+      *nb_samples = (uint32_t)((uint64_t)nb_input * CAPTURE_RATE / rate);
+      samples = malloc(*nb_samples ? *nb_samples : 1);
+      for (uint32_t i = 0; i < *nb_samples; i++)
+      {
+        const uint8_t* p = wav + pos + 8 + (uint32_t)((uint64_t)i * rate / CAPTURE_RATE) * frame;
+        samples[i] = (bits == 8) ? p[0] : (uint8_t)(p[1] ^ 0x80);
+      }
+      break;
+    }
+
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  if (!samples)
+    fprintf(stderr, "%s: no 8-bit or 16-bit PCM data\n", name);
+
+  free(wav);
+  return samples;
+}
+
+static void run_clip(const char* name)
+{
+  char* path = strdup(name);
+  const char* base = basename(path);
+  uint8_t expected = !strncmp(base, "cry", 3);
+  uint32_t nb_samples, detections = 0, first = 0;
+  uint8_t* samples = load_clip(name, &nb_samples);
+  struct timespec start, end;
+
+  if (!samples)
+  {
+    bench.errors++;
+    free(path);
+    return;
+  }
+
+  cry_init();
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t pos = 0; pos + BUFFER_SIZE <= nb_samples; pos += BUFFER_SIZE)
+  {
+    if (cry_process(samples + pos, BUFFER_SIZE))
+    {
+      if (!detections++)
+        first = pos + BUFFER_SIZE;
+      if (bench.verbose)
+        printf("  %s: cry at %.2f s\n", base, (double)(pos + BUFFER_SIZE) / CAPTURE_RATE);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  bench.ns += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+  bench.frames += nb_samples / CRY_FRAME_SIZE;
+  bench.clips++;
+
+  if (detections)
+    printf("%-24s %-4s detected at %6.2f s (%u)", base, expected ? "cry" : "none",
+           (double)first / CAPTURE_RATE, detections);
+  else
+    printf("%-24s %-4s not detected         ", base, expected ? "cry" : "none");
+
+  if (!detections == !expected)
+  {
+    printf("  ok\n");
+  }
+  else
+  {
+    printf("  FAIL\n");
+    bench.errors++;
+  }
+
+  free(samples);
+  free(path);
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "vh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'v': bench.verbose = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-v] <clip.wav> ...\n", argv[0]);
+        return 2;
+    }
+  }
+
+  for (int i = optind; i < argc; i++)
+    run_clip(argv[i]);
+
+  if (bench.frames)
+    printf("%u clips, %u errors, %.0f ns per frame of %u samples\n",
+           bench.clips, bench.errors, (double)bench.ns / bench.frames, CRY_FRAME_SIZE);
+
+  return bench.errors ? 1 : 0;
+}
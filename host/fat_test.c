@@ -0,0 +1,315 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: test of the cluster run cache of the FAT layer
+*
+* Builds a FAT16 volume in memory holding one file fragmented in 7 runs of
+* clusters, one sector each, out of order on the volume, and reads it
+* through the vendored fat.c:
+*   - streamed twice from the start with random read lengths
+*   - at 20000 random positions, each read then followed by another one
+*   - from the start after a truncation
+* and checks every byte against the pattern of its file position. The
+* device reads and the FAT sector reads are counted.
+*
+*   fat_test
+*
+* Built once per cache size, with FAT_FILE_EXTENT_COUNT 0 for the chain
+* walk without cache. Exits with 1 on a mismatch.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "partition.h"
+#include "fat.h"
+#include "fat_config.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define SECTOR_SIZE     (512)
+#define RESERVED        (1)     /* Boot sector */
+#define FAT_SECTORS     (20)    /* One FAT */
+#define ROOT_SECTORS    (32)    /* 512 root entries */
+#define NB_CLUSTERS     (5000)  /* Of one sector, FAT16 */
+#define NB_SECTORS      (RESERVED + FAT_SECTORS + ROOT_SECTORS + NB_CLUSTERS)
+
+#define FAT_START       (RESERVED * SECTOR_SIZE)
+#define ROOT_START      ((RESERVED + FAT_SECTORS) * SECTOR_SIZE)
+#define DATA_START      ((RESERVED + FAT_SECTORS + ROOT_SECTORS) * SECTOR_SIZE)
+
+#define SEEK_READS      (20000)
+#define TRUNCATED_SIZE  (9000)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+
+/* Runs of clusters of the file, <first cluster, nb clusters> */
+static const uint16_t runs[][2] = {
+  {  2,  8}, { 20, 10}, { 15,  1}, { 40, 20}, {100, 20}, {200, 11}, {300,  3}
+};
+
+static uint8_t image[NB_SECTORS * SECTOR_SIZE];
+static uint8_t buffer[70000];
+
+static struct {
+  uint32_t reads;
+  uint32_t fat_reads;
+  uint32_t checks;
+  uint32_t failures;
+} test;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Byte at a position of the file */
+static uint8_t pattern(uint32_t position)
+{
+  return (uint8_t)((position * 2654435761u) >> 13);
+}
+
+static void check(int condition, const char* message, uint32_t value)
+{
+  test.checks++;
+  if (!condition)
+  {
+    test.failures++;
+    printf("FAIL %s %u\n", message, value);
+  }
+}
+
+/* Bytes of a read against the pattern, from a file position */
+static void check_data(const uint8_t* data, intptr_t length, uint32_t position, const char* message)
+{
+  intptr_t i;
+
+  for (i = 0; i < length; i++)
+  {
+    if (data[i] != pattern(position + i))
+      break;
+  }
+
+  check(i == length, message, position + (uint32_t)i);
+}
+
+static uint8_t device_read(offset_t offset, uint8_t* data, uintptr_t length)
+{
+  test.reads++;
+  if ((offset >= FAT_START) && (offset < ROOT_START))
+    test.fat_reads++;
+
+  memcpy(data, image + offset, length);
+  return 1;
+}
+
+static uint8_t device_read_interval(offset_t offset, uint8_t* data, uintptr_t interval, uintptr_t length,
+                                    device_read_callback_t callback, void* p)
+{
+  while (length >= interval)
+  {
+    test.reads++;
+    memcpy(data, image + offset, interval);
+    if (!callback(data, offset, p))
+      break;
+    offset += interval;
+    length -= interval;
+  }
+
+  return 1;
+}
+
+static uint8_t device_write(offset_t offset, const uint8_t* data, uintptr_t length)
+{
+  memcpy(image + offset, data, length);
+  return 1;
+}
+
+static uint8_t device_write_interval(offset_t offset, uint8_t* data, uintptr_t length,
+                                     device_write_callback_t callback, void* p)
+{
+  return 0;
+}
+
+/* FAT16 volume with TEST.BIN in its runs of clusters, the size of the file */
+static uint32_t build_image(void)
+{
+  uint16_t* fat = (uint16_t*)(image + FAT_START);
+  uint8_t* boot = image;
+  uint8_t* entry = image + ROOT_START;
+  uint32_t position = 0;
+  uint32_t size;
+  int previous = -1;
+
+  boot[0x0b] = SECTOR_SIZE & 0xFF;
+  boot[0x0c] = SECTOR_SIZE >> 8;
+  boot[0x0d] = 1;                                 /* Sectors per cluster */
+  boot[0x0e] = RESERVED;
+  boot[0x10] = 1;                                 /* FAT copies */
+  boot[0x11] = (ROOT_SECTORS * SECTOR_SIZE / 32) & 0xFF;
+  boot[0x12] = (ROOT_SECTORS * SECTOR_SIZE / 32) >> 8;
+  boot[0x13] = NB_SECTORS & 0xFF;
+  boot[0x14] = NB_SECTORS >> 8;
+  boot[0x16] = FAT_SECTORS;
+
+  fat[0] = 0xFFF8;
+  fat[1] = 0xFFFF;
+
+  for (uint8_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+  {
+    for (int cluster = runs[r][0]; cluster < runs[r][0] + runs[r][1]; cluster++)
+    {
+      if (previous >= 0)
+        fat[previous] = cluster;
+      previous = cluster;
+
+      for (int i = 0; i < SECTOR_SIZE; i++, position++)
+        image[DATA_START + (cluster - 2) * SECTOR_SIZE + i] = pattern(position);
+    }
+  }
+  fat[previous] = 0xFFFF;
+
+  /* The file ends inside its last cluster */
+  size = position - 100;
+  memcpy(entry, "TEST    BIN", 11);
+  entry[11] = 0x20;                               /* Archive */
+  entry[26] = runs[0][0];
+  memcpy(entry + 28, &size, 4);
+
+  return size;
+}
+
+static void test_stream(struct fat_file_struct* fd, uint32_t size, uint8_t pass)
+{
+  int32_t offset = 0;
+  uint32_t position = 0;
+  intptr_t length;
+
+  test.reads = test.fat_reads = 0;
+  fat_seek_file(fd, &offset, FAT_SEEK_SET);
+
+  while ((length = fat_read_file(fd, buffer, 1 + rand() % 1500)) > 0)
+  {
+    check_data(buffer, length, position, "stream mismatch at");
+    position += length;
+  }
+
+  check((length == 0) && (position == size), "stream size", position);
+  printf("stream %u:   %6u reads, %6u FAT reads\n", pass, test.reads, test.fat_reads);
+}
+
+static void test_seek(struct fat_file_struct* fd, uint32_t size)
+{
+  test.reads = test.fat_reads = 0;
+
+  for (uint32_t i = 0; i < SEEK_READS; i++)
+  {
+    int32_t offset = rand() % (size + 1);
+    uintptr_t length = 1 + rand() % 3000;
+    uintptr_t expected = ((uint32_t)offset >= size) ? 0 :
+                         ((size - offset < length) ? size - offset : length);
+    intptr_t got;
+
+    if (!fat_seek_file(fd, &offset, FAT_SEEK_SET))
+    {
+      check(0, "seek to", (uint32_t)offset);
+      continue;
+    }
+
+    got = fat_read_file(fd, buffer, length);
+    check(got == (intptr_t)expected, "seek read length at", (uint32_t)offset);
+    check_data(buffer, got, offset, "seek mismatch at");
+
+    /* Keep reading from there */
+    if (got > 0)
+    {
+      uint32_t position = offset + got;
+      got = fat_read_file(fd, buffer, 700);
+      check_data(buffer, got, position, "next read mismatch at");
+    }
+  }
+
+  printf("seek:       %6u reads, %6u FAT reads\n", test.reads, test.fat_reads);
+}
+
+static void test_truncate(struct fat_file_struct* fd)
+{
+  int32_t offset = 0;
+  intptr_t got;
+
+  check(fat_resize_file(fd, TRUNCATED_SIZE), "resize to", TRUNCATED_SIZE);
+  fat_seek_file(fd, &offset, FAT_SEEK_SET);
+
+  got = fat_read_file(fd, buffer, 20000);
+  check(got == TRUNCATED_SIZE, "truncated read length", (uint32_t)got);
+  check_data(buffer, got, 0, "truncated mismatch at");
+}
+
+int main(void)
+{
+  struct partition_struct partition;
+  struct fat_dir_entry_struct entry;
+  struct fat_fs_struct* fs;
+  struct fat_file_struct* fd;
+  uint32_t size = build_image();
+
+  memset(&partition, 0x00, sizeof(partition));
+  partition.device_read = device_read;
+  partition.device_read_interval = device_read_interval;
+  partition.device_write = device_write;
+  partition.device_write_interval = device_write_interval;
+  partition.type = PARTITION_TYPE_FAT16;
+  partition.offset = 0;
+  partition.length = NB_SECTORS;
+
+  fs = fat_open(&partition);
+  if (!fs || !fat_get_dir_entry_of_path(fs, "/TEST.BIN", &entry) ||
+      !(fd = fat_open_file(fs, &entry)))
+  {
+    printf("FAIL cannot open TEST.BIN\n");
+    return 1;
+  }
+
+  printf("%u cluster runs cached, file of %u bytes in %u runs\n",
+         FAT_FILE_EXTENT_COUNT, size, (uint32_t)(sizeof(runs) / sizeof(runs[0])));
+
+  srand(1);
+  test_stream(fd, size, 0);
+  test_stream(fd, size, 1);
+  test_seek(fd, size);
+  test_truncate(fd);
+
+  fat_close_file(fd);
+  fat_close(fs);
+
+  printf("%u checks, %u failures\n", test.checks, test.failures);
+
+  return test.failures ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+"""Card fault injection test of the playback and the recording.
+
+Runs the shell simulator with read and write faults injected by the card
+model once a stream is running, and checks that:
+  - playback goes on to the end of the slot with some failed reads, each
+    buffer of half a block reads it again after a failure
+  - playback ends when every read fails, after 8 consecutive read errors
+  - recording ends when every write fails, after 8 consecutive write errors
+  - both end before the deadline given by the sd_raw timeouts, and the
+    shell still lists the card once the faults stop
+
+  fault_test.py [-s <simulator>] [-i <image>]
+"""
+
+import argparse
+import math
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import wave
+
+TRACE_SYNC = 0xA5
+RECORD_SIZE = 6
+
+# Slot 10 of partition 1: 61 blocks at 16000 Hz, about 2 s
+PLAY_SLOT = 10
+PLAY_BLOCKS = 61
+PLAY_MS = 2000
+
+# A failed block costs SD_RAW_RETRIES + 1 timeouts of 1 byte per us:
+# 2 x 65 ms to read, 2 x 164 ms to write. The streams must end after the
+# 8 errors of their limit, allow for twice their cost.
+READ_LIMIT_MS = 2 * 8 * 2 * 66
+WRITE_LIMIT_MS = 2 * 8 * 2 * 164
+
+
+class Test:
+    def __init__(self, simulator, image):
+        self.simulator = simulator
+        self.image = image
+        self.checks = 0
+        self.failures = 0
+
+    def check(self, condition, message):
+        self.checks += 1
+        if not condition:
+            self.failures += 1
+            print('FAIL %s' % message)
+
+    def run(self, events, end_ms, adc=None):
+        args = [self.simulator, '-i', self.image, '-t', str(end_ms)]
+        if adc:
+            args += ['-a', adc]
+        for event in events:
+            args += ['-e', event]
+        result = subprocess.run(args, stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE, check=True)
+        output = result.stdout
+        self.stats = result.stderr.decode('latin-1')
+
+        # Drop the trace records mixed with the text
+        text = bytearray()
+        i = 0
+        while i < len(output):
+            if output[i] == TRACE_SYNC:
+                i += RECORD_SIZE
+                continue
+            text.append(output[i])
+            i += 1
+        return text.decode('latin-1')
+
+    def counter(self, text, name):
+        match = re.search(r'%s errors = (\d+)' % name, text)
+        return int(match.group(1)) if match else 0
+
+    def check_stop(self, name, text, end, errors, expected):
+        # The end of the stream is printed before the listing requested at
+        # the deadline, once the faults stop
+        listing = text.find('4 partitions')
+        self.check(listing >= 0,
+                   '%s: the card is not listed after the faults' % name)
+        self.check(0 <= text.find(end) < listing,
+                   '%s: no "%s" before the deadline' % (name, end))
+        self.check(errors == expected,
+                   '%s: %u errors, expected %u' % (name, errors, expected))
+
+    def playback(self, name, read_faults, deadline_ms, expected):
+        start = 700
+        text = self.run(['%u serial playslot %u' % (start, PLAY_SLOT),
+                         '%u faults %u 0' % (start + 60, read_faults),
+                         '%u faults 0 0' % (start + deadline_ms),
+                         '%u serial ls' % (start + deadline_ms + 100)],
+                        start + deadline_ms + 1000)
+        errors = self.counter(text, 'Read')
+        if expected is None:
+            # Not stopped by the error limit: every block has been read
+            match = re.search(r'blocks read (\d+)', self.stats)
+            blocks = int(match.group(1)) if match else 0
+            self.check(errors > 0, '%s: no read errors' % name)
+            self.check(blocks >= PLAY_BLOCKS,
+                       '%s: %u blocks read, expected %u' % (name, blocks, PLAY_BLOCKS))
+            expected = errors
+        self.check_stop(name, text, 'End of playback', errors, expected)
+        print('%-24s %u read errors' % (name, errors))
+
+    def recording(self, name, adc, write_faults, deadline_ms):
+        start = 700
+        text = self.run(['%u serial recslot 0' % start,
+                         '%u faults 0 %u' % (start + 300, write_faults),
+                         '%u faults 0 0' % (start + 300 + deadline_ms),
+                         '%u serial ls' % (start + 300 + deadline_ms + 100)],
+                        start + deadline_ms + 1500, adc)
+        errors = self.counter(text, 'Write')
+        self.check_stop(name, text, 'End of record slot 0', errors, 8)
+        print('%-24s %u write errors' % (name, errors))
+
+
+def write_tone(name, seconds):
+    with wave.open(name, 'wb') as w:
+        w.setnchannels(1)
+        w.setsampwidth(1)
+        w.setframerate(8000)
+        w.writeframes(bytes(int(128 + 60 * math.sin(2 * math.pi * 400 * i / 8000))
+                            for i in range(8000 * seconds)))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-s', '--simulator', default=os.path.join(here, 'sim_shell'))
+    parser.add_argument('-i', '--image',
+                        default=os.path.join(here, '..', 'sounds', 'babyphone.image'))
+    args = parser.parse_args()
+
+    test = Test(args.simulator, args.image)
+
+    # The voice activity trigger starts the recording on the tone at once
+    with tempfile.TemporaryDirectory() as directory:
+        tone = os.path.join(directory, 'tone.wav')
+        write_tone(tone, 10)
+
+        test.playback('playback, 30% faults', 300, PLAY_MS + 2 * READ_LIMIT_MS, None)
+        test.playback('playback, all faults', 1000, READ_LIMIT_MS, 8)
+        test.recording('recording, all faults', tone, 1000, WRITE_LIMIT_MS)
+
+    print('%u checks, %u failures' % (test.checks, test.failures))
+    return 1 if test.failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,49 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: EEPROM accessors
+*
+* EEMEM variables live in host RAM for the duration of a run.
+******************************************************************************/
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <avr/io.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_byte(p)         (*(const uint8_t*)(p))
+#define eeprom_write_byte(p, v)     (*(uint8_t*)(p) = (v))
+#define eeprom_update_byte(p, v)    eeprom_write_byte(p, v)
+#define eeprom_read_word(p)         (*(const uint16_t*)(p))
+#define eeprom_write_word(p, v)     (*(uint16_t*)(p) = (v))
+#define eeprom_update_word(p, v)    eeprom_write_word(p, v)
+#define eeprom_read_block(d, s, n)  memcpy((d), (s), (n))
+#define eeprom_write_block(s, d, n) memcpy((d), (s), (n))
+#define eeprom_update_block(s, d, n) eeprom_write_block(s, d, n)
+
+#endif /* SIM_AVR_EEPROM_H */
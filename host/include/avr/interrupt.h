@@ -0,0 +1,44 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: interrupt control
+*
+* ISR bodies become plain functions named after their vector. The simulator
+* dispatches them from the timer and peripheral models while the global
+* interrupt flag is set.
+******************************************************************************/
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+void sim_sei(void);
+void sim_cli(void);
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#endif /* SIM_AVR_INTERRUPT_H */
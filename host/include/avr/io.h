@@ -0,0 +1,327 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: register model of the ATmega328P
+*
+* Plain registers are backed by globals of the simulator. The registers with
+* a side effect on access (SPI transfer, ADC conversion, keyboard matrix
+* pins) go through an accessor which lets the simulator update the state
+* before the firmware reads or writes it.
+******************************************************************************/
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit)   ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+#define loop_until_bit_is_set(sfr, bit)   do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+/* Plain registers */
+extern volatile uint8_t  sim_DDRB;
+extern volatile uint8_t  sim_PORTB;
+extern volatile uint8_t  sim_PINB;
+extern volatile uint8_t  sim_DDRC;
+extern volatile uint8_t  sim_PORTC;
+extern volatile uint8_t  sim_DDRD;
+extern volatile uint8_t  sim_PORTD;
+extern volatile uint8_t  sim_TCCR0A;
+extern volatile uint8_t  sim_TCCR0B;
+extern volatile uint8_t  sim_TCNT0;
+extern volatile uint8_t  sim_OCR0A;
+extern volatile uint8_t  sim_OCR0B;
+extern volatile uint8_t  sim_TIMSK0;
+extern volatile uint8_t  sim_TIFR0;
+extern volatile uint8_t  sim_TCCR1A;
+extern volatile uint8_t  sim_TCCR1B;
+extern volatile uint8_t  sim_TCCR1C;
+extern volatile uint8_t  sim_TIMSK1;
+extern volatile uint8_t  sim_TIFR1;
+extern volatile uint8_t  sim_TCCR2A;
+extern volatile uint8_t  sim_TCCR2B;
+extern volatile uint8_t  sim_TCNT2;
+extern volatile uint8_t  sim_OCR2A;
+extern volatile uint8_t  sim_OCR2B;
+extern volatile uint8_t  sim_TIMSK2;
+extern volatile uint8_t  sim_TIFR2;
+extern volatile uint8_t  sim_ADMUX;
+extern volatile uint8_t  sim_ADCSRB;
+extern volatile uint8_t  sim_ADCL;
+extern volatile uint8_t  sim_DIDR0;
+extern volatile uint8_t  sim_SPCR;
+extern volatile uint8_t  sim_MCUSR;
+extern volatile uint8_t  sim_SREG;
+extern volatile uint8_t  sim_GPIOR0;
+extern volatile uint8_t  sim_UCSR0B;
+extern volatile uint8_t  sim_UCSR0C;
+extern volatile uint16_t sim_UBRR0;
+extern volatile uint16_t sim_TCNT1;
+extern volatile uint16_t sim_OCR1A;
+extern volatile uint16_t sim_OCR1B;
+extern volatile uint16_t sim_ICR1;
+
+#define DDRB     sim_DDRB
+#define PORTB    sim_PORTB
+#define PINB     sim_PINB
+#define DDRC     sim_DDRC
+#define PORTC    sim_PORTC
+#define DDRD     sim_DDRD
+#define PORTD    sim_PORTD
+#define TCCR0A   sim_TCCR0A
+#define TCCR0B   sim_TCCR0B
+#define TCNT0    sim_TCNT0
+#define OCR0A    sim_OCR0A
+#define OCR0B    sim_OCR0B
+#define TIMSK0   sim_TIMSK0
+#define TIFR0    sim_TIFR0
+#define TCCR1A   sim_TCCR1A
+#define TCCR1B   sim_TCCR1B
+#define TCCR1C   sim_TCCR1C
+#define TIMSK1   sim_TIMSK1
+#define TIFR1    sim_TIFR1
+#define TCCR2A   sim_TCCR2A
+#define TCCR2B   sim_TCCR2B
+#define TCNT2    sim_TCNT2
+#define OCR2A    sim_OCR2A
+#define OCR2B    sim_OCR2B
+#define TIMSK2   sim_TIMSK2
+#define TIFR2    sim_TIFR2
+#define ADMUX    sim_ADMUX
+#define ADCSRB   sim_ADCSRB
+#define ADCL     sim_ADCL
+#define DIDR0    sim_DIDR0
+#define SPCR     sim_SPCR
+#define MCUSR    sim_MCUSR
+#define SREG     sim_SREG
+#define GPIOR0   sim_GPIOR0
+#define UCSR0B   sim_UCSR0B
+#define UCSR0C   sim_UCSR0C
+#define UBRR0    sim_UBRR0
+#define TCNT1    sim_TCNT1
+#define OCR1A    sim_OCR1A
+#define OCR1B    sim_OCR1B
+#define ICR1     sim_ICR1
+
+/* Registers with side effects */
+volatile uint8_t* sim_pinc(void);
+volatile uint8_t* sim_pind(void);
+volatile uint8_t* sim_spsr(void);
+volatile uint8_t* sim_spdr(void);
+volatile uint8_t* sim_adcsra(void);
+volatile uint8_t* sim_adch(void);
+volatile uint16_t* sim_udr0(void);
+volatile uint8_t* sim_ucsr0a(void);
+
+#define PINC     (*sim_pinc())
+#define PIND     (*sim_pind())
+#define SPSR     (*sim_spsr())
+#define SPDR     (*sim_spdr())
+#define ADCSRA   (*sim_adcsra())
+#define ADCH     (*sim_adch())
+#define UCSR0A   (*sim_ucsr0a())
+#define UDR0     (*sim_udr0()) /* Reads return the byte plus 0x8000, to tell them from writes */
+
+/* Bit positions */
+#define PORTB0   0
+#define PORTB1   1
+#define PORTB2   2
+#define PORTB3   3
+#define PORTB4   4
+#define PORTB5   5
+#define PORTB6   6
+#define PORTB7   7
+#define PB0      0
+#define PB1      1
+#define PB2      2
+#define PB3      3
+#define PB4      4
+#define PB5      5
+#define PB6      6
+#define PB7      7
+#define DDB0     0
+#define DDB1     1
+#define DDB2     2
+#define DDB3     3
+#define DDB4     4
+#define DDB5     5
+#define DDB6     6
+#define DDB7     7
+#define PORTC0   0
+#define PORTC1   1
+#define PORTC2   2
+#define PORTC3   3
+#define PORTC4   4
+#define PORTC5   5
+#define PORTC6   6
+#define PC0      0
+#define PC1      1
+#define PC2      2
+#define PC3      3
+#define PC4      4
+#define PC5      5
+#define PC6      6
+#define DDC0     0
+#define DDC1     1
+#define DDC2     2
+#define DDC3     3
+#define DDC4     4
+#define DDC5     5
+#define DDC6     6
+#define PORTD0   0
+#define PORTD1   1
+#define PORTD2   2
+#define PORTD3   3
+#define PORTD4   4
+#define PORTD5   5
+#define PORTD6   6
+#define PORTD7   7
+#define PD0      0
+#define PD1      1
+#define PD2      2
+#define PD3      3
+#define PD4      4
+#define PD5      5
+#define PD6      6
+#define PD7      7
+#define DDD0     0
+#define DDD1     1
+#define DDD2     2
+#define DDD3     3
+#define DDD4     4
+#define DDD5     5
+#define DDD6     6
+#define DDD7     7
+#define WGM00    0
+#define WGM01    1
+#define COM0B0   4
+#define COM0B1   5
+#define COM0A0   6
+#define COM0A1   7
+#define CS00     0
+#define CS01     1
+#define CS02     2
+#define WGM02    3
+#define TOIE0    0
+#define OCIE0A   1
+#define OCIE0B   2
+#define TOV0     0
+#define OCF0A    1
+#define OCF0B    2
+#define WGM10    0
+#define WGM11    1
+#define COM1B0   4
+#define COM1B1   5
+#define COM1A0   6
+#define COM1A1   7
+#define CS10     0
+#define CS11     1
+#define CS12     2
+#define WGM12    3
+#define WGM13    4
+#define TOIE1    0
+#define OCIE1A   1
+#define OCIE1B   2
+#define ICIE1    5
+#define TOV1     0
+#define OCF1A    1
+#define OCF1B    2
+#define ICF1     5
+#define WGM20    0
+#define WGM21    1
+#define COM2B0   4
+#define COM2B1   5
+#define COM2A0   6
+#define COM2A1   7
+#define CS20     0
+#define CS21     1
+#define CS22     2
+#define WGM22    3
+#define MUX0     0
+#define MUX1     1
+#define MUX2     2
+#define MUX3     3
+#define ADLAR    5
+#define REFS0    6
+#define REFS1    7
+#define ADPS0    0
+#define ADPS1    1
+#define ADPS2    2
+#define ADIE     3
+#define ADIF     4
+#define ADATE    5
+#define ADSC     6
+#define ADEN     7
+#define ADTS0    0
+#define ADTS1    1
+#define ADTS2    2
+#define ADC0D    0
+#define ADC1D    1
+#define ADC2D    2
+#define ADC3D    3
+#define ADC4D    4
+#define ADC5D    5
+#define SPR0     0
+#define SPR1     1
+#define CPHA     2
+#define CPOL     3
+#define MSTR     4
+#define DORD     5
+#define SPE      6
+#define SPIE     7
+#define SPI2X    0
+#define WCOL     6
+#define SPIF     7
+#define PORF     0
+#define EXTRF    1
+#define BORF     2
+#define WDRF     3
+#define MPCM0    0
+#define U2X0     1
+#define UPE0     2
+#define DOR0     3
+#define FE0      4
+#define UDRE0    5
+#define TXC0     6
+#define RXC0     7
+#define TXB80    0
+#define RXB80    1
+#define UCSZ02   2
+#define TXEN0    3
+#define RXEN0    4
+#define UDRIE0   5
+#define TXCIE0   6
+#define RXCIE0   7
+#define UCPOL0   0
+#define UCSZ00   1
+#define UCSZ01   2
+#define USBS0    3
+#define UPM00    4
+#define UPM01    5
+#define SREG_I   7
+
+#endif /* SIM_AVR_IO_H */
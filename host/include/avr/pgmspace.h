@@ -0,0 +1,59 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: program memory accessors
+*
+* Flash and RAM share the host address space, so the _P variants map to
+* their plain counterparts.
+******************************************************************************/
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P   const char*
+
+#define pgm_read_byte(addr)       (*(const uint8_t*)(addr))
+#define pgm_read_byte_near(addr)  pgm_read_byte(addr)
+#define pgm_read_word(addr)       (*(const uint16_t*)(addr))
+#define pgm_read_word_near(addr)  pgm_read_word(addr)
+#define pgm_read_dword(addr)      (*(const uint32_t*)(addr))
+
+#define printf_P   printf
+#define sprintf_P  sprintf
+#define snprintf_P snprintf
+#define fprintf_P  fprintf
+#define puts_P     puts
+#define fputs_P    fputs
+#define strcmp_P   strcmp
+#define strncmp_P  strncmp
+#define strlen_P   strlen
+#define memcpy_P   memcpy
+#define memcmp_P   memcmp
+
+#endif /* SIM_AVR_PGMSPACE_H */
@@ -0,0 +1,48 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: sleep modes
+*
+* Sleeping fast-forwards the simulated time to the next interrupt.
+******************************************************************************/
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE       (0)
+#define SLEEP_MODE_ADC        (1)
+#define SLEEP_MODE_PWR_DOWN   (2)
+#define SLEEP_MODE_PWR_SAVE   (3)
+#define SLEEP_MODE_STANDBY    (6)
+
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()    sim_sleep()
+#define sleep_mode()   sim_sleep()
+
+#endif /* SIM_AVR_SLEEP_H */
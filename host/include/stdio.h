@@ -0,0 +1,41 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/*****************************************************************************
+* Host build: avr-libc stdio extensions
+*
+* The C library stdio, plus fdevopen(): the stream it opens becomes stdin
+* and stdout, as with avr-libc, on top of a cookie stream of the host C
+* library. The simulator keeps the original stdout for its own output.
+******************************************************************************/
+
+#ifndef SIM_STDIO_H
+#define SIM_STDIO_H
+
+#include_next <stdio.h>
+
+FILE* sim_fdevopen(int (*put)(char, FILE*), int (*get)(FILE*));
+
+#define fdevopen(put, get) sim_fdevopen(put, get)
+
+#endif /* SIM_STDIO_H */
@@ -0,0 +1,53 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: atomic blocks
+*
+* ATOMIC_BLOCK(ATOMIC_RESTORESTATE) as in avr-libc: the interrupts are
+* disabled for the block and SREG is restored on any way out of it.
+******************************************************************************/
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+static __inline__ uint8_t sim_atomic_cli(void)
+{
+  cli();
+  return 1;
+}
+
+static __inline__ void sim_atomic_restore(const uint8_t* sreg)
+{
+  SREG = *sreg;
+}
+
+#define ATOMIC_RESTORESTATE \
+  uint8_t sim_sreg_save __attribute__((__cleanup__(sim_atomic_restore))) = SREG
+
+#define ATOMIC_BLOCK(type) \
+  for (type, sim_atomic_todo = sim_atomic_cli(); sim_atomic_todo; sim_atomic_todo = 0)
+
+#endif /* SIM_UTIL_ATOMIC_H */
@@ -0,0 +1,39 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: busy wait delays
+*
+* The delays advance the simulated time, running the pending interrupts.
+******************************************************************************/
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include <stdint.h>
+
+void sim_delay_cycles(uint32_t cycles);
+
+#define _delay_us(us) sim_delay_cycles((uint32_t)((us) * (F_CPU / 1000000UL)))
+#define _delay_ms(ms) sim_delay_cycles((uint32_t)((ms) * (F_CPU / 1000UL)))
+
+#endif /* SIM_UTIL_DELAY_H */
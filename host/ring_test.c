@@ -0,0 +1,386 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: test of the ring index of audio/ring.c
+*
+* Runs audio/ring.c against a file-backed card image, sd_raw being
+* replaced by reads and writes of the file behind a one block write
+* buffer, lost on a reset as in sd_raw. A model of the recorder in
+* loop mode writes sectors tagged with their number, in sessions ended by
+* a stop or by a reset before the marker, over rings of several sizes.
+* After each session it checks:
+*   - the newest chunk found by the binary search, and its cost in marker
+*     reads (log2(nb_chunks) + 1 at most)
+*   - the last N sectors read back through ring_get_last() and
+*     ring_next_address(), against the sectors committed by a marker
+*
+*   ring_test [-s <seed>] [image]
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sd_raw.h"
+#include "ring.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define IMAGE_SECTORS  (16500)
+#define FIRST_SECTOR   (123)  /* Ring start, off any power of two */
+#define MAX_HISTORY    (200000)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  FILE* image;
+  uint8_t block[512];
+  uint32_t block_address;
+  uint8_t block_pending;
+  uint32_t reads;
+  uint32_t failures;
+  uint32_t checks;
+} test;
+
+/* Recorder model */
+static struct {
+  t_ring ring;
+  uint16_t chunk;
+  uint32_t seq;
+  uint8_t nb_sectors;
+  uint8_t resumed;
+  uint32_t next_tag;
+  
+  /* Tags of the sectors covered by a marker in recording order, and of
+     the sectors of the current chunk */
+  uint32_t committed[MAX_HISTORY];
+  uint32_t nb_committed;
+  uint32_t pending[RING_AUDIO_SECTORS];
+  
+  /* Sectors committed by the marker of a full chunk, until the next write
+     puts it on the card */
+  uint32_t marker_sectors;
+} model;
+
+/*****************************************************************************
+* File-backed card
+******************************************************************************/
+
+uint8_t sd_raw_sync(void)
+{
+  if (test.block_pending)
+  {
+    test.block_pending = 0;
+    if (fseek(test.image, test.block_address, SEEK_SET) ||
+        (fwrite(test.block, 1, sizeof(test.block), test.image) != sizeof(test.block)))
+      return 0;
+  }
+  return fflush(test.image) == 0;
+}
+
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+  test.reads++;
+  
+  if (test.block_pending && ((offset & ~511) == test.block_address))
+  {
+    memcpy(buffer, test.block + (offset & 511), length);
+    return 1;
+  }
+  
+  if (fseek(test.image, offset, SEEK_SET) || (fread(buffer, 1, length, test.image) != length))
+    return 0;
+  return 1;
+}
+
+/* Whole sectors only, kept in the write buffer */
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+  if (!sd_raw_sync())
+    return 0;
+  
+  memcpy(test.block, buffer, length);
+  test.block_address = offset;
+  test.block_pending = 1;
+  return 1;
+}
+
+uint8_t sd_raw_write_padded(offset_t offset, const uint8_t* buffer, uint16_t length)
+{
+  if (!sd_raw_sync())
+    return 0;
+  
+  memset(test.block, 0x00, sizeof(test.block));
+  memcpy(test.block, buffer, length);
+  test.block_address = offset;
+  test.block_pending = 1;
+  return 1;
+}
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+#define CHECK(condition, ...) \
+  do { \
+    test.checks++; \
+    if (!(condition)) { \
+      test.failures++; \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+    } \
+  } while (0)
+
+static void clear_image(void)
+{
+  uint8_t zero[512];
+  
+  memset(zero, 0x00, sizeof(zero));
+  test.block_pending = 0;
+  fseek(test.image, 0, SEEK_SET);
+  for (uint32_t i = 0; i < IMAGE_SECTORS; i++)
+    fwrite(zero, 1, sizeof(zero), test.image);
+  fflush(test.image);
+}
+
+static void write_audio_sector(uint32_t address, uint32_t tag)
+{
+  uint8_t sector[512];
+  
+  memset(sector, (uint8_t)tag, sizeof(sector));
+  memcpy(sector, &tag, sizeof(tag));
+  sd_raw_write(address, sector, sizeof(sector));
+}
+
+static uint32_t read_tag(uint32_t address)
+{
+  uint32_t tag = 0;
+  
+  sd_raw_read(address, (uint8_t*)&tag, sizeof(tag));
+  return tag;
+}
+
+/* Start of a session, as recorder_start() in loop mode */
+static void session_start(void)
+{
+  t_ring_head head;
+  
+  model.chunk = 0;
+  model.seq = 0;
+  model.nb_sectors = 0;
+  if (ring_find_head(&model.ring, &head))
+  {
+    model.seq = head.seq;
+    if (head.nb_sectors < RING_AUDIO_SECTORS)
+      model.nb_sectors = head.nb_sectors;
+    else
+      model.seq++;
+    model.chunk = (uint16_t)(model.seq % model.ring.nb_chunks);
+  }
+  
+  /* The sectors of a resumed chunk are already committed */
+  model.resumed = model.nb_sectors;
+  memcpy(model.pending, &model.committed[model.nb_committed - model.resumed],
+         model.resumed * sizeof(uint32_t));
+}
+
+/* One sector of audio, with the marker of a full chunk */
+static void session_write(void)
+{
+  uint32_t address = ring_chunk_address(&model.ring, model.chunk) + 512 + ((uint32_t)model.nb_sectors << 9);
+  
+  write_audio_sector(address, model.next_tag);
+  model.pending[model.nb_sectors++] = model.next_tag++;
+  model.marker_sectors = 0;
+  
+  if (model.nb_sectors == RING_AUDIO_SECTORS)
+  {
+    ring_write_marker(&model.ring, model.chunk, model.seq, RING_AUDIO_SECTORS);
+    memcpy(&model.committed[model.nb_committed], &model.pending[model.resumed],
+           (RING_AUDIO_SECTORS - model.resumed) * sizeof(uint32_t));
+    model.nb_committed += RING_AUDIO_SECTORS - model.resumed;
+    model.marker_sectors = RING_AUDIO_SECTORS - model.resumed;
+    model.resumed = 0;
+    
+    model.seq++;
+    model.chunk = (uint16_t)(model.seq % model.ring.nb_chunks);
+    model.nb_sectors = 0;
+  }
+}
+
+/* End of a session, as recorder_stop(). A reset loses the marker of the
+   partial chunk, and the one of a full chunk still in the write buffer */
+static void session_stop(uint8_t reset)
+{
+  if (reset)
+  {
+    test.block_pending = 0;
+    model.nb_committed -= model.marker_sectors;
+  }
+  else
+  {
+    if (model.nb_sectors)
+    {
+      ring_write_marker(&model.ring, model.chunk, model.seq, model.nb_sectors);
+      memcpy(&model.committed[model.nb_committed], &model.pending[model.resumed],
+             (model.nb_sectors - model.resumed) * sizeof(uint32_t));
+      model.nb_committed += model.nb_sectors - model.resumed;
+    }
+    sd_raw_sync();
+  }
+  model.marker_sectors = 0;
+}
+
+static uint8_t log2_ceil(uint16_t n)
+{
+  uint8_t bits = 0;
+  
+  while ((1u << bits) < n)
+    bits++;
+  return bits;
+}
+
+/* The index against the model, after a session */
+static void check_ring(void)
+{
+  t_ring* ring = &model.ring;
+  t_ring_head head;
+  uint32_t requests[] = { 1, 62, 63, 64, 200, 469, 1000, 100000 };
+  
+  test.reads = 0;
+  if (!ring_find_head(ring, &head))
+  {
+    CHECK(model.nb_committed == 0, "empty ring with %u committed sectors", model.nb_committed);
+    return;
+  }
+  
+  CHECK(test.reads <= log2_ceil(ring->nb_chunks) + 1,
+        "%u marker reads for %u chunks", test.reads, ring->nb_chunks);
+  
+  for (uint8_t r = 0; r < sizeof(requests) / sizeof(requests[0]); r++)
+  {
+    uint32_t address;
+    uint32_t nb_sectors = ring_get_last(ring, &head, requests[r], &address);
+    uint32_t expected = requests[r];
+    uint32_t limit = head.nb_sectors + RING_AUDIO_SECTORS *
+                     ((head.seq < (uint32_t)ring->nb_chunks - 2) ? head.seq : (uint32_t)ring->nb_chunks - 2);
+    
+    if (expected > limit)
+      expected = limit;
+    if (expected > model.nb_committed)
+      expected = model.nb_committed;
+    
+    CHECK(nb_sectors == expected, "ring of %u chunks: %u sectors of %u available, expected %u",
+          ring->nb_chunks, nb_sectors, requests[r], expected);
+    
+    /* The newest committed sectors, in order, across markers and the end */
+    for (uint32_t i = 0; (i < nb_sectors) && (nb_sectors == expected); i++)
+    {
+      uint32_t tag = read_tag(address);
+      uint32_t wanted = model.committed[model.nb_committed - nb_sectors + i];
+      
+      if (tag != wanted)
+      {
+        CHECK(0, "ring of %u chunks, last %u: sector %u has %u instead of %u",
+              ring->nb_chunks, nb_sectors, i, tag, wanted);
+        break;
+      }
+      address = ring_next_address(ring, address + 512);
+    }
+  }
+}
+
+static void run_ring(uint32_t nb_sectors)
+{
+  clear_image();
+  memset(&model, 0x00, sizeof(model));
+  
+  if (!ring_init(&model.ring, FIRST_SECTOR, nb_sectors))
+  {
+    CHECK(nb_sectors < 2 * RING_CHUNK_SECTORS, "no ring over %u sectors", nb_sectors);
+    return;
+  }
+  
+  check_ring();
+  
+  /* Sessions of random lengths up to a few laps, until the history is full */
+  while (model.nb_committed + 4 * (uint32_t)model.ring.nb_chunks * RING_CHUNK_SECTORS < MAX_HISTORY)
+  {
+    uint32_t length = rand() % (3 * (uint32_t)model.ring.nb_chunks * RING_AUDIO_SECTORS + 1);
+    uint8_t reset = (rand() % 4) == 0;
+    
+    session_start();
+    for (uint32_t i = 0; i < length; i++)
+      session_write();
+    session_stop(reset);
+    
+    check_ring();
+  }
+  
+  printf("ring of %4u chunks: %6u sectors committed\n", model.ring.nb_chunks, model.nb_committed);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* name = "ring_test.image";
+  static const uint32_t sizes[] = { 64, 128, 191, 192, 1872, 4096, 16384 };
+  unsigned seed = 1;
+  int opt;
+  
+  while ((opt = getopt(argc, argv, "s:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: %s [-s <seed>] [image]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind < argc)
+    name = argv[optind];
+  
+  test.image = fopen(name, "w+b");
+  if (!test.image)
+  {
+    perror(name);
+    return 2;
+  }
+  srand(seed);
+  
+  for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    run_ring(sizes[i]);
+  
+  fclose(test.image);
+  
+  printf("%u checks, %u failures\n", test.checks, test.failures);
+  return test.failures ? 1 : 0;
+}
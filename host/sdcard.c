@@ -0,0 +1,480 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: SD card model in SPI mode
+*
+* Standard capacity card (byte addressing) backed by an image in memory.
+* The read access time and the write busy time are expressed in simulated
+* time, so the number of polling bytes depends on the SPI clock like on a
+* real card. Faults are injected per transaction: a faulty read never sends
+* its start token, a faulty write never leaves the busy state.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define BLOCK_SIZE (512)
+
+#define R1_IDLE        (0x01)
+#define R1_ILLEGAL     (0x04)
+#define R1_ADDRESS_ERR (0x20)
+
+#define TOKEN_START_BLOCK       (0xfe)
+#define TOKEN_START_MULTI_WRITE (0xfc)
+#define TOKEN_STOP_TRANSMISSION (0xfd)
+
+#define DATA_RESPONSE_ACCEPTED (0xe5)
+
+#define ERASE_BUSY_US (5000)
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+enum {
+  CARD_COMMAND,
+  CARD_RESPONSE,
+  CARD_READ_WAIT,
+  CARD_READ_DATA,
+  CARD_WRITE_WAIT,
+  CARD_WRITE_DATA,
+  CARD_WRITE_RESPONSE,
+  CARD_BUSY,
+};
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  uint8_t* image;
+  uint32_t size;
+  t_sdcard_config config;
+  t_sdcard_stats stats;
+  uint32_t random;
+
+  uint8_t present;
+  uint8_t spi_mode;
+  uint8_t idle;
+  uint8_t app_cmd;
+  uint64_t op_cond_done;
+
+  uint8_t state;
+  uint8_t next_state;
+  uint8_t multi;
+  uint8_t faulty;
+
+  uint8_t command[6];
+  uint8_t command_length;
+
+  uint8_t response[5];
+  uint8_t response_length;
+  uint8_t response_pos;
+
+  uint32_t address;
+  uint32_t erase_start;
+  uint32_t erase_end;
+  uint64_t ready_at;
+
+  uint8_t data[BLOCK_SIZE + 2];
+  uint16_t data_length;
+  uint16_t data_pos;
+} card;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void sdcard_init(uint8_t* image, uint32_t size, const t_sdcard_config* config)
+{
+  memset(&card, 0x00, sizeof(card));
+  card.image = image;
+  card.size = size;
+  card.config = *config;
+  card.random = 1;
+  card.present = 1;
+}
+
+void sdcard_set_faults(uint16_t read_fault_permille, uint16_t write_fault_permille)
+{
+  card.config.read_fault_permille = read_fault_permille;
+  card.config.write_fault_permille = write_fault_permille;
+}
+
+void sdcard_set_present(uint8_t present)
+{
+  /* A new card powers up in SD mode and waits for CMD0 */
+  card.present = present;
+  card.spi_mode = 0;
+  card.idle = 1;
+  card.state = CARD_COMMAND;
+  card.command_length = 0;
+}
+
+const t_sdcard_stats* sdcard_get_stats(void)
+{
+  return &card.stats;
+}
+
+static uint8_t fault(uint16_t permille)
+{
+  card.random = card.random * 1103515245 + 12345;
+  return ((card.random >> 16) % 1000) < permille;
+}
+
+static void respond(uint8_t r1, uint8_t next_state)
+{
+  card.response[0] = r1 | (card.idle ? R1_IDLE : 0);
+  card.response_length = 1;
+  card.response_pos = 0;
+  card.next_state = next_state;
+  card.state = CARD_RESPONSE;
+}
+
+static void start_read(void)
+{
+  if (card.address + BLOCK_SIZE > card.size)
+  {
+    memset(card.data, 0xff, BLOCK_SIZE);
+  }
+  else
+  {
+    memcpy(card.data, card.image + card.address, BLOCK_SIZE);
+  }
+
+  card.data[BLOCK_SIZE] = card.data[BLOCK_SIZE + 1] = 0xff; /* CRC */
+  card.data_length = BLOCK_SIZE + 2;
+  card.data_pos = 0;
+  card.faulty = fault(card.config.read_fault_permille);
+  card.ready_at = sim_cycles + SIM_US(card.config.read_latency_us);
+
+  if (card.faulty)
+    card.stats.read_faults++;
+}
+
+static void start_register_read(const uint8_t* reg)
+{
+  memcpy(card.data, reg, 16);
+  card.data[16] = card.data[17] = 0xff; /* CRC */
+  card.data_length = 18;
+  card.data_pos = 0;
+  card.faulty = 0;
+  card.ready_at = sim_cycles;
+}
+
+static void start_busy(uint32_t us, uint8_t faulty)
+{
+  card.faulty = faulty;
+  card.ready_at = sim_cycles + SIM_US(us);
+}
+
+static void execute_command(void)
+{
+  uint8_t index = card.command[0] & 0x3f;
+  uint32_t arg = ((uint32_t)card.command[1] << 24)
+               | ((uint32_t)card.command[2] << 16)
+               | ((uint32_t)card.command[3] << 8)
+               | card.command[4];
+  uint8_t app_cmd = card.app_cmd;
+
+  card.app_cmd = 0;
+  card.stats.commands++;
+
+  if (!card.spi_mode)
+  {
+    /* Only CMD0 with CS asserted enters the SPI mode */
+    if (index != 0)
+    {
+      card.state = CARD_COMMAND;
+      return;
+    }
+    card.spi_mode = 1;
+  }
+
+  switch (index)
+  {
+    case 0: /* GO_IDLE_STATE */
+      card.idle = 1;
+      card.op_cond_done = 0;
+      card.multi = 0;
+      respond(0, CARD_COMMAND);
+      break;
+
+    case 1: /* SEND_OP_COND */
+    case 41: /* SD_SEND_OP_COND */
+      if ((index == 41) && !app_cmd)
+      {
+        respond(R1_ILLEGAL, CARD_COMMAND);
+        break;
+      }
+      /* The power up sequence starts with the first request */
+      if (!card.op_cond_done)
+        card.op_cond_done = sim_cycles + SIM_US(card.config.init_us);
+      if (sim_cycles >= card.op_cond_done)
+        card.idle = 0;
+      respond(0, CARD_COMMAND);
+      break;
+
+    case 9: /* SEND_CSD */
+    {
+      /* CSD v1: READ_BL_LEN = 9, C_SIZE_MULT = 7, C_SIZE from the image size */
+      uint8_t csd[16] = { 0 };
+      uint32_t c_size = (card.size >> 18) - 1;
+      csd[5] = 0x09;
+      csd[6] = (c_size >> 10) & 0x03;
+      csd[7] = (c_size >> 2) & 0xff;
+      csd[8] = (c_size & 0x03) << 6;
+      csd[9] = 0x03;
+      csd[10] = 0x80;
+      start_register_read(csd);
+      respond(0, CARD_READ_WAIT);
+      break;
+    }
+
+    case 10: /* SEND_CID */
+    {
+      static const uint8_t cid[16] = { 0x03, 'S', 'M', 'H', 'O', 'S', 'T', ' ', 0x10, 0, 0, 0, 1, 0x00, 0xb1, 0x01 };
+      start_register_read(cid);
+      respond(0, CARD_READ_WAIT);
+      break;
+    }
+
+    case 12: /* STOP_TRANSMISSION */
+      card.multi = 0;
+      start_busy(0, 0);
+      respond(0, CARD_BUSY);
+      break;
+
+    case 13: /* SEND_STATUS */
+      respond(0, CARD_COMMAND);
+      card.response[1] = 0x00;
+      card.response_length = 2;
+      break;
+
+    case 16: /* SET_BLOCKLEN */
+      respond(arg == BLOCK_SIZE ? 0 : R1_ILLEGAL, CARD_COMMAND);
+      break;
+
+    case 17: /* READ_SINGLE_BLOCK */
+    case 18: /* READ_MULTIPLE_BLOCK */
+      if (card.idle || (arg % BLOCK_SIZE) || (arg >= card.size))
+      {
+        respond(card.idle ? R1_ILLEGAL : R1_ADDRESS_ERR, CARD_COMMAND);
+        break;
+      }
+      card.address = arg;
+      card.multi = (index == 18);
+      start_read();
+      respond(0, CARD_READ_WAIT);
+      break;
+
+    case 24: /* WRITE_BLOCK */
+    case 25: /* WRITE_MULTIPLE_BLOCK */
+      if (card.idle || (arg % BLOCK_SIZE) || (arg >= card.size))
+      {
+        respond(card.idle ? R1_ILLEGAL : R1_ADDRESS_ERR, CARD_COMMAND);
+        break;
+      }
+      card.address = arg;
+      card.multi = (index == 25);
+      respond(0, CARD_WRITE_WAIT);
+      break;
+
+    case 32: /* ERASE_WR_BLK_START_ADDR */
+      card.erase_start = arg;
+      respond(0, CARD_COMMAND);
+      break;
+
+    case 33: /* ERASE_WR_BLK_END_ADDR */
+      card.erase_end = arg;
+      respond(0, CARD_COMMAND);
+      break;
+
+    case 38: /* ERASE */
+      if ((card.erase_start <= card.erase_end) && (card.erase_end < card.size))
+        memset(card.image + card.erase_start, 0x00, card.erase_end - card.erase_start + 1);
+      card.stats.erases++;
+      start_busy(ERASE_BUSY_US, 0);
+      respond(0, CARD_BUSY);
+      break;
+
+    case 55: /* APP_CMD */
+      card.app_cmd = 1;
+      respond(0, CARD_COMMAND);
+      break;
+
+    case 58: /* READ_OCR */
+      respond(0, CARD_COMMAND);
+      card.response[1] = 0x80; /* Powered up, standard capacity */
+      card.response[2] = 0xff;
+      card.response[3] = 0x80;
+      card.response[4] = 0x00;
+      card.response_length = 5;
+      break;
+
+    case 59: /* CRC_ON_OFF */
+      respond(0, CARD_COMMAND);
+      break;
+
+    default:
+      respond(R1_ILLEGAL, CARD_COMMAND);
+      break;
+  }
+}
+
+static uint8_t receive_command_byte(uint8_t mosi)
+{
+  if ((card.command_length == 0) && ((mosi & 0xc0) != 0x40))
+    return 0xff;
+
+  card.command[card.command_length++] = mosi;
+  if (card.command_length == sizeof(card.command))
+  {
+    card.command_length = 0;
+    execute_command();
+  }
+
+  return 0xff;
+}
+
+uint8_t sdcard_transfer(uint8_t mosi, uint8_t selected)
+{
+  uint8_t miso = 0xff;
+
+  if (!card.present)
+    return 0xff;
+
+  /* The card finishes its programming even when deselected, an aborted
+     transfer or a faulty transaction is dropped */
+  if (!selected)
+  {
+    if (card.faulty || (card.state != CARD_BUSY))
+    {
+      card.state = CARD_COMMAND;
+      card.command_length = 0;
+      card.faulty = 0;
+    }
+    return 0xff;
+  }
+
+  switch (card.state)
+  {
+    case CARD_COMMAND:
+      miso = receive_command_byte(mosi);
+      break;
+
+    case CARD_RESPONSE:
+      miso = card.response[card.response_pos++];
+      if (card.response_pos >= card.response_length)
+        card.state = card.next_state;
+      break;
+
+    case CARD_READ_WAIT:
+      if (card.multi && ((mosi & 0xc0) == 0x40))
+      {
+        /* STOP_TRANSMISSION while waiting for the next block */
+        card.state = CARD_COMMAND;
+        miso = receive_command_byte(mosi);
+      }
+      else if (!card.faulty && (sim_cycles >= card.ready_at))
+      {
+        miso = TOKEN_START_BLOCK;
+        card.state = CARD_READ_DATA;
+      }
+      break;
+
+    case CARD_READ_DATA:
+      miso = card.data[card.data_pos++];
+      if (card.data_pos >= card.data_length)
+      {
+        if (card.data_length > BLOCK_SIZE)
+          card.stats.blocks_read++;
+
+        if (card.multi)
+        {
+          card.address += BLOCK_SIZE;
+          start_read();
+          card.state = CARD_READ_WAIT;
+        }
+        else
+        {
+          card.state = CARD_COMMAND;
+        }
+      }
+      break;
+
+    case CARD_WRITE_WAIT:
+      if (mosi == (card.multi ? TOKEN_START_MULTI_WRITE : TOKEN_START_BLOCK))
+      {
+        card.data_pos = 0;
+        card.state = CARD_WRITE_DATA;
+      }
+      else if (card.multi && (mosi == TOKEN_STOP_TRANSMISSION))
+      {
+        card.multi = 0;
+        start_busy(card.config.write_busy_us, 0);
+        card.state = CARD_BUSY;
+      }
+      break;
+
+    case CARD_WRITE_DATA:
+      card.data[card.data_pos++] = mosi;
+      if (card.data_pos >= BLOCK_SIZE + 2)
+        card.state = CARD_WRITE_RESPONSE;
+      break;
+
+    case CARD_WRITE_RESPONSE:
+      if (card.address + BLOCK_SIZE <= card.size)
+        memcpy(card.image + card.address, card.data, BLOCK_SIZE);
+      card.stats.blocks_written++;
+      card.address += BLOCK_SIZE;
+
+      start_busy(card.config.write_busy_us, fault(card.config.write_fault_permille));
+      if (card.faulty)
+        card.stats.write_faults++;
+
+      miso = DATA_RESPONSE_ACCEPTED;
+      card.state = CARD_BUSY;
+      break;
+
+    case CARD_BUSY:
+      if (card.faulty || (sim_cycles < card.ready_at))
+      {
+        miso = 0x00;
+      }
+      else
+      {
+        card.state = card.multi ? CARD_WRITE_WAIT : CARD_COMMAND;
+      }
+      break;
+  }
+
+  return miso;
+}
@@ -0,0 +1,863 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: ATmega328P model
+*
+* Only the time spent in the peripherals (SPI transfers, ADC conversions,
+* busy waits, sleep) advances the simulated clock. The firmware code itself
+* runs at host speed, so the figures are a lower bound of the real load.
+*
+* Resources modelled:
+*   Timer0 and Timer1 in normal and CTC modes with their compare interrupts
+*   Timer2 fast PWM on OC2B (DAC output)
+*   ADC0 single conversions, or triggered by Timer0 compare A
+*   SPI master connected to the SD card model
+*   USART0 with its data register double buffering, at the programmed baud
+*   rate: transmitted bytes go to stdout, received bytes come from the
+*   input queued by the simulation driver
+*   Keyboard matrix on PORTC/PORTD
+*
+* The global interrupt flag follows the I bit of SREG, so that the firmware
+* can save and restore it around its critical sections.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define ISR_ENTRY_CYCLES   (10) /* Vector jump, prologue */
+#define ISR_EXIT_CYCLES    (10) /* Epilogue, reti */
+#define SPI_BYTE_OVERHEAD  (6)  /* Poll loop around each SPI byte */
+#define ADC_POLL_CYCLES    (4)
+#define USART_POLL_CYCLES  (4)
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint16_t divider;
+  uint64_t next_tick;
+} t_sim_timer;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+volatile uint8_t  sim_DDRB, sim_PORTB, sim_PINB;
+volatile uint8_t  sim_DDRC, sim_PORTC;
+volatile uint8_t  sim_DDRD, sim_PORTD;
+volatile uint8_t  sim_TCCR0A, sim_TCCR0B, sim_TCNT0, sim_OCR0A, sim_OCR0B, sim_TIMSK0, sim_TIFR0;
+volatile uint8_t  sim_TCCR1A, sim_TCCR1B, sim_TCCR1C, sim_TIMSK1, sim_TIFR1;
+volatile uint16_t sim_TCNT1, sim_OCR1A, sim_OCR1B, sim_ICR1;
+volatile uint8_t  sim_TCCR2A, sim_TCCR2B, sim_TCNT2, sim_OCR2A, sim_OCR2B, sim_TIMSK2, sim_TIFR2;
+volatile uint8_t  sim_ADMUX, sim_ADCSRB, sim_ADCL, sim_DIDR0;
+volatile uint8_t  sim_SPCR;
+volatile uint8_t  sim_MCUSR, sim_SREG, sim_GPIOR0;
+volatile uint8_t  sim_UCSR0A, sim_UCSR0B, sim_UCSR0C;
+volatile uint16_t sim_UBRR0;
+
+uint64_t sim_cycles;
+
+t_sim_vector_stats sim_vector_stats[SIM_NB_VECTORS] = {
+  { "TIMER1_COMPA", 0, 0, 0 },
+  { "TIMER0_COMPA", 0, 0, 0 },
+  { "TIMER0_COMPB", 0, 0, 0 },
+  { "USART_RX", 0, 0, 0 },
+  { "USART_UDRE", 0, 0, 0 },
+};
+
+/* Interrupt vectors provided by the firmware */
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPB_vect(void) __attribute__((weak));
+void USART_RX_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+
+static struct {
+  uint8_t irq_enabled;
+  uint8_t irq_depth;
+
+  t_sim_timer timer0;
+  t_sim_timer timer1;
+
+  uint8_t sleeping;
+  uint8_t woken;
+  uint8_t sleep_depth;
+  uint64_t sleep_start;
+  uint64_t slept;
+
+  uint64_t end_cycles;
+  void (*finish)(void);
+
+  uint64_t next_event;
+  void (*event_handler)(void);
+
+  /* Keyboard */
+  uint8_t key_pressed;
+  uint8_t key_row;
+  uint8_t key_col;
+  uint8_t pinc;
+  uint8_t pind;
+
+  /* SPI */
+  uint8_t spdr;
+  uint8_t spsr;
+  uint8_t spdr_touched;
+
+  /* ADC */
+  uint8_t adcsra;
+  uint8_t adch;
+  uint8_t adc_running;
+  uint64_t adc_done;
+  const uint8_t* adc_input;
+  uint32_t adc_input_length;
+  uint32_t adc_input_rate;
+  uint32_t adc_noise;
+
+  /* PWM output */
+  FILE* wav;
+  uint32_t wav_rate;
+  uint32_t wav_samples;
+  uint64_t wav_next;
+  uint64_t pwm_activity;
+
+  /* Leds */
+  uint64_t led_on[2];
+
+  /* USART */
+  FILE* console;
+  int (*stdio_put)(char, FILE*);
+  int (*stdio_get)(FILE*);
+  uint16_t udr;
+  uint8_t udr_touched;
+  uint8_t tx_data;
+  uint8_t tx_full;
+  uint8_t tx_shift;
+  uint64_t tx_shift_end;
+  uint8_t rx_data;
+  uint8_t rx_full;
+  uint8_t rx_overrun;
+  uint64_t rx_next;
+  uint8_t* rx_input;
+  uint32_t rx_length;
+  uint32_t rx_pos;
+  t_sim_usart_stats usart_stats;
+} sim;
+
+/*****************************************************************************
+* Local prototypes
+******************************************************************************/
+static void sim_dispatch(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void sim_init(void)
+{
+  memset(&sim, 0x00, sizeof(sim));
+  sim.adc_noise = 1;
+  sim.pwm_activity = UINT64_MAX;
+  sim.led_on[0] = sim.led_on[1] = UINT64_MAX;
+  sim.end_cycles = UINT64_MAX;
+  sim.next_event = UINT64_MAX;
+  sim.timer0.next_tick = sim.timer1.next_tick = UINT64_MAX;
+  sim.tx_shift_end = sim.rx_next = UINT64_MAX;
+  sim.console = stdout;
+  sim_UCSR0A = _BV(UDRE0);
+  sim_cycles = 0;
+}
+
+void sim_set_end(uint64_t end_cycles, void (*finish)(void))
+{
+  sim.end_cycles = end_cycles;
+  sim.finish = finish;
+}
+
+void sim_set_event_handler(uint64_t next_event, void (*handler)(void))
+{
+  sim.next_event = next_event;
+  sim.event_handler = handler;
+}
+
+/* Global interrupt flag */
+
+static void set_irq_enabled(uint8_t enabled)
+{
+  sim.irq_enabled = enabled;
+
+  if (enabled)
+    SREG |= _BV(SREG_I);
+  else
+    SREG &= ~_BV(SREG_I);
+}
+
+/* Pick up an SREG restored by the firmware */
+static void sreg_sync(void)
+{
+  sim.irq_enabled = (SREG & _BV(SREG_I)) != 0;
+}
+
+void sim_sei(void)
+{
+  set_irq_enabled(1);
+  sim_dispatch();
+}
+
+void sim_cli(void)
+{
+  set_irq_enabled(0);
+}
+
+/* Timers */
+
+static uint16_t timer01_divider(uint8_t tccrb)
+{
+  static const uint16_t dividers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  return dividers[tccrb & 0x07];
+}
+
+static void timer_update_clock(t_sim_timer* timer, uint16_t divider)
+{
+  if (divider != timer->divider)
+  {
+    timer->divider = divider;
+    timer->next_tick = divider ? sim_cycles + divider : UINT64_MAX;
+  }
+}
+
+static void timer0_tick(void)
+{
+  if ((TCCR0A & _BV(WGM01)) && (TCNT0 == OCR0A))
+    TCNT0 = 0;
+  else
+    TCNT0++;
+
+  if (TCNT0 == OCR0A)
+  {
+    /* Auto trigger of the ADC on the rising edge of the flag */
+    if (!(TIFR0 & _BV(OCF0A)) && (sim.adcsra & _BV(ADEN)) && (sim.adcsra & _BV(ADATE))
+      && ((ADCSRB & (_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) == (_BV(ADTS1) | _BV(ADTS0))))
+      sim.adcsra |= _BV(ADSC);
+
+    TIFR0 |= _BV(OCF0A);
+  }
+  if (TCNT0 == OCR0B)
+    TIFR0 |= _BV(OCF0B);
+}
+
+static void timer1_tick(void)
+{
+  if ((TCCR1B & _BV(WGM12)) && (TCNT1 == OCR1A))
+    TCNT1 = 0;
+  else
+    TCNT1++;
+
+  if (TCNT1 == OCR1A)
+    TIFR1 |= _BV(OCF1A);
+  if (TCNT1 == OCR1B)
+    TIFR1 |= _BV(OCF1B);
+}
+
+/* Peripherals sampled on the simulated clock */
+
+static void adc_update(void)
+{
+  if ((sim.adcsra & _BV(ADSC)) && !sim.adc_running)
+  {
+    static const uint8_t dividers[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+
+    sim.adc_running = 1;
+    sim.adc_done = sim_cycles + 13 * dividers[sim.adcsra & 0x07];
+  }
+}
+
+static void adc_complete(void)
+{
+  uint8_t sample = 128;
+
+  if (sim.adc_input)
+  {
+    uint64_t index = sim_cycles * sim.adc_input_rate / F_CPU;
+    if (index < sim.adc_input_length)
+      sample = sim.adc_input[index];
+  }
+  else
+  {
+    /* Some noise around the midscale */
+    sim.adc_noise = sim.adc_noise * 1103515245 + 12345;
+    sample = 127 + ((sim.adc_noise >> 16) % 3);
+  }
+
+  sim.adch = sample;
+  sim.adc_running = 0;
+  sim.adcsra &= ~_BV(ADSC);
+  sim.adcsra |= _BV(ADIF);
+}
+
+static uint8_t pwm_level(void)
+{
+  if ((TCCR2B & 0x07) && (TCCR2A & _BV(COM2B1)) && (DDRD & _BV(PORTD3)))
+    return OCR2B;
+
+  return 128;
+}
+
+static void pwm_sample(void)
+{
+  uint8_t level = pwm_level();
+
+  if ((sim.pwm_activity == UINT64_MAX) && ((level > 130) || (level < 126)))
+    sim.pwm_activity = sim_cycles;
+
+  if (sim.wav)
+    fputc(level, sim.wav);
+
+  sim.wav_samples++;
+  sim.wav_next = (uint64_t)(sim.wav_samples + 1) * F_CPU / sim.wav_rate;
+}
+
+static void leds_sample(void)
+{
+  /* Leds are active low on PB0 (green) and PB1 (red) */
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    if ((sim.led_on[i] == UINT64_MAX) && (DDRB & _BV(i)) && !(PORTB & _BV(i)))
+      sim.led_on[i] = sim_cycles;
+  }
+}
+
+/* USART: UDR0 accesses are told apart at the next simulator call, a read
+   leaves the 0x8000 marker in place */
+
+static uint32_t usart_byte_cycles(void)
+{
+  return 10UL * (UBRR0 + 1) * ((sim_UCSR0A & _BV(U2X0)) ? 8 : 16);
+}
+
+static void usart_flags(void)
+{
+  uint8_t flags = 0;
+
+  if (!sim.tx_full)
+    flags |= _BV(UDRE0);
+  if (sim.rx_full)
+    flags |= _BV(RXC0);
+  if (sim.rx_overrun)
+    flags |= _BV(DOR0);
+
+  sim_UCSR0A = (sim_UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | flags;
+}
+
+static void usart_tx_start(void)
+{
+  /* The shift register takes the byte as soon as it is free */
+  if (sim.tx_full && (sim.tx_shift_end == UINT64_MAX))
+  {
+    sim.tx_shift = sim.tx_data;
+    sim.tx_full = 0;
+    sim.tx_shift_end = sim_cycles + usart_byte_cycles();
+  }
+}
+
+static void usart_commit(void)
+{
+  if (!sim.udr_touched)
+    return;
+
+  sim.udr_touched = 0;
+
+  if (sim.udr & 0x8000)
+  {
+    sim.rx_full = 0;
+    sim.rx_overrun = 0;
+  }
+  else if ((UCSR0B & _BV(TXEN0)) && !sim.tx_full)
+  {
+    sim.tx_data = (uint8_t)sim.udr;
+    sim.tx_full = 1;
+    usart_tx_start();
+  }
+
+  usart_flags();
+}
+
+static void usart_tx_done(void)
+{
+  fputc(sim.tx_shift, sim.console);
+  sim.usart_stats.bytes_sent++;
+
+  sim.tx_shift_end = UINT64_MAX;
+  usart_tx_start();
+  usart_flags();
+}
+
+static void usart_rx_update(void)
+{
+  /* The next byte starts once the receiver is enabled */
+  if ((sim.rx_next == UINT64_MAX) && (sim.rx_pos < sim.rx_length) && (UCSR0B & _BV(RXEN0)))
+    sim.rx_next = sim_cycles + usart_byte_cycles();
+}
+
+static void usart_rx_done(void)
+{
+  if (sim.rx_full)
+  {
+    sim.rx_overrun = 1;
+    sim.usart_stats.rx_overruns++;
+  }
+  else
+  {
+    sim.rx_data = sim.rx_input[sim.rx_pos];
+    sim.rx_full = 1;
+    sim.usart_stats.bytes_received++;
+  }
+
+  sim.rx_pos++;
+  sim.rx_next = UINT64_MAX;
+  usart_rx_update();
+  usart_flags();
+}
+
+/* Advance the simulated clock up to target, running the interrupts which
+   become pending while the global interrupt flag is set */
+void sim_step(uint64_t target)
+{
+  sreg_sync();
+  usart_commit();
+
+  while (sim_cycles < target)
+  {
+    uint64_t next = target;
+
+    timer_update_clock(&sim.timer0, timer01_divider(TCCR0B));
+    timer_update_clock(&sim.timer1, timer01_divider(TCCR1B));
+    adc_update();
+    usart_rx_update();
+
+    if (sim.timer0.next_tick < next)
+      next = sim.timer0.next_tick;
+    if (sim.timer1.next_tick < next)
+      next = sim.timer1.next_tick;
+    if (sim.adc_running && (sim.adc_done < next))
+      next = sim.adc_done;
+    if (sim.wav_rate && (sim.wav_next < next))
+      next = sim.wav_next;
+    if (sim.tx_shift_end < next)
+      next = sim.tx_shift_end;
+    if (sim.rx_next < next)
+      next = sim.rx_next;
+    if (sim.next_event < next)
+      next = sim.next_event;
+    if (sim.end_cycles < next)
+      next = sim.end_cycles;
+
+    sim_cycles = next;
+
+    if (sim.timer0.next_tick == sim_cycles)
+    {
+      timer0_tick();
+      sim.timer0.next_tick += sim.timer0.divider;
+    }
+
+    if (sim.timer1.next_tick == sim_cycles)
+    {
+      timer1_tick();
+      sim.timer1.next_tick += sim.timer1.divider;
+    }
+
+    if (sim.adc_running && (sim.adc_done <= sim_cycles))
+      adc_complete();
+
+    if (sim.wav_rate && (sim.wav_next <= sim_cycles))
+      pwm_sample();
+
+    if (sim.tx_shift_end <= sim_cycles)
+      usart_tx_done();
+
+    if (sim.rx_next <= sim_cycles)
+      usart_rx_done();
+
+    leds_sample();
+
+    if ((sim.next_event <= sim_cycles) && sim.event_handler)
+    {
+      sim.next_event = UINT64_MAX;
+      sim.event_handler();
+    }
+
+    if ((sim.end_cycles <= sim_cycles) && sim.finish)
+    {
+      sim.finish();
+      exit(0);
+    }
+
+    sim_dispatch();
+
+    if (sim.sleeping && sim.woken && (sim.irq_depth == sim.sleep_depth))
+      break;
+  }
+}
+
+/* Interrupts */
+
+static void sim_run_vector(uint8_t index, void (*vector)(void))
+{
+  t_sim_vector_stats* stats = &sim_vector_stats[index];
+  uint64_t start = sim_cycles;
+
+  set_irq_enabled(0);
+  sim.irq_depth++;
+  sim_step(sim_cycles + ISR_ENTRY_CYCLES);
+
+  vector();
+
+  sim_step(sim_cycles + ISR_EXIT_CYCLES);
+  sim.irq_depth--;
+  set_irq_enabled(1);
+
+  sim.woken = 1;
+
+  stats->count++;
+  stats->total_cycles += sim_cycles - start;
+  if (sim_cycles - start > stats->max_cycles)
+    stats->max_cycles = (uint32_t)(sim_cycles - start);
+}
+
+static void sim_dispatch(void)
+{
+  usart_commit();
+
+  while (sim.irq_enabled)
+  {
+    /* Highest priority first, as in the vector table */
+    if ((TIFR1 & TIMSK1 & _BV(OCF1A)) && TIMER1_COMPA_vect)
+    {
+      TIFR1 &= ~_BV(OCF1A);
+      sim_run_vector(SIM_VECTOR_TIMER1_COMPA, TIMER1_COMPA_vect);
+    }
+    else if ((TIFR0 & TIMSK0 & _BV(OCF0A)) && TIMER0_COMPA_vect)
+    {
+      TIFR0 &= ~_BV(OCF0A);
+      sim_run_vector(SIM_VECTOR_TIMER0_COMPA, TIMER0_COMPA_vect);
+    }
+    else if ((TIFR0 & TIMSK0 & _BV(OCF0B)) && TIMER0_COMPB_vect)
+    {
+      TIFR0 &= ~_BV(OCF0B);
+      sim_run_vector(SIM_VECTOR_TIMER0_COMPB, TIMER0_COMPB_vect);
+    }
+    else if ((UCSR0B & _BV(RXCIE0)) && sim.rx_full && USART_RX_vect)
+    {
+      sim_run_vector(SIM_VECTOR_USART_RX, USART_RX_vect);
+    }
+    else if ((UCSR0B & _BV(UDRIE0)) && !sim.tx_full && USART_UDRE_vect)
+    {
+      sim_run_vector(SIM_VECTOR_USART_UDRE, USART_UDRE_vect);
+    }
+    else
+    {
+      break;
+    }
+  }
+}
+
+/* Sleep until the next interrupt. An interrupt handler may sleep too,
+   within the sleep of the code it interrupted */
+void sim_sleep(void)
+{
+  uint8_t sleeping = sim.sleeping;
+  uint8_t sleep_depth = sim.sleep_depth;
+  uint64_t start = sim_cycles;
+
+  sreg_sync();
+
+  /* Nothing can wake the CPU up anymore: end of the simulation */
+  if (!sim.irq_enabled)
+  {
+    if (sim.finish)
+      sim.finish();
+    exit(0);
+  }
+
+  sim.sleeping = 1;
+  sim.woken = 0;
+  sim.sleep_depth = sim.irq_depth;
+  if (!sleeping)
+    sim.sleep_start = start;
+  sim_step(UINT64_MAX);
+  sim.sleeping = sleeping;
+  sim.sleep_depth = sleep_depth;
+  if (!sleeping)
+    sim.slept += sim_cycles - start;
+}
+
+/* Time spent in sleep mode, up to now */
+uint64_t sim_sleep_cycles(void)
+{
+  return sim.slept + (sim.sleeping ? sim_cycles - sim.sleep_start : 0);
+}
+
+void sim_delay_cycles(uint32_t cycles)
+{
+  sim_step(sim_cycles + cycles);
+}
+
+/* Keyboard matrix: rows on PC2..PC5 driven low, columns read on
+   PD6, PD5, PD2, PD4 and PC1 with pull-ups */
+
+void sim_key_set(uint8_t row, uint8_t col, uint8_t pressed)
+{
+  sim.key_pressed = pressed;
+  sim.key_row = row;
+  sim.key_col = col;
+}
+
+static uint8_t key_column_low(uint8_t col)
+{
+  return sim.key_pressed
+      && (sim.key_col == col)
+      && (DDRC & _BV(PORTC2 + sim.key_row))
+      && !(PORTC & _BV(PORTC2 + sim.key_row));
+}
+
+volatile uint8_t* sim_pinc(void)
+{
+  sim.pinc = PORTC | (uint8_t)~DDRC;
+  if (key_column_low(4))
+    sim.pinc &= ~_BV(PORTC1);
+
+  return &sim.pinc;
+}
+
+volatile uint8_t* sim_pind(void)
+{
+  static const uint8_t columns[4] = { PORTD6, PORTD5, PORTD2, PORTD4 };
+
+  sim.pind = PORTD | (uint8_t)~DDRD;
+  for (uint8_t col = 0; col < 4; col++)
+  {
+    if (key_column_low(col))
+      sim.pind &= ~_BV(columns[col]);
+  }
+
+  return &sim.pind;
+}
+
+/* SPI master: a byte written in SPDR is shifted when the firmware polls SPSR */
+
+volatile uint8_t* sim_spdr(void)
+{
+  sim.spdr_touched = 1;
+  return &sim.spdr;
+}
+
+volatile uint8_t* sim_spsr(void)
+{
+  if (sim.spdr_touched && (SPCR & _BV(SPE)) && !(sim.spsr & _BV(SPIF)))
+  {
+    static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+    uint32_t divider = dividers[SPCR & 0x03];
+    uint8_t selected = (DDRB & _BV(DDB2)) && !(PORTB & _BV(PB2));
+
+    if (sim.spsr & _BV(SPI2X))
+      divider /= 2;
+
+    sim.spdr_touched = 0;
+    sim.spdr = sdcard_transfer(sim.spdr, selected);
+    sim_step(sim_cycles + 8 * divider + SPI_BYTE_OVERHEAD);
+    sim.spsr |= _BV(SPIF);
+  }
+
+  return &sim.spsr;
+}
+
+/* ADC */
+
+volatile uint8_t* sim_adcsra(void)
+{
+  /* A conversion started by the previous write is only seen by the next step */
+  if (sim.adc_running || (sim.adcsra & _BV(ADSC)))
+    sim_step(sim_cycles + ADC_POLL_CYCLES);
+
+  return &sim.adcsra;
+}
+
+volatile uint8_t* sim_adch(void)
+{
+  return &sim.adch;
+}
+
+void sim_adc_set_input(const uint8_t* samples, uint32_t nb_samples, uint32_t rate)
+{
+  sim.adc_input = samples;
+  sim.adc_input_length = nb_samples;
+  sim.adc_input_rate = rate;
+}
+
+/* USART data register and status */
+
+volatile uint16_t* sim_udr0(void)
+{
+  usart_commit();
+
+  sim.udr = 0x8000 | sim.rx_data;
+  sim.udr_touched = 1;
+
+  return &sim.udr;
+}
+
+volatile uint8_t* sim_ucsr0a(void)
+{
+  usart_commit();
+
+  /* Polling for a free data register */
+  if (sim.tx_full)
+    sim_step(sim_cycles + USART_POLL_CYCLES);
+
+  usart_flags();
+  return &sim_UCSR0A;
+}
+
+void sim_usart_add_input(const uint8_t* data, uint32_t length)
+{
+  sim.rx_input = realloc(sim.rx_input, sim.rx_length + length);
+  memcpy(sim.rx_input + sim.rx_length, data, length);
+  sim.rx_length += length;
+}
+
+const t_sim_usart_stats* sim_usart_get_stats(void)
+{
+  return &sim.usart_stats;
+}
+
+/* avr-libc stdio streams on top of host cookie streams */
+
+static ssize_t stdio_write(void* cookie, const char* buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+    sim.stdio_put(buffer[i], NULL);
+
+  return size;
+}
+
+static ssize_t stdio_read(void* cookie, char* buffer, size_t size)
+{
+  int c;
+
+  if (!size || !sim.stdio_get)
+    return 0;
+
+  c = sim.stdio_get(NULL);
+  if (c < 0)
+    return 0;
+
+  buffer[0] = (char)c;
+  return 1;
+}
+
+FILE* sim_fdevopen(int (*put)(char, FILE*), int (*get)(FILE*))
+{
+  cookie_io_functions_t functions = { stdio_read, stdio_write, NULL, NULL };
+  FILE* stream;
+
+  sim.stdio_put = put;
+  sim.stdio_get = get;
+
+  stream = fopencookie(NULL, "r+", functions);
+  setvbuf(stream, NULL, _IONBF, 0);
+
+  /* stderr stays on the host for the simulator reports */
+  if (put)
+    stdout = stream;
+  if (get)
+    stdin = stream;
+
+  return stream;
+}
+
+/* DAC output as an unsigned 8-bit mono WAV file */
+
+static void wav_write_header(FILE* wav, uint32_t rate, uint32_t nb_samples)
+{
+  uint8_t header[44];
+  uint32_t values[] = { 36 + nb_samples, 16, rate, rate, nb_samples };
+
+  memcpy(header, "RIFF", 4);
+  memcpy(header + 4, &values[0], 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  memcpy(header + 16, &values[1], 4);
+  header[20] = 1; header[21] = 0; /* PCM */
+  header[22] = 1; header[23] = 0; /* Mono */
+  memcpy(header + 24, &values[2], 4);
+  memcpy(header + 28, &values[3], 4);
+  header[32] = 1; header[33] = 0; /* Block align */
+  header[34] = 8; header[35] = 0; /* Bits per sample */
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &values[4], 4);
+
+  fseek(wav, 0, SEEK_SET);
+  fwrite(header, sizeof(header), 1, wav);
+}
+
+void sim_pwm_set_output(FILE* wav, uint32_t rate)
+{
+  sim.wav = wav;
+  sim.wav_rate = rate;
+  sim.wav_samples = 0;
+  sim.wav_next = F_CPU / rate;
+
+  if (wav)
+    wav_write_header(wav, rate, 0);
+}
+
+uint32_t sim_pwm_close_output(void)
+{
+  if (sim.wav)
+  {
+    wav_write_header(sim.wav, sim.wav_rate, sim.wav_samples);
+    fclose(sim.wav);
+    sim.wav = NULL;
+  }
+
+  return sim.wav_samples;
+}
+
+uint64_t sim_pwm_first_activity(void)
+{
+  return sim.pwm_activity;
+}
+
+uint64_t sim_led_first_on(uint8_t led)
+{
+  return sim.led_on[led];
+}
@@ -0,0 +1,121 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define SIM_MS(ms) ((uint64_t)(ms) * (F_CPU / 1000UL))
+#define SIM_US(us) ((uint64_t)(us) * (F_CPU / 1000000UL))
+
+enum {
+  SIM_VECTOR_TIMER1_COMPA,
+  SIM_VECTOR_TIMER0_COMPA,
+  SIM_VECTOR_TIMER0_COMPB,
+  SIM_VECTOR_USART_RX,
+  SIM_VECTOR_USART_UDRE,
+  SIM_NB_VECTORS,
+};
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint32_t bytes_sent;
+  uint32_t bytes_received;
+  uint32_t rx_overruns;
+} t_sim_usart_stats;
+
+typedef struct {
+  const char* name;
+  uint32_t count;
+  uint64_t total_cycles;
+  uint32_t max_cycles;
+} t_sim_vector_stats;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+extern uint64_t sim_cycles;
+extern t_sim_vector_stats sim_vector_stats[SIM_NB_VECTORS];
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Core */
+void sim_init(void);
+void sim_step(uint64_t target);
+void sim_set_end(uint64_t end_cycles, void (*finish)(void));
+void sim_set_event_handler(uint64_t next_event, void (*handler)(void));
+
+/* Time spent in sleep mode, wake-up interrupts included */
+uint64_t sim_sleep_cycles(void);
+
+/* Keyboard matrix */
+void sim_key_set(uint8_t row, uint8_t col, uint8_t pressed);
+
+/* ADC input, 8-bit unsigned samples at the given rate */
+void sim_adc_set_input(const uint8_t* samples, uint32_t nb_samples, uint32_t rate);
+
+/* DAC output, sampled at the given rate with a zero-order hold */
+void sim_pwm_set_output(FILE* wav, uint32_t rate);
+uint32_t sim_pwm_close_output(void);
+uint64_t sim_pwm_first_activity(void);
+
+/* Leds */
+uint64_t sim_led_first_on(uint8_t led);
+
+/* USART input, received at the programmed baud rate */
+void sim_usart_add_input(const uint8_t* data, uint32_t length);
+const t_sim_usart_stats* sim_usart_get_stats(void);
+
+/* SD card model */
+typedef struct {
+  uint32_t init_us;
+  uint32_t read_latency_us;
+  uint32_t write_busy_us;
+  uint16_t read_fault_permille;
+  uint16_t write_fault_permille;
+} t_sdcard_config;
+
+typedef struct {
+  uint32_t commands;
+  uint32_t blocks_read;
+  uint32_t blocks_written;
+  uint32_t erases;
+  uint32_t read_faults;
+  uint32_t write_faults;
+} t_sdcard_stats;
+
+void sdcard_init(uint8_t* image, uint32_t size, const t_sdcard_config* config);
+void sdcard_set_present(uint8_t present);
+void sdcard_set_faults(uint16_t read_fault_permille, uint16_t write_fault_permille);
+uint8_t sdcard_transfer(uint8_t mosi, uint8_t selected);
+const t_sdcard_stats* sdcard_get_stats(void);
+
+#endif /* SIM_H */
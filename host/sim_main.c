@@ -0,0 +1,543 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: simulation driver
+*
+* Runs the firmware against the ATmega328P model and the SD card model,
+* replays a script of keyboard and card events and records the DAC output.
+*
+* Script lines, times in ms from reset:
+*   <time> key <name> [<hold time>]   Press a key (1..9, 0, *, #, M1..M3,
+*                                     R, MEM, BIS, ENR), default hold 200
+*   <time> remove                     Remove the SD card
+*   <time> insert                     Insert the SD card
+*   <time> faults <read> <write>      Set the card fault rates, per 1000
+*                                     block transfers
+*   <time> serial <text>              Send a line on the serial port,
+*                                     terminated by a carriage return
+*   <time> send <file>                Send the content of a file on the
+*                                     serial port
+*   <time> end                        End of the simulation
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define MAX_EVENTS       (256)
+#define DEFAULT_HOLD_MS  (200)
+#define DEFAULT_END_MS   (10000)
+
+enum {
+  EVENT_KEY_PRESS,
+  EVENT_KEY_RELEASE,
+  EVENT_CARD_REMOVE,
+  EVENT_CARD_INSERT,
+  EVENT_CARD_FAULTS,
+  EVENT_SERIAL,
+  EVENT_SERIAL_FILE,
+};
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint64_t time;
+  uint8_t type;
+  uint8_t row;
+  uint8_t col;
+  uint16_t read_faults;
+  uint16_t write_faults;
+  char* text;
+  uint32_t length;
+} t_event;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static const struct {
+  const char* name;
+  uint8_t row;
+  uint8_t col;
+} keys[] = {
+  { "1", 0, 0 }, { "2", 0, 1 }, { "3", 0, 2 }, { "M1", 0, 4 },
+  { "4", 1, 0 }, { "5", 1, 1 }, { "6", 1, 2 }, { "R", 1, 3 }, { "M2", 1, 4 },
+  { "7", 2, 0 }, { "8", 2, 1 }, { "9", 2, 2 }, { "MEM", 2, 3 }, { "M3", 2, 4 },
+  { "*", 3, 0 }, { "0", 3, 1 }, { "#", 3, 2 }, { "BIS", 3, 3 }, { "ENR", 3, 4 },
+};
+
+static struct {
+  t_event events[MAX_EVENTS];
+  uint16_t nb_events;
+  uint16_t next_event;
+
+  const char* image_name;
+  uint8_t* image;
+  uint32_t image_size;
+  uint8_t write_back;
+
+  uint8_t* adc_input;
+
+  const char* wav_name;
+  uint32_t wav_rate;
+
+  uint64_t end_cycles;
+  struct timespec start;
+} host;
+
+extern int firmware_main(void);
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+static void usage(const char* name)
+{
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -i <image>      SD card image (default ../sounds/babyphone.image)\n"
+    "  -w              write the card modifications back to the image\n"
+    "  -o <wav>        record the DAC output\n"
+    "  -r <rate>       DAC output sampling rate (default 16000)\n"
+    "  -a <wav>        ADC input, 8-bit or 16-bit mono\n"
+    "  -s <script>     event script\n"
+    "  -e <event>      event line, same syntax as the script\n"
+    "  -u <file>       serial input, sent from reset\n"
+    "  -t <ms>         end of the simulation (default %u)\n"
+    "  -I <ms>         card power up time (default 100)\n"
+    "  -L <us>         card read access time (default 300)\n"
+    "  -B <us>         card write busy time (default 1000)\n"
+    "  -f read:<n>     fail n/1000 block reads (no start token)\n"
+    "  -f write:<n>    fail n/1000 block writes (stuck busy)\n",
+    name, DEFAULT_END_MS);
+  exit(1);
+}
+
+static uint8_t* load_file(const char* name, uint32_t* size)
+{
+  FILE* f = fopen(name, "rb");
+  uint8_t* data;
+  long length;
+
+  if (!f)
+  {
+    perror(name);
+    exit(1);
+  }
+
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  data = malloc(length ? length : 1);
+  if (!data || (fread(data, 1, length, f) != (size_t)length))
+  {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+
+  fclose(f);
+  *size = (uint32_t)length;
+  return data;
+}
+
+/* Convert a PCM WAV file to unsigned 8-bit mono samples */
+static void load_adc_input(const char* name)
+{
+  uint32_t size, pos = 12;
+  uint8_t* wav = load_file(name, &size);
+  uint16_t channels = 0, bits = 0;
+  uint32_t rate = 0;
+
+  if ((size < 12) || memcmp(wav, "RIFF", 4) || memcmp(wav + 8, "WAVE", 4))
+  {
+    fprintf(stderr, "%s: not a WAV file\n", name);
+    exit(1);
+  }
+
+  while (pos + 8 <= size)
+  {
+    uint32_t chunk_size;
+    memcpy(&chunk_size, wav + pos + 4, 4);
+
+    if (!memcmp(wav + pos, "fmt ", 4))
+    {
+      memcpy(&channels, wav + pos + 10, 2);
+      memcpy(&rate, wav + pos + 12, 4);
+      memcpy(&bits, wav + pos + 22, 2);
+    }
+    else if (!memcmp(wav + pos, "data", 4))
+    {
+      uint32_t frame = channels * bits / 8;
+      uint32_t nb_samples;
+
+      if (!frame || ((bits != 8) && (bits != 16)))
+        break;
+
+      if (chunk_size > size - pos - 8)
+        chunk_size = size - pos - 8;
+      nb_samples = chunk_size / frame;
+
+      host.adc_input = malloc(nb_samples ? nb_samples : 1);
+      for (uint32_t i = 0; i < nb_samples; i++)
+      {
+        const uint8_t* p = wav + pos + 8 + i * frame;
+        host.adc_input[i] = (bits == 8) ? p[0] : (uint8_t)(p[1] ^ 0x80);
+      }
+
+      sim_adc_set_input(host.adc_input, nb_samples, rate);
+      free(wav);
+      return;
+    }
+
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  fprintf(stderr, "%s: unsupported WAV format\n", name);
+  exit(1);
+}
+
+static t_event* add_event(uint64_t time, uint8_t type, uint8_t row, uint8_t col)
+{
+  t_event* event;
+  uint16_t i;
+
+  if (host.nb_events >= MAX_EVENTS)
+  {
+    fprintf(stderr, "too many events\n");
+    exit(1);
+  }
+
+  /* Keep the list sorted by time */
+  for (i = host.nb_events; (i > 0) && (host.events[i - 1].time > time); i--)
+    host.events[i] = host.events[i - 1];
+
+  event = &host.events[i];
+  event->time = time;
+  event->type = type;
+  event->row = row;
+  event->col = col;
+  host.nb_events++;
+
+  return event;
+}
+
+static void parse_event(const char* line)
+{
+  char action[16] = "", argument[16] = "";
+  unsigned long time, hold = DEFAULT_HOLD_MS;
+  int n;
+
+  n = sscanf(line, "%lu %15s %15s %lu", &time, action, argument, &hold);
+  if (n < 2)
+  {
+    fprintf(stderr, "invalid event: %s\n", line);
+    exit(1);
+  }
+
+  if (!strcmp(action, "key") && (n >= 3))
+  {
+    for (uint8_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+      if (!strcasecmp(argument, keys[i].name))
+      {
+        add_event(SIM_MS(time), EVENT_KEY_PRESS, keys[i].row, keys[i].col);
+        add_event(SIM_MS(time + hold), EVENT_KEY_RELEASE, keys[i].row, keys[i].col);
+        return;
+      }
+    }
+    fprintf(stderr, "unknown key: %s\n", argument);
+    exit(1);
+  }
+  else if (!strcmp(action, "remove"))
+  {
+    add_event(SIM_MS(time), EVENT_CARD_REMOVE, 0, 0);
+  }
+  else if (!strcmp(action, "insert"))
+  {
+    add_event(SIM_MS(time), EVENT_CARD_INSERT, 0, 0);
+  }
+  else if (!strcmp(action, "faults") && (n >= 3))
+  {
+    t_event* event = add_event(SIM_MS(time), EVENT_CARD_FAULTS, 0, 0);
+    event->read_faults = strtoul(argument, NULL, 0);
+    event->write_faults = (n >= 4) ? hold : 0;
+  }
+  else if (!strcmp(action, "serial"))
+  {
+    t_event* event = add_event(SIM_MS(time), EVENT_SERIAL, 0, 0);
+    const char* text = strstr(line, "serial") + 6;
+
+    text += strspn(text, " \t");
+    event->text = malloc(strlen(text) + 2);
+    strcpy(event->text, text);
+    event->text[strcspn(event->text, "\r\n")] = '\0';
+    strcat(event->text, "\r");
+    event->length = strlen(event->text);
+  }
+  else if (!strcmp(action, "send") && (n >= 3))
+  {
+    char name[128];
+    t_event* event = add_event(SIM_MS(time), EVENT_SERIAL_FILE, 0, 0);
+
+    if (sscanf(line, "%*u %*s %127s", name) != 1)
+    {
+      fprintf(stderr, "invalid event: %s\n", line);
+      exit(1);
+    }
+    event->text = (char*)load_file(name, &event->length);
+  }
+  else if (!strcmp(action, "end"))
+  {
+    host.end_cycles = SIM_MS(time);
+  }
+  else
+  {
+    fprintf(stderr, "invalid event: %s\n", line);
+    exit(1);
+  }
+}
+
+static void load_script(const char* name)
+{
+  char line[128];
+  FILE* f = fopen(name, "r");
+
+  if (!f)
+  {
+    perror(name);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char* p = line + strspn(line, " \t");
+
+    if ((*p == '#') || (*p == '\n') || (*p == '\0'))
+      continue;
+
+    parse_event(p);
+  }
+
+  fclose(f);
+}
+
+static void run_events(void)
+{
+  while ((host.next_event < host.nb_events)
+      && (host.events[host.next_event].time <= sim_cycles))
+  {
+    t_event* event = &host.events[host.next_event++];
+
+    switch (event->type)
+    {
+      case EVENT_KEY_PRESS:
+        sim_key_set(event->row, event->col, 1);
+        break;
+
+      case EVENT_KEY_RELEASE:
+        sim_key_set(event->row, event->col, 0);
+        break;
+
+      case EVENT_CARD_REMOVE:
+        sdcard_set_present(0);
+        break;
+
+      case EVENT_CARD_INSERT:
+        sdcard_set_present(1);
+        break;
+
+      case EVENT_CARD_FAULTS:
+        sdcard_set_faults(event->read_faults, event->write_faults);
+        break;
+
+      case EVENT_SERIAL:
+      case EVENT_SERIAL_FILE:
+        sim_usart_add_input((const uint8_t*)event->text, event->length);
+        break;
+    }
+  }
+
+  if (host.next_event < host.nb_events)
+    sim_set_event_handler(host.events[host.next_event].time, &run_events);
+}
+
+static double cycles_to_ms(uint64_t cycles)
+{
+  return (double)cycles * 1000.0 / F_CPU;
+}
+
+static void report_time(const char* label, uint64_t cycles)
+{
+  if (cycles == UINT64_MAX)
+    fprintf(stderr, "  %-22s never\n", label);
+  else
+    fprintf(stderr, "  %-22s %.2f ms\n", label, cycles_to_ms(cycles));
+}
+
+static void finish(void)
+{
+  struct timespec now;
+  double wall, simulated = cycles_to_ms(sim_cycles) / 1000.0;
+  const t_sdcard_stats* card = sdcard_get_stats();
+  const t_sim_usart_stats* usart = sim_usart_get_stats();
+
+  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  wall = (now.tv_sec - host.start.tv_sec) + (now.tv_nsec - host.start.tv_nsec) / 1e9;
+
+  sim_pwm_close_output();
+
+  if (host.write_back)
+  {
+    FILE* f = fopen(host.image_name, "r+b");
+    if (!f || (fwrite(host.image, 1, host.image_size, f) != host.image_size))
+      perror(host.image_name);
+    if (f)
+      fclose(f);
+  }
+
+  fprintf(stderr, "\nSimulated %.3f s in %.3f s (x%.1f)\n", simulated, wall, wall > 0 ? simulated / wall : 0);
+
+  fprintf(stderr, "Milestones:\n");
+  report_time("first audio output", sim_pwm_first_activity());
+  report_time("green led on", sim_led_first_on(0));
+  report_time("red led on", sim_led_first_on(1));
+
+  fprintf(stderr, "CPU:\n");
+  fprintf(stderr, "  asleep %.1f%% of the time\n", sim_cycles ? 100.0 * sim_sleep_cycles() / sim_cycles : 0.0);
+
+  fprintf(stderr, "Interrupts:            count   avg cycles   max cycles\n");
+  for (uint8_t i = 0; i < SIM_NB_VECTORS; i++)
+  {
+    t_sim_vector_stats* stats = &sim_vector_stats[i];
+    fprintf(stderr, "  %-16s %10u %12.1f %12u\n", stats->name, stats->count,
+            stats->count ? (double)stats->total_cycles / stats->count : 0.0, stats->max_cycles);
+  }
+
+  fprintf(stderr, "SD card:\n");
+  fprintf(stderr, "  commands %u, blocks read %u, blocks written %u, erases %u\n",
+          card->commands, card->blocks_read, card->blocks_written, card->erases);
+  fprintf(stderr, "  injected read faults %u, write faults %u\n", card->read_faults, card->write_faults);
+
+  fprintf(stderr, "USART:\n");
+  fprintf(stderr, "  bytes sent %u, received %u, receive overruns %u\n",
+          usart->bytes_sent, usart->bytes_received, usart->rx_overruns);
+}
+
+int main(int argc, char* argv[])
+{
+  t_sdcard_config card_config = { 100000, 300, 1000, 0, 0 };
+  const char* adc_name = NULL;
+  const char* serial_name = NULL;
+  int opt;
+
+  host.image_name = "../sounds/babyphone.image";
+  host.wav_rate = 16000;
+  host.end_cycles = SIM_MS(DEFAULT_END_MS);
+
+  while ((opt = getopt(argc, argv, "i:wo:r:a:s:e:u:t:I:L:B:f:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'i': host.image_name = optarg; break;
+      case 'w': host.write_back = 1; break;
+      case 'o': host.wav_name = optarg; break;
+      case 'r': host.wav_rate = strtoul(optarg, NULL, 0); break;
+      case 'a': adc_name = optarg; break;
+      case 's': load_script(optarg); break;
+      case 'e': parse_event(optarg); break;
+      case 'u': serial_name = optarg; break;
+      case 't': host.end_cycles = SIM_MS(strtoul(optarg, NULL, 0)); break;
+      case 'I': card_config.init_us = strtoul(optarg, NULL, 0) * 1000; break;
+      case 'L': card_config.read_latency_us = strtoul(optarg, NULL, 0); break;
+      case 'B': card_config.write_busy_us = strtoul(optarg, NULL, 0); break;
+      case 'f':
+        if (!strncmp(optarg, "read:", 5))
+          card_config.read_fault_permille = strtoul(optarg + 5, NULL, 0);
+        else if (!strncmp(optarg, "write:", 6))
+          card_config.write_fault_permille = strtoul(optarg + 6, NULL, 0);
+        else
+          usage(argv[0]);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (!host.wav_rate)
+    usage(argv[0]);
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  sim_init();
+
+  host.image = load_file(host.image_name, &host.image_size);
+  sdcard_init(host.image, host.image_size, &card_config);
+
+  if (adc_name)
+    load_adc_input(adc_name);
+
+  if (serial_name)
+  {
+    uint32_t size;
+    uint8_t* data = load_file(serial_name, &size);
+    sim_usart_add_input(data, size);
+    free(data);
+  }
+
+  if (host.wav_name)
+  {
+    FILE* wav = fopen(host.wav_name, "wb");
+    if (!wav)
+    {
+      perror(host.wav_name);
+      exit(1);
+    }
+    sim_pwm_set_output(wav, host.wav_rate);
+  }
+  else
+  {
+    sim_pwm_set_output(NULL, host.wav_rate);
+  }
+
+  run_events();
+  sim_set_end(host.end_cycles, &finish);
+  clock_gettime(CLOCK_MONOTONIC, &host.start);
+
+  /* Reset */
+  firmware_main();
+
+  finish();
+  return 0;
+}
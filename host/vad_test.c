@@ -0,0 +1,280 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/*****************************************************************************
+* Host build: test of the voice activity detector of audio/vad.c
+*
+* Feeds audio/vad.c with the block levels of WAV vectors, computed as the
+* ADC interrupt does, and checks the blocks where the voice starts and
+* where the auto-stop ends it against the expected ones of a list:
+*
+*   # comment
+*   <vector.wav> <auto-stop ms> <voice starts> <first start> <end>
+*
+* Blocks are counted from the start of the vector, 64 samples (8 ms) each,
+* "-" when there is none. The vectors are 8-bit mono WAV files at 8000 Hz,
+* named relative to the list.
+*
+*   vad_test [-v] <list>
+*
+* With -v the state changes are printed. Exits with 1 on a mismatch.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "vad.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#define CAPTURE_RATE  (8000)
+#define NONE          (-1)
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static struct {
+  uint8_t verbose;
+  uint32_t vectors;
+  uint32_t failures;
+} test;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+/* Samples of an 8-bit mono PCM WAV file at the capture rate, NULL if the
+   file cannot be read or has another format */
+static uint8_t* load_vector(const char* name, uint32_t* nb_samples)
+{
+  FILE* f = fopen(name, "rb");
+  uint8_t header[12], chunk[8], format[16];
+  uint8_t* samples = NULL;
+
+  if (!f)
+  {
+    perror(name);
+    return NULL;
+  }
+
+  if ((fread(header, 1, sizeof(header), f) != sizeof(header)) ||
+      memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4))
+  {
+    fprintf(stderr, "%s: not a WAV file\n", name);
+    fclose(f);
+    return NULL;
+  }
+
+  memset(format, 0x00, sizeof(format));
+
+  while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk))
+  {
+    uint32_t size;
+    memcpy(&size, chunk + 4, 4);
+
+    if (!memcmp(chunk, "fmt ", 4) && (size >= sizeof(format)))
+    {
+      if (fread(format, 1, sizeof(format), f) != sizeof(format))
+        break;
+      fseek(f, size - sizeof(format) + (size & 1), SEEK_CUR);
+    }
+    else if (!memcmp(chunk, "data", 4))
+    {
+      uint16_t channels, bits;
+      uint32_t rate;
+
+      memcpy(&channels, format + 2, 2);
+      memcpy(&rate, format + 4, 4);
+      memcpy(&bits, format + 14, 2);
+      if ((channels != 1) || (rate != CAPTURE_RATE) || (bits != 8))
+        break;
+
+      samples = malloc(size ? size : 1);
+      *nb_samples = (uint32_t)fread(samples, 1, size, f);
+      break;
+    }
+    else
+    {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+
+  fclose(f);
+
+  if (!samples)
+    fprintf(stderr, "%s: no 8-bit mono data at %u Hz\n", name, CAPTURE_RATE);
+
+  return samples;
+}
+
+static void print_block(const char* label, int32_t block)
+{
+  if (block == NONE)
+    printf(" %s %5s", label, "-");
+  else
+    printf(" %s %5d", label, block);
+}
+
+static int32_t parse_block(const char* field)
+{
+  return strcmp(field, "-") ? atoi(field) : NONE;
+}
+
+static void run_vector(const char* name, uint32_t stop_ms, uint32_t expected_starts,
+                       int32_t expected_start, int32_t expected_end)
+{
+  uint32_t nb_samples, starts = 0;
+  int32_t start = NONE, end = NONE;
+  uint8_t* samples = load_vector(name, &nb_samples);
+  uint8_t state = VAD_SILENCE;
+  uint8_t ok;
+
+  test.vectors++;
+
+  if (!samples)
+  {
+    test.failures++;
+    return;
+  }
+
+  /* Auto-stop converted to blocks as by the recorder and the ADC */
+  vad_init((uint16_t)((stop_ms * CAPTURE_RATE / 1000) >> VAD_BLOCK_SHIFT));
+
+  for (uint32_t block = 0; (block + 1) * VAD_BLOCK_SIZE <= nb_samples; block++)
+  {
+    const uint8_t* p = samples + block * VAD_BLOCK_SIZE;
+    uint16_t sum = 0;
+    uint8_t next;
+
+    for (uint8_t i = 0; i < VAD_BLOCK_SIZE; i++)
+      sum += (p[i] < 128) ? (128 - p[i]) : (p[i] - 128);
+
+    next = vad_update((uint8_t)(sum >> VAD_BLOCK_SHIFT));
+
+    if ((next == VAD_VOICE) && (state != VAD_VOICE))
+    {
+      if (!starts++)
+        start = (int32_t)block;
+      if (test.verbose)
+        printf("  %s: voice at block %u\n", basename((char*)name), block);
+    }
+    else if ((next != VAD_VOICE) && (state == VAD_VOICE) && test.verbose)
+    {
+      printf("  %s: silence at block %u\n", basename((char*)name), block);
+    }
+
+    if ((next == VAD_END) && (end == NONE))
+    {
+      end = (int32_t)block;
+      if (test.verbose)
+        printf("  %s: end at block %u\n", basename((char*)name), block);
+    }
+
+    state = next;
+  }
+
+  ok = (starts == expected_starts) && (start == expected_start) && (end == expected_end);
+
+  printf("%-16s starts %2u", basename((char*)name), starts);
+  print_block("first", start);
+  print_block("end", end);
+  if (ok)
+  {
+    printf("  ok\n");
+  }
+  else
+  {
+    printf("  FAIL, expected %u", expected_starts);
+    print_block("first", expected_start);
+    print_block("end", expected_end);
+    printf("\n");
+    test.failures++;
+  }
+
+  free(samples);
+}
+
+int main(int argc, char* argv[])
+{
+  char line[256], path[512];
+  char* dir;
+  FILE* list;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "vh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'v': test.verbose = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-v] <list>\n", argv[0]);
+        return 2;
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    fprintf(stderr, "usage: %s [-v] <list>\n", argv[0]);
+    return 2;
+  }
+
+  list = fopen(argv[optind], "r");
+  if (!list)
+  {
+    perror(argv[optind]);
+    return 2;
+  }
+  dir = dirname(strdup(argv[optind]));
+
+  while (fgets(line, sizeof(line), list))
+  {
+    char name[128], start[16], end[16];
+    unsigned stop_ms, starts;
+
+    if ((line[0] == '#') || (line[strspn(line, " \t\r\n")] == '\0'))
+      continue;
+
+    if (sscanf(line, "%127s %u %u %15s %15s", name, &stop_ms, &starts, start, end) != 5)
+    {
+      fprintf(stderr, "%s: bad line: %s", argv[optind], line);
+      test.failures++;
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    run_vector(path, stop_ms, starts, parse_block(start), parse_block(end));
+  }
+
+  fclose(list);
+
+  printf("%u vectors, %u failures\n", test.vectors, test.failures);
+
+  return test.failures ? 1 : 0;
+}
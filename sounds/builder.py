@@ -0,0 +1,336 @@
+#!/usr/bin/env python3
+
+"""Incremental builder of the SD card image.
+
+The sources of the read-only partitions are WAV files (8 to 32-bit
+integer or float PCM, any number of channels) or FLAC files, decoded with
+the flac command. Each one is converted in a worker process to the
+unsigned 8-bit mono samples of the slot:
+
+  - mixed down to mono
+  - resampled to the rate of the slot, windowed-sinc interpolation
+  - normalised to -1 dBFS, when asked for
+  - dithered (triangular, seeded by the source) down to 8 bits
+
+An 8-bit mono source at the rate of the slot is copied as is. The samples
+end on a whole block, as with slotfs.build_fs.
+
+The conversions are cached in .cache/ by the hash of the source and of the
+options, a partition is written again only when the hash of its slots and
+layout changed, and the image only when one of its partitions did. The
+manifest written next to the image describes every partition and slot
+with its position on the card and the hash of its content.
+"""
+
+import hashlib
+import json
+import math
+import operator
+import os
+import random
+import struct
+import subprocess
+from concurrent.futures import ProcessPoolExecutor
+
+import slotfs
+
+BUILDER_VERSION = 1
+CACHE_DIR = ".cache"
+DEFAULT_RATE = 8000
+NORMALISE_PEAK = 10 ** (-1 / 20)
+
+# Resampling: zero crossings on each side of the kernel at the lower rate,
+# and fractional positions of the kernel table
+RESAMPLE_ZEROS = 12
+RESAMPLE_PHASES = 256
+
+
+class Slot:
+    """Source file of a slot, with its own rate or normalisation"""
+
+    def __init__(self, source, sampling_rate = 0, normalise = False):
+        self.source = source
+        self.sampling_rate = sampling_rate
+        self.normalise = normalise
+
+
+class ReadOnly:
+    """Read-only partition of the slots of a list of sources"""
+
+    def __init__(self, name, slots, sampling_rate = 0, normalise = False):
+        self.name = name
+        self.sampling_rate = sampling_rate
+        self.slots = [s if isinstance(s, Slot) else Slot(s, normalise=normalise) for s in slots]
+
+
+class DynamicRW:
+    """Read-write partition of slots allocated on recording"""
+
+    def __init__(self, name, nb_slots, nb_blocks, sampling_rate = 0, nb_journal_blocks = 8, cluster_blocks = 8):
+        self.name = name
+        self.params = dict(nb_slots=nb_slots, nb_blocks=nb_blocks, sampling_rate=sampling_rate,
+                           nb_journal_blocks=nb_journal_blocks, cluster_blocks=cluster_blocks)
+
+
+class Area:
+    """Partition of blocks left to the application, after its header"""
+
+    def __init__(self, name, nb_blocks):
+        self.name = name
+        self.params = dict(nb_blocks=nb_blocks)
+
+
+def sha256(*parts):
+    h = hashlib.sha256()
+    for part in parts:
+        h.update(part if isinstance(part, bytes) else repr(part).encode())
+    return h.hexdigest()
+
+
+def file_sha256(name):
+    with open(name, "rb") as f:
+        return sha256(f.read())
+
+
+# ---------------------------------------------------------------------------
+# Decoding
+
+def read_wav(data, name):
+    """Sample width, rate, channels and frames of a RIFF WAVE file"""
+    if data[:4] != b"RIFF" or data[8:12] != b"WAVE":
+        raise ValueError("%s: not a WAV file" % name)
+
+    fmt, frames, pos = None, None, 12
+    while pos + 8 <= len(data):
+        chunk, size = struct.unpack_from("<4sL", data, pos)
+        if chunk == b"fmt ":
+            fmt = struct.unpack_from("<HHLLHH", data, pos + 8)
+            if fmt[0] == 0xFFFE:  # Extensible: the format is the sub-format
+                fmt = (struct.unpack_from("<H", data, pos + 32)[0],) + fmt[1:]
+        elif chunk == b"data":
+            frames = data[pos + 8:pos + 8 + size]
+        pos += 8 + size + (size & 1)
+
+    if fmt is None or frames is None or fmt[0] not in (1, 3):
+        raise ValueError("%s: PCM or float WAV expected" % name)
+    tag, channels, rate, _, _, bits = fmt
+    return tag, bits // 8, rate, channels, frames
+
+
+def decode(name):
+    """Tag, sample width, rate, channels and frames of a source"""
+    if name.lower().endswith(".flac"):
+        try:
+            data = subprocess.run(["flac", "-d", "-c", "-s", name], check=True,
+                                  stdout=subprocess.PIPE).stdout
+        except OSError:
+            raise ValueError("%s: the flac command is needed" % name)
+    else:
+        with open(name, "rb") as f:
+            data = f.read()
+    return read_wav(data, name)
+
+
+def to_float(tag, width, channels, frames):
+    """Mono samples in [-1, 1]"""
+    nb_frames = len(frames) // (width * channels)
+    if tag == 3:
+        values = struct.unpack_from("<%i%s" % (nb_frames * channels, "f" if width == 4 else "d"), frames)
+    elif width == 1:
+        values = [(b - 128) / 128 for b in frames[:nb_frames * channels]]
+    elif width == 3:
+        values = [int.from_bytes(frames[i:i + 3], "little", signed=True) / 8388608
+                  for i in range(0, nb_frames * channels * 3, 3)]
+    else:
+        scale = 1 << (8 * width - 1)
+        values = [v / scale for v in struct.unpack_from("<%i%s" % (nb_frames * channels, "h" if width == 2 else "i"), frames)]
+
+    if channels == 1:
+        return list(values)
+    return [sum(values[i:i + channels]) / channels for i in range(0, nb_frames * channels, channels)]
+
+
+# ---------------------------------------------------------------------------
+# Conversion
+
+def resample(samples, src_rate, dst_rate):
+    """Windowed-sinc interpolation, low-pass at the lower Nyquist rate"""
+    if src_rate == dst_rate:
+        return samples
+
+    cutoff = min(1.0, dst_rate / src_rate)
+    half = int(math.ceil(RESAMPLE_ZEROS / cutoff))
+
+    # Kernel at the fractional positions, Hann window
+    table = []
+    for phase in range(RESAMPLE_PHASES):
+        frac = phase / RESAMPLE_PHASES
+        row = []
+        for k in range(-half + 1, half + 1):
+            d = k - frac
+            w = 0.5 + 0.5 * math.cos(math.pi * d / half)
+            x = math.pi * cutoff * d
+            row.append(cutoff * w * (math.sin(x) / x if x else 1.0))
+        table.append(row)
+
+    padded = [0.0] * half + samples + [0.0] * (half + 1)
+    step = src_rate / dst_rate
+    out = []
+    for n in range(int(len(samples) / step)):
+        t = n * step
+        i = int(t)
+        row = table[int((t - i) * RESAMPLE_PHASES)]
+        out.append(sum(map(operator.mul, padded[i + 1:i + 1 + 2 * half], row)))
+    return out
+
+
+def quantize(samples, seed):
+    """Unsigned 8-bit samples, triangular dither of one step"""
+    rng = random.Random(seed)
+    out = bytearray(len(samples))
+    for i, x in enumerate(samples):
+        v = int(round(128 + x * 127 + rng.random() - rng.random()))
+        out[i] = 0 if v < 0 else 255 if v > 255 else v
+    return bytes(out)
+
+
+def convert(source, rate, normalise, key):
+    """8-bit mono samples of a source at a rate, whole blocks"""
+    tag, width, src_rate, channels, frames = decode(source)
+
+    if tag == 1 and width == 1 and channels == 1 and src_rate == rate and not normalise:
+        samples = frames
+    else:
+        x = resample(to_float(tag, width, channels, frames), src_rate, rate)
+        peak = max(map(abs, x), default=0)
+        if normalise and peak > 0:
+            x = [v * NORMALISE_PEAK / peak for v in x]
+        samples = quantize(x, key)
+
+    return samples[:len(samples) // 512 * 512]
+
+
+def convert_job(job):
+    """Worker: convert a source into the cache"""
+    source, rate, normalise, key = job
+    samples = convert(source, rate, normalise, key)
+    with open(os.path.join(CACHE_DIR, key + ".u8"), "wb") as f:
+        f.write(samples)
+    return source, len(samples) // 512
+
+
+# ---------------------------------------------------------------------------
+# Build
+
+def read_manifest(name):
+    try:
+        with open(name) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def build(image, partitions, manifest = None, jobs = None, partition_align = 1, slot_align = 1, force = False):
+    """Build what changed, returns the manifest"""
+    manifest = manifest or os.path.splitext(image)[0] + ".manifest.json"
+    previous = {p["name"]: p for p in read_manifest(manifest).get("partitions", [])}
+    os.makedirs(CACHE_DIR, exist_ok=True)
+
+    # Key of each slot: its source and conversion
+    jobs_todo = []
+    for p in partitions:
+        if not isinstance(p, ReadOnly):
+            continue
+        for s in p.slots:
+            s.rate = s.sampling_rate or p.sampling_rate or DEFAULT_RATE
+            s.source_sha256 = file_sha256(s.source)
+            s.key = sha256(BUILDER_VERSION, s.source_sha256, s.rate, s.normalise)
+            if force or not os.path.exists(os.path.join(CACHE_DIR, s.key + ".u8")):
+                jobs_todo.append((s.source, s.rate, s.normalise, s.key))
+
+    # Conversions in parallel
+    jobs_todo = list({job[3]: job for job in jobs_todo}.values())
+    if len(jobs_todo) > 1 and jobs != 1:
+        with ProcessPoolExecutor(max_workers=jobs) as executor:
+            for source, nb_blocks in executor.map(convert_job, jobs_todo):
+                print("Converted %s: %i blocks" % (source, nb_blocks))
+    else:
+        for job in jobs_todo:
+            print("Converted %s: %i blocks" % convert_job(job))
+
+    # Partitions whose key changed
+    built = []
+    entries = []
+    for p in partitions:
+        if isinstance(p, ReadOnly):
+            key = sha256(BUILDER_VERSION, p.sampling_rate, slot_align, [s.key for s in p.slots])
+        else:
+            key = sha256(BUILDER_VERSION, sorted(p.params.items()))
+        p.key = key
+
+        old = previous.get(p.name)
+        if not force and old and old.get("key") == key and os.path.exists(p.name):
+            print("%s is up to date" % p.name)
+            p.entries = [(s["offset"], s["nb_blocks"]) for s in old["slots"]]
+            continue
+
+        if isinstance(p, ReadOnly):
+            slots = []
+            for s in p.slots:
+                with open(os.path.join(CACHE_DIR, s.key + ".u8"), "rb") as f:
+                    slots.append((s.source, f.read(), s.rate, 1))
+            p.entries = [e[:2] for e in slotfs.write_fs(p.name, slots, p.sampling_rate, slot_align)]
+        elif isinstance(p, DynamicRW):
+            slotfs.build_dynamic_rw_fs(p.name, **p.params)
+            p.entries = []
+        else:
+            slotfs.build_area_fs(p.name, **p.params)
+            p.entries = []
+        built.append(p.name)
+
+    # Image of the partitions
+    image_key = sha256(BUILDER_VERSION, partition_align, [p.key for p in partitions])
+    if force or built or read_manifest(manifest).get("key") != image_key or not os.path.exists(image):
+        entries = slotfs.build_image(image, [p.name for p in partitions], partition_align)
+    else:
+        print("%s is up to date" % image)
+        entries = [(p["start"], p["nb_blocks"]) for p in previous.values()]
+
+    # Manifest of the partitions and slots
+    result = {"image": image, "key": image_key, "nb_blocks": os.path.getsize(image) // 512, "partitions": []}
+    for p, (start, nb_blocks) in zip(partitions, entries):
+        partition = {"name": p.name, "key": p.key, "start": start, "nb_blocks": nb_blocks, "slots": []}
+        if isinstance(p, ReadOnly):
+            for i, (s, (offset, slot_blocks)) in enumerate(zip(p.slots, p.entries)):
+                with open(os.path.join(CACHE_DIR, s.key + ".u8"), "rb") as f:
+                    data = f.read()
+                partition["slots"].append({
+                    "slot": i, "source": s.source, "source_sha256": s.source_sha256,
+                    "sampling_rate": s.rate, "normalise": s.normalise,
+                    "offset": offset, "start": start + offset, "nb_blocks": slot_blocks,
+                    "sha256": sha256(data)})
+        elif isinstance(p, DynamicRW):
+            partition["dynamic"] = p.params
+        else:
+            partition["area"] = p.params
+        result["partitions"].append(partition)
+
+    with open(manifest, "w") as f:
+        json.dump(result, f, indent=1)
+        f.write("\n")
+    return result
+
+
+def main(image, partitions, argv = None):
+    """Command line of make.py"""
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Build %s, only what changed" % image)
+    parser.add_argument("-j", "--jobs", type=int, default=None, help="worker processes (default: one per CPU)")
+    parser.add_argument("--partition-align", type=int, default=1, help="alignment of the partitions, in blocks")
+    parser.add_argument("--slot-align", type=int, default=1, help="alignment of the slots, in blocks")
+    parser.add_argument("-f", "--force", action="store_true", help="convert and write everything again")
+    args = parser.parse_args(argv)
+
+    build(image, partitions, jobs=args.jobs, partition_align=args.partition_align,
+          slot_align=args.slot_align, force=args.force)
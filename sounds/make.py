@@ -1,16 +1,57 @@
-#!/usr/bin/python
+#!/usr/bin/env python3
+
+"""Build babyphone.image and babyphone.manifest.json, see builder.py.
+
+  make.py [-j <jobs>] [--partition-align <blocks>] [--slot-align <blocks>] [-f]
+"""
+
+import builder
+
+DTMF = [
+    "1.wav",
+    "2.wav",
+    "3.wav",
+    "4.wav",
+    "5.wav",
+    "6.wav",
+    "7.wav",
+    "8.wav",
+    "9.wav",
+    "star.wav",
+    "0.wav",
+    "sharp.wav"
+]
+
+ANIMALS = [
+    "chimp.wav",
+    "cow.wav",
+    "dog.wav",
+    "dolphin.wav",
+    "ducks.wav",
+    "elephant.wav",
+    "frog.wav",
+    "horse.wav",
+    "lamb.wav",
+    "pig.wav",
+    "rooster.wav",
+    "wolf.wav"
+]
 
 PARTITIONS = [
-    "dtmf/dtmf.slotfs",
-    "animals/animals.slotfs",
-    "record/12slots10sec.slotfs",
+    builder.ReadOnly("dtmf/dtmf.slotfs", ["dtmf/" + f for f in DTMF]),
+    builder.ReadOnly("animals/animals.slotfs", ["animals/" + f for f in ANIMALS], sampling_rate=16000),
+
+    # 16 slots sharing 233 clusters of 8 blocks, about 4 min at 8 kHz
+    builder.DynamicRW("record/record.slotfs", 16, 1881, sampling_rate=8000),
+
+    # Black box ring of the shell, 30 chunks of 64 blocks after the header.
+    # Its partition file only holds the header, it is written by the build
+    # and not committed
+    builder.Area("ring/ring.slotfs", 1921),
 ]
 
 if __name__ == '__main__':
-    import sys
-    sys.path.append("..")
-    import slotfs
-    
-    slotfs.build_image("babyphone.image", PARTITIONS)
+    builder.main("babyphone.image", PARTITIONS)
     
-    print "To load the image on a SD card: dd if=<image> of=/dev/diskx bs=512"
\ No newline at end of file
+    print("To load the image on a SD card: dd if=<image> of=/dev/diskx bs=512")
+    print("or only its changes: ../tools/cardpatch.py write -s <state> <image> /dev/diskx")
@@ -1,138 +1,333 @@
-#!/usr/bin/python
+#!/usr/bin/env python3
+
+"""Build the slotfs partitions and the partitioned image of the SD card.
+
+Version 1 partition header (one sector):
+  0   "SLOTFS"
+  6   B   version
+  7   B   1 if read-only
+  8   <H  sampling rate of the partition, 0 for 8000 Hz
+  10  <H  number of journal blocks after the header (read-write partitions)
+  12  B   number of slots
+  13  B   flags (1: dynamic)
+  14  <H  alignment of the slot starts, in blocks
+  16  slot entries of 16 bytes:
+      <L  offset from the partition start, in blocks
+      <H  max content blocks
+      <H  content blocks
+      <H  sampling rate, 0 for the rate of the partition
+      B   codec (0: unsigned 8-bit PCM)
+      B   number of channels
+      <L  reserved
+
+Version 0 headers have entries of 8 bytes (offset, max content blocks,
+content blocks) up to a null offset, and no count.
+
+The content sizes of a read-write partition are updated in its journal
+blocks, in turn: "SJNL", <L sequence number, B number of slots, B check
+(complement of the byte sum), then the <H content blocks of every slot.
+The valid entry with the highest sequence number holds the current sizes.
+
+The slots of a dynamic read-write partition have no blocks in the header,
+they are allocated on recording in clusters of the alignment blocks, from
+the first multiple of it after the journal up to the end of the partition
+(255 clusters at most). Its journal entries hold, after the same 10 bytes,
+the extent of every slot (B first cluster, B number of clusters, <H content
+blocks) then the bitmap of the used clusters.
+
+An area partition is a read-write header without slot nor journal, the
+blocks after it are left to the application (the black box ring of the
+shell).
+
+The partitions of an image and the slots of a partition can be aligned on
+a number of blocks, for example 8192 for the 4 MB allocation units of most
+cards: the slots are then read and written without crossing the erase
+blocks or allocation units. The slot alignment is relative to the
+partition start, which is on a multiple of the partition alignment.
+
+  slotfs.py <image or partition>      list the partitions and slots
+"""
 
 import os
 import struct
+import sys
 import wave
 
-def build_fs(name, files, sampling_rate = 0):
+VERSION = 1
+HEADER = struct.Struct("<6sBBHHBBH")
+SLOT_ENTRY = struct.Struct("<LHHHBBL")
+SLOT_ENTRY_V0 = struct.Struct("<LHH")
+JOURNAL_ENTRY = struct.Struct("<4sLBB")
+EXTENT = struct.Struct("<BBH")
+CODEC_PCM_U8 = 0
+FLAG_DYNAMIC = 0x01
+MAX_DYNAMIC_SLOTS = 16
+MAX_CLUSTERS = 255
+
+
+def align_up(offset, align_blocks):
+    """First multiple of the alignment from an offset in blocks"""
+    return -(-offset // align_blocks) * align_blocks
+
+
+def header_sector(read_only, sampling_rate, nb_journal_blocks, entries, align_blocks=1, flags=0):
+    data = HEADER.pack(b"SLOTFS", VERSION, read_only, sampling_rate,
+                       nb_journal_blocks, len(entries), flags, align_blocks)
+    for entry in entries:
+        data += SLOT_ENTRY.pack(*entry)
+
+    if len(data) > 512:
+        raise ValueError("Too many slots")
+    return data + bytes(512 - len(data))
+
+
+def build_fs(name, files, sampling_rate = 0, align_blocks = 1):
     
-    # Compute the size of each file
+    # 8-bit samples of each file, the last partial block is left out
+    slots = []
+    for f in files:
+        with wave.open(f, "rb") as w:
+            if w.getsampwidth() != 1:
+                raise ValueError("%s: 8-bit samples expected" % f)
+            nb_blocks = w.getnframes() // 512
+            slots.append((f, w.readframes(nb_blocks * 512), w.getframerate(), w.getnchannels()))
+
+    write_fs(name, slots, sampling_rate, align_blocks)
+
+
+def write_fs(name, slots, sampling_rate = 0, align_blocks = 1):
+    """Read-only partition of the (name, samples, rate, channels) of the
+    slots, returns the slot entries"""
+
+    # Compute the position of each slot
     entries = []
     offset = 1 # Start at sector 1
-    for i, f in enumerate(files):
-        w = wave.open(f, "r")
-        nb_blocks = w.getnframes() / 512
-        print "%s => offset %i, %i blocks" % (f, offset, nb_blocks)
-        w.close()
-    
-        entries.append((offset, nb_blocks, nb_blocks))
+    for f, samples, rate, channels in slots:
+        offset = align_up(offset, align_blocks)
+        nb_blocks = len(samples) // 512
+        print("%s => offset %i, %i blocks, %i Hz" % (f, offset, nb_blocks, rate))
+
+        entries.append((offset, nb_blocks, nb_blocks, rate, CODEC_PCM_U8, channels, 0))
         offset += nb_blocks
 
     # Write the output
-    with open(name, "w") as output:
-        print "Writing %s..." % name
+    with open(name, "wb") as output:
+        print("Writing %s..." % name)
 
-        # Write the slotfs header
-        output.write("SLOTFS")
-        output.write(struct.pack("BB", 0, 1)) # Version 0, Read-only
-        output.write(struct.pack("<H", sampling_rate)) # Sampling rate
-        output.write(struct.pack("<HL", 0, 0)) # Padding
+        # Read-only slotfs header and slot entries
+        output.write(header_sector(1, sampling_rate, 0, entries, align_blocks))
 
-        # Write the slot entries
-        for entry in entries:
-            output.write(struct.pack("<LHH", *entry)) # Little endian
-    
-        # Sector padding
-        pos = output.tell()
-        if pos > 512:
-            raise "Too many slots"
-        else:
-            padding = [0] * (512 - pos)
-            output.write(struct.pack("B" * len(padding), *padding))
-
-        # Write the files
-        for f in files:
-            w = wave.open(f, "r")
-            nb_blocks = w.getnframes() / 512
-    
-            for i in range(nb_blocks):
-                data = w.readframes(512)
-                output.write(data)
-        
-            w.close()
+        # Write the samples, padded up to their entry
+        for (f, samples, rate, channels), entry in zip(slots, entries):
+            output.write(bytes(entry[0] * 512 - output.tell()))
+            output.write(samples[:entry[1] * 512])
 
     # Print the number of blocks in the partition
-    bytes = os.path.getsize(name)
-    print "Slotfs size: %i blocks" % (bytes / 512)
+    print("Slotfs size: %i blocks" % (os.path.getsize(name) // 512))
+    return entries
 
 
-def build_empty_rw_fs(name, nb_slots, nb_blocks_by_slot, sampling_rate = 0):
+def build_empty_rw_fs(name, nb_slots, nb_blocks_by_slot, sampling_rate = 0, nb_journal_blocks = 8, align_blocks = 1):
     
+    # Slot entries after the journal of the content sizes, for the
+    # recordings in unsigned 8-bit mono
+    entries = []
+    offset = 1 + nb_journal_blocks
+    for i in range(nb_slots):
+        offset = align_up(offset, align_blocks)
+        entries.append((offset, nb_blocks_by_slot, 0, sampling_rate, CODEC_PCM_U8, 1, 0))
+        offset += nb_blocks_by_slot
+
     # Write the output
-    with open(name, "w") as output:
-        print "Writing %s..." % name
+    with open(name, "wb") as output:
+        print("Writing %s..." % name)
 
-        # Write the slotfs header
-        output.write("SLOTFS")
-        output.write(struct.pack("BB", 0, 0)) # Version 0, Read-Write
-        output.write(struct.pack("<H", sampling_rate)) # Sampling rate
-        output.write(struct.pack("<HL", 0, 0)) # Padding
+        output.write(header_sector(0, sampling_rate, nb_journal_blocks, entries, align_blocks))
 
-        # Write the slot entries
-        offset = 1
-        for i in range(nb_slots):
-            output.write(struct.pack("<LHH", offset, nb_blocks_by_slot, sampling_rate)) # Little endian
-            offset += nb_blocks_by_slot
-    
-        # Sector padding
-        pos = output.tell()
-        if pos > 512:
-            raise "Too many slots"
-        else:
-            padding = [0] * (512 - pos)
-            output.write(struct.pack("B" * len(padding), *padding))
-
-        # Slots padding
-        empty_block = struct.pack("B", 0) * 512
-        for i in range(nb_slots):
-            for i in range(nb_blocks_by_slot):
-                output.write(empty_block)
+        # Empty journal and slots
+        output.write(bytes(512 * (offset - 1)))
 
     # Print the number of blocks in the partition
-    bytes = os.path.getsize(name)
-    print "Slotfs size: %i blocks" % (bytes / 512)
+    print("Slotfs size: %i blocks" % (os.path.getsize(name) // 512))
+
+
+def build_dynamic_rw_fs(name, nb_slots, nb_blocks, sampling_rate = 0, nb_journal_blocks = 8, cluster_blocks = 8):
+
+    if nb_slots > MAX_DYNAMIC_SLOTS or nb_journal_blocks == 0:
+        raise ValueError("Up to %i slots and a journal expected" % MAX_DYNAMIC_SLOTS)
+    if nb_blocks > 1 + nb_journal_blocks + MAX_CLUSTERS * cluster_blocks:
+        raise ValueError("More than %i clusters, use larger ones" % MAX_CLUSTERS)
+
+    # Slots without blocks, for the recordings in unsigned 8-bit mono
+    entries = [(0, 0, 0, sampling_rate, CODEC_PCM_U8, 1, 0)] * nb_slots
 
-def build_image(name, partitions):
+    # Write the output
+    with open(name, "wb") as output:
+        print("Writing %s..." % name)
+
+        output.write(header_sector(0, sampling_rate, nb_journal_blocks, entries,
+                                   cluster_blocks, FLAG_DYNAMIC))
+
+        # Empty journal, all the clusters free
+        output.write(bytes(512 * (nb_blocks - 1)))
+
+    # Print the number of blocks in the partition
+    print("Slotfs size: %i blocks, %i clusters" %
+          (os.path.getsize(name) // 512, dynamic_geometry(nb_journal_blocks, cluster_blocks, nb_blocks)[1]))
+
+
+def build_area_fs(name, nb_blocks):
+
+    # Read-write header without slots, then empty blocks
+    with open(name, "wb") as output:
+        print("Writing %s..." % name)
+
+        output.write(header_sector(0, 0, 0, []))
+        output.write(bytes(512 * (nb_blocks - 1)))
+
+    print("Slotfs size: %i blocks" % (os.path.getsize(name) // 512))
+
+
+def dynamic_geometry(nb_journal_blocks, cluster_blocks, nb_blocks):
+    """Offset of the first cluster and number of clusters of a dynamic partition"""
+    first = align_up(1 + nb_journal_blocks, cluster_blocks)
+    return first, min(max(nb_blocks - first, 0) // cluster_blocks, MAX_CLUSTERS)
+
+
+def build_image(name, partitions, align_blocks = 1):
     
     # Compute the size of each partition
     entries = []
     offset = 1 # Start at sector 1
-    for i, f in enumerate(partitions):
-        nb_blocks = os.path.getsize(f) / 512
-        print "%s => offset %i, %i blocks" % (f, offset, nb_blocks)
+    for f in partitions:
+        offset = align_up(offset, align_blocks)
+        nb_blocks = os.path.getsize(f) // 512
+        print("%s => offset %i, %i blocks" % (f, offset, nb_blocks))
     
         entries.append((offset, nb_blocks))
         offset += nb_blocks
 
     # Write the image
-    with open(name, "w") as output:
-        print "Writing %s..." % name
+    with open(name, "wb") as output:
+        print("Writing %s..." % name)
 
-        # Write the partition table header
-        output.write("PARTITIONS")
-        output.write(struct.pack("<HL", 0, 0)) # Padding
+        # Partition table header, with the number of partitions
+        data = b"PARTITIONS" + struct.pack("<HL", len(entries), 0)
 
         # Write the partition table
         for entry in entries:
-            output.write(struct.pack("<LL", *entry)) # Little endian
+            data += struct.pack("<LL", *entry) # Little endian
     
-        # Sector padding
-        pos = output.tell()
-        if pos > 512:
-            raise "Too many partitions"
-        else:
-            padding = [0] * (512 - pos)
-            output.write(struct.pack("B" * len(padding), *padding))
-
-        # Write the partitions
-        for f in partitions:
-            with open(f) as input:
-                nb_blocks = os.path.getsize(f) / 512
-    
-                for i in range(nb_blocks):
-                    data = input.read(512)
-                    output.write(data)
+        if len(data) > 512:
+            raise ValueError("Too many partitions")
+        output.write(data + bytes(512 - len(data)))
+
+        # Write the partitions, padded up to their entry
+        for f, entry in zip(partitions, entries):
+            output.write(bytes(entry[0] * 512 - output.tell()))
+            with open(f, "rb") as input:
+                nb_blocks = os.path.getsize(f) // 512
+                output.write(input.read(nb_blocks * 512))
 
     # Print the number of blocks in the file system image
-    bytes = os.path.getsize(name)
-    print "Image size: %i blocks" % (bytes / 512)
+    print("Image size: %i blocks" % (os.path.getsize(name) // 512))
+    return entries
+
+
+def read_fs(data, nb_blocks=0):
+    """Header fields and slot entries of a partition, as in version 1.
+    The size in blocks locates the clusters of a dynamic partition"""
+    magic, version, read_only, sampling_rate, nb_journal_blocks, nb_slots, flags, align_blocks = \
+        HEADER.unpack_from(data)
+    if magic != b"SLOTFS" or version > VERSION:
+        raise ValueError("Not a slotfs partition")
+
+    slots = []
+    if version == 0:
+        align_blocks = 1
+        flags = 0
+        for i in range((512 - 16) // SLOT_ENTRY_V0.size):
+            offset, max_blocks, content_blocks = SLOT_ENTRY_V0.unpack_from(data, 16 + i * SLOT_ENTRY_V0.size)
+            if offset == 0:
+                break
+            slots.append((offset, max_blocks, content_blocks, 0, CODEC_PCM_U8, 1))
+    else:
+        for i in range(nb_slots):
+            slots.append(SLOT_ENTRY.unpack_from(data, 16 + i * SLOT_ENTRY.size)[:6])
+
+    if flags & FLAG_DYNAMIC and nb_journal_blocks:
+        # Newest extents of the journal
+        slots = slots[:MAX_DYNAMIC_SLOTS]
+        first, nb_clusters = dynamic_geometry(nb_journal_blocks, align_blocks, nb_blocks)
+        extents, _ = read_journal(data, nb_journal_blocks, len(slots), nb_clusters)
+        slots = [(first + e[0] * align_blocks if e[1] else 0, e[1] * align_blocks, e[2]) + s[3:]
+                 for s, e in zip(slots, extents)]
+    else:
+        # Newest content sizes of the journal
+        sizes = read_journal(data, nb_journal_blocks, len(slots))
+        if sizes:
+            slots = [s[:2] + (size,) + s[3:] for s, size in zip(slots, sizes)]
+
+    # Rate of the partition for the slots without one
+    slots = [s[:3] + (s[3] or sampling_rate or 8000,) + s[4:] for s in slots]
+    return version, read_only, nb_journal_blocks, align_blocks, slots
+
+
+def read_journal(data, nb_journal_blocks, nb_slots, nb_clusters=None):
+    """Content sizes of the newest valid journal entry, None without one.
+    With a number of clusters, the extents and the bitmap of a dynamic
+    partition, all free without entry"""
+    newest, sizes = 0, None
+    nb_slots = min(nb_slots, (512 - 16) // SLOT_ENTRY.size)
+    size = JOURNAL_ENTRY.size + 2 * nb_slots
+    if nb_clusters is not None:
+        size = JOURNAL_ENTRY.size + EXTENT.size * nb_slots + (nb_clusters + 7) // 8
+        sizes = [(0, 0, 0)] * nb_slots, bytes((nb_clusters + 7) // 8)
+
+    for i in range(nb_journal_blocks):
+        entry = bytearray(data[(1 + i) * 512:(1 + i) * 512 + size])
+        if len(entry) < size:
+            break
+        magic, seq, entry_slots, check = JOURNAL_ENTRY.unpack_from(entry)
+        entry[JOURNAL_ENTRY.size - 1] = 0
+        if (magic == b"SJNL" and entry_slots == nb_slots and check == ~sum(entry) & 0xFF and
+                seq % nb_journal_blocks == i and seq > newest):
+            newest = seq
+            if nb_clusters is None:
+                sizes = struct.unpack_from("<%iH" % nb_slots, entry, JOURNAL_ENTRY.size)
+            else:
+                bitmap = JOURNAL_ENTRY.size + EXTENT.size * nb_slots
+                sizes = ([EXTENT.unpack_from(entry, JOURNAL_ENTRY.size + j * EXTENT.size) for j in range(nb_slots)],
+                         bytes(entry[bitmap:]))
+
+    return sizes
+
+
+def list_image(name):
+    with open(name, "rb") as f:
+        data = f.read()
+
+    if data.startswith(b"PARTITIONS"):
+        nb_partitions = struct.unpack_from("<H", data, 10)[0] or (512 - 16) // 8
+        starts = []
+        for i in range(nb_partitions):
+            start, nb_blocks = struct.unpack_from("<LL", data, 16 + i * 8)
+            if start == 0:
+                break
+            starts.append((start, nb_blocks))
+    else:
+        starts = [(0, len(data) // 512)]
+
+    for i, (start, nb_blocks) in enumerate(starts):
+        version, read_only, nb_journal_blocks, align_blocks, slots = read_fs(data[start * 512:], nb_blocks)
+        print("Partition %i: start %i, version %i, %s, %i journal blocks, alignment %i" %
+              (i, start, version, "read-only" if read_only else "read-write", nb_journal_blocks, align_blocks))
+        for j, (offset, max_blocks, content_blocks, rate, codec, channels) in enumerate(slots):
+            print("  Slot %02i: %5i %4i/%-4i %5i Hz codec %i, %i channel(s)" %
+                  (j, start + offset, content_blocks, max_blocks, rate, codec, channels))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    list_image(sys.argv[1])
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+
+"""Write a new card image over an SD card, only the sectors which changed.
+
+The sectors of the image are compared with the card, or with the state
+file of the last image written to it, by hashes of 8 bytes. The changed
+sectors are gathered in runs, the runs closer than the gap merged (writing
+a few unchanged sectors is cheaper than a new write command) and written
+in sequential writes of up to the maximum size. The target may be a
+device or an image file.
+
+  cardpatch.py hash babyphone.image               write babyphone.sectors,
+                                                  the hashes of the sectors
+  cardpatch.py write babyphone.image /dev/sdx     compare with the card
+  cardpatch.py write -s card.sectors babyphone.image /dev/sdx
+                                                  compare with the state of
+                                                  the last write, without
+                                                  reading the card
+
+The state is only written after a complete write. With a state, the
+sectors written on the card since, like the recordings, are left as they
+are unless they also changed in the image; comparing with the card
+restores the image there.
+
+Hash file: "SECTHASH", <L version, <L number of sectors, then 8 bytes of
+BLAKE2b per sector.
+"""
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import time
+
+SECTOR_SIZE = 512
+DIGEST_SIZE = 8
+HASH_MAGIC = b"SECTHASH"
+HASH_HEADER = struct.Struct("<8sLL")
+HASH_VERSION = 1
+READ_SIZE = 2048 * SECTOR_SIZE
+
+
+def sector_hashes(data):
+    """Hashes of the sectors of a buffer, concatenated"""
+    return b"".join(hashlib.blake2b(data[i:i + SECTOR_SIZE], digest_size=DIGEST_SIZE).digest()
+                    for i in range(0, len(data), SECTOR_SIZE))
+
+
+def read_hashes(name):
+    with open(name, "rb") as f:
+        data = f.read()
+    magic, version, nb_sectors = HASH_HEADER.unpack_from(data)
+    hashes = data[HASH_HEADER.size:]
+    if magic != HASH_MAGIC or version != HASH_VERSION or len(hashes) != nb_sectors * DIGEST_SIZE:
+        raise ValueError("%s: not a sector hash file" % name)
+    return hashes
+
+
+def write_hashes(name, hashes):
+    with open(name + ".tmp", "wb") as f:
+        f.write(HASH_HEADER.pack(HASH_MAGIC, HASH_VERSION, len(hashes) // DIGEST_SIZE))
+        f.write(hashes)
+    os.replace(name + ".tmp", name)
+
+
+def target_hashes(name, nb_sectors):
+    """Hashes of the first sectors of the target, short if it is smaller"""
+    hashes = []
+    if not os.path.exists(name):
+        return b""
+    with open(name, "rb") as f:
+        remaining = nb_sectors * SECTOR_SIZE
+        while remaining:
+            data = f.read(min(READ_SIZE, remaining))
+            if not data:
+                break
+            hashes.append(sector_hashes(data[:len(data) // SECTOR_SIZE * SECTOR_SIZE]))
+            remaining -= len(data)
+    return b"".join(hashes)
+
+
+def changed_runs(new, old, gap, max_sectors):
+    """(first sector, number of sectors) of the writes"""
+    runs = []
+    for sector in range(len(new) // DIGEST_SIZE):
+        i = sector * DIGEST_SIZE
+        if new[i:i + DIGEST_SIZE] == old[i:i + DIGEST_SIZE]:
+            continue
+        if runs and sector - (runs[-1][0] + runs[-1][1]) <= gap:
+            runs[-1][1] = sector + 1 - runs[-1][0]
+        else:
+            runs.append([sector, 1])
+
+    # Split the long runs
+    writes = []
+    for first, count in runs:
+        for start in range(first, first + count, max_sectors):
+            writes.append((start, min(max_sectors, first + count - start)))
+    return writes
+
+
+def cmd_hash(args):
+    output = args.output or os.path.splitext(args.image)[0] + ".sectors"
+    with open(args.image, "rb") as f:
+        hashes = sector_hashes(f.read())
+    write_hashes(output, hashes)
+    print("%s: %i sectors" % (output, len(hashes) // DIGEST_SIZE))
+
+
+def cmd_write(args):
+    start_time = time.time()
+    with open(args.image, "rb") as f:
+        image = f.read()
+    nb_sectors = len(image) // SECTOR_SIZE
+
+    # New hashes: from the build when they match the image size
+    new = None
+    if args.hashes:
+        new = read_hashes(args.hashes)
+        if len(new) != nb_sectors * DIGEST_SIZE:
+            sys.exit("%s: %i sectors expected" % (args.hashes, nb_sectors))
+    if new is None:
+        new = sector_hashes(image[:nb_sectors * SECTOR_SIZE])
+
+    # Old hashes: the state of the last write, or the target itself
+    if args.state and os.path.exists(args.state):
+        old = read_hashes(args.state)
+        source = args.state
+    else:
+        old = target_hashes(args.target, nb_sectors)
+        source = args.target
+
+    writes = changed_runs(new, old, args.gap, args.max_write)
+    changed = sum(1 for i in range(0, len(new), DIGEST_SIZE) if new[i:i + DIGEST_SIZE] != old[i:i + DIGEST_SIZE])
+    written = sum(count for _, count in writes)
+    print("%i of %i sectors changed against %s, %i writes of %i sectors" %
+          (changed, nb_sectors, source, len(writes), written))
+
+    if args.dry_run:
+        for first, count in writes:
+            print("  %8i +%i" % (first, count))
+        return
+
+    # Sequential writes, synced before the state is saved
+    fd = os.open(args.target, os.O_RDWR | os.O_CREAT, 0o644)
+    try:
+        for first, count in writes:
+            data = image[first * SECTOR_SIZE:(first + count) * SECTOR_SIZE]
+            if os.pwrite(fd, data, first * SECTOR_SIZE) != len(data):
+                sys.exit("%s: short write at sector %i" % (args.target, first))
+        os.fsync(fd)
+
+        if args.verify:
+            for first, count in writes:
+                data = image[first * SECTOR_SIZE:(first + count) * SECTOR_SIZE]
+                if os.pread(fd, len(data), first * SECTOR_SIZE) != data:
+                    sys.exit("%s: verify failed at sector %i" % (args.target, first))
+    finally:
+        os.close(fd)
+
+    if args.state:
+        write_hashes(args.state, new)
+
+    print("%i bytes written in %.2f s" % (written * SECTOR_SIZE, time.time() - start_time))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    p = commands.add_parser('hash', help='write the hashes of the sectors of an image')
+    p.add_argument('image')
+    p.add_argument('-o', '--output', help='hash file (default: <image>.sectors)')
+    p.set_defaults(func=cmd_hash)
+
+    p = commands.add_parser('write', help='write the changed sectors of an image')
+    p.add_argument('image')
+    p.add_argument('target', help='device or image file')
+    p.add_argument('-H', '--hashes', help='hashes of the image from its build')
+    p.add_argument('-s', '--state', help='hashes of the last image written to the target, updated')
+    p.add_argument('-g', '--gap', type=int, default=32,
+                   help='unchanged sectors written to merge two runs (default 32)')
+    p.add_argument('-m', '--max-write', type=int, default=8192,
+                   help='sectors of a write (default 8192, 4 MB)')
+    p.add_argument('-n', '--dry-run', action='store_true', help='list the writes only')
+    p.add_argument('-v', '--verify', action='store_true', help='read back the written sectors')
+    p.set_defaults(func=cmd_write)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == '__main__':
+    main()
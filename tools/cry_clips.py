@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+
+"""Write the labelled clips of the cry detector benchmark.
+
+Synthetic 8 kHz 8-bit clips, named after their label: cry_*.wav hold a
+cry, none_*.wav hold sounds which must not be taken for one. The cries
+are bursts of a harmonic voice with a 300-600 Hz fundamental, separated
+by breaths. Recordings of real cries can be added to the same directory
+with the same naming.
+
+  cry_clips.py clips/
+  host/cry_bench clips/*.wav
+"""
+
+import argparse
+import math
+import os
+import random
+import wave
+
+SAMPLING_RATE = 8000
+
+
+class Clip:
+    def __init__(self, seconds, noise=0.01):
+        self.samples = [random.gauss(0.0, noise) for _ in range(int(seconds * SAMPLING_RATE))]
+
+    def add_voice(self, start, duration, f0, amplitude, harmonics=8, contour=0.15, vibrato=0.02):
+        """Harmonic voice, the pitch rises and falls by contour over the burst"""
+        begin = int(start * SAMPLING_RATE)
+        length = int(duration * SAMPLING_RATE)
+        phase = 0.0
+        for n in range(length):
+            if begin + n >= len(self.samples):
+                break
+            t = n / float(length)
+            f = f0 * (1.0 + contour * math.sin(math.pi * t)
+                      + vibrato * math.sin(2 * math.pi * 6.0 * n / SAMPLING_RATE))
+            phase += 2 * math.pi * f / SAMPLING_RATE
+            envelope = min(1.0, n / 400.0, (length - n) / 400.0)
+            value = 0.0
+            for h in range(1, harmonics + 1):
+                if h * f < SAMPLING_RATE / 2:
+                    value += math.sin(h * phase) / h
+            self.samples[begin + n] += amplitude * envelope * value
+
+    def add_noise(self, start, duration, amplitude):
+        begin = int(start * SAMPLING_RATE)
+        for n in range(int(duration * SAMPLING_RATE)):
+            if begin + n < len(self.samples):
+                self.samples[begin + n] += random.gauss(0.0, amplitude)
+
+    def add_tone(self, start, duration, frequency, amplitude):
+        begin = int(start * SAMPLING_RATE)
+        for n in range(int(duration * SAMPLING_RATE)):
+            if begin + n < len(self.samples):
+                self.samples[begin + n] += amplitude * math.sin(2 * math.pi * frequency * n / SAMPLING_RATE)
+
+    def add_hum(self, frequency, amplitude):
+        for n in range(len(self.samples)):
+            self.samples[n] += amplitude * math.sin(2 * math.pi * frequency * n / SAMPLING_RATE)
+
+    def save(self, path):
+        data = bytearray(max(0, min(255, int(round(128 + 127 * s)))) for s in self.samples)
+        with wave.open(path, 'wb') as w:
+            w.setnchannels(1)
+            w.setsampwidth(1)
+            w.setframerate(SAMPLING_RATE)
+            w.writeframes(bytes(data))
+
+
+def cry(f0, amplitude, burst, pause, noise=0.01, start=1.0, seconds=12.0):
+    clip = Clip(seconds, noise)
+    t = start
+    while t + burst < seconds:
+        clip.add_voice(t, burst * random.uniform(0.8, 1.2), f0 * random.uniform(0.9, 1.1), amplitude)
+        t += burst + pause
+        clip.add_noise(t - pause * 0.8, pause * 0.6, amplitude * 0.1)
+    return clip
+
+
+def speech(f0, amplitude, seconds=12.0):
+    """Syllables of 100-250 ms with short pauses, in sentences"""
+    clip = Clip(seconds)
+    t = 0.5
+    while t < seconds - 1.0:
+        for _ in range(random.randint(4, 10)):
+            duration = random.uniform(0.1, 0.25)
+            clip.add_voice(t, duration, f0 * random.uniform(0.85, 1.2), amplitude, contour=-0.1)
+            t += duration + random.uniform(0.02, 0.08)
+        t += random.uniform(0.4, 1.0)
+    return clip
+
+
+def beeps(frequency, on, off, amplitude=0.4, seconds=12.0):
+    clip = Clip(seconds)
+    t = 1.0
+    while t < seconds:
+        clip.add_tone(t, on, frequency, amplitude)
+        t += on + off
+    return clip
+
+
+CLIPS = {
+    'cry_loud':       lambda: cry(450, 0.4, 1.0, 0.4),
+    'cry_high':       lambda: cry(520, 0.3, 0.7, 0.3),
+    'cry_low':        lambda: cry(340, 0.3, 1.2, 0.5),
+    'cry_far':        lambda: cry(480, 0.08, 1.0, 0.4, noise=0.01),
+    'cry_fan':        lambda: cry(420, 0.25, 0.9, 0.4, noise=0.06),
+    'none_silence':   lambda: Clip(12.0),
+    'none_fan':       lambda: Clip(12.0, noise=0.08),
+    'none_tone':      lambda: beeps(440, 10.0, 0.0),
+    'none_alarm':     lambda: beeps(500, 0.2, 0.2),
+    'none_microwave': lambda: beeps(400, 1.0, 1.0, seconds=8.0),
+    'none_man':       lambda: speech(110, 0.4),
+    'none_woman':     lambda: speech(210, 0.4),
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('directory', help='output directory')
+    parser.add_argument('-s', '--seed', type=int, default=1, help='random seed')
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    os.makedirs(args.directory, exist_ok=True)
+
+    for name, make in sorted(CLIPS.items()):
+        make().save(os.path.join(args.directory, name + '.wav'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+"""Decode the live microphone stream of the shell "monitor" command.
+
+The frames of audio/monitor.c carry a capture buffer of the shell, 256 IMA
+ADPCM samples at 8000 Hz.
+Text around them, like the shell prompt, goes to stderr. Lost frames are
+reported from the sequence numbers and the drop counter of the target.
+
+  monitor.py /dev/ttyUSB0 -o baby.wav             record to a WAV file
+  monitor.py /dev/ttyUSB0 | aplay -f S16_LE -r 8000
+                                                  listen, raw samples on stdout
+  ./sim_shell -a in.wav -e "500 serial monitor" | monitor.py - -o out.wav
+"""
+
+import argparse
+import struct
+import sys
+import wave
+
+SYNC = b'\x5a\xa5'
+HEADER_SIZE = 8
+DATA_SIZE = 128
+FRAME_SIZE = HEADER_SIZE + DATA_SIZE + 2
+SAMPLING_RATE = 8000
+
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8]
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+
+
+def crc16(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+
+def adpcm_decode(data, predictor, index):
+    samples = bytearray()
+    for byte in data:
+        for code in (byte & 0x0F, byte >> 4):
+            step = STEP_TABLE[index]
+            delta = step >> 3
+            if code & 4:
+                delta += step
+            if code & 2:
+                delta += step >> 1
+            if code & 1:
+                delta += step >> 2
+            predictor += -delta if code & 8 else delta
+            predictor = max(-32768, min(32767, predictor))
+            index = max(0, min(88, index + INDEX_TABLE[code & 7]))
+            samples += struct.pack('<h', predictor)
+    return bytes(samples)
+
+
+def open_input(name, baudrate):
+    if name == '-':
+        return sys.stdin.buffer
+    if name.startswith('/dev/'):
+        import serial
+        return serial.Serial(name, baudrate)
+    return open(name, 'rb')
+
+
+class Stream:
+    def __init__(self, out):
+        self.out = out
+        self.seq = None
+        self.drops = 0
+        self.frames = 0
+        self.lost = 0
+        self.errors = 0
+
+    def frame(self, data):
+        seq, drops, predictor, index = struct.unpack('<BHhB', data[2:HEADER_SIZE])
+        if crc16(data[2:FRAME_SIZE - 2]) != struct.unpack('>H', data[FRAME_SIZE - 2:])[0]:
+            self.errors += 1
+            return False
+
+        if self.seq is not None:
+            gap = (seq - self.seq - 1) & 0xFF
+            if gap:
+                self.lost += gap
+                # Keep the timing: silence for the missing frames
+                self.out(b'\x00\x00' * DATA_SIZE * 2 * gap)
+        if drops != self.drops:
+            sys.stderr.write('target dropped %u frames\n' % (drops - self.drops))
+        self.seq, self.drops = seq, drops
+        self.frames += 1
+
+        self.out(adpcm_decode(data[HEADER_SIZE:HEADER_SIZE + DATA_SIZE], predictor, index))
+        return True
+
+    def feed(self, stream):
+        pending = bytearray()
+
+        while True:
+            chunk = stream.read1(4096) if hasattr(stream, 'read1') else stream.read(1)
+            if not chunk:
+                break
+            pending += chunk
+
+            while True:
+                start = pending.find(SYNC)
+                if start < 0:
+                    # Text, keep a byte which may start a sync
+                    keep = 1 if pending.endswith(SYNC[:1]) else 0
+                    sys.stderr.write(pending[:len(pending) - keep].decode('latin-1'))
+                    del pending[:len(pending) - keep]
+                    break
+
+                sys.stderr.write(pending[:start].decode('latin-1'))
+                del pending[:start]
+                if len(pending) < FRAME_SIZE:
+                    break
+
+                if self.frame(bytes(pending[:FRAME_SIZE])):
+                    del pending[:FRAME_SIZE]
+                else:
+                    # False sync, look for the next one
+                    del pending[:1]
+
+        sys.stderr.write(pending.decode('latin-1'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='serial port, capture file or - for stdin')
+    parser.add_argument('-b', '--baudrate', type=int, default=500000)
+    parser.add_argument('-o', '--output', help='WAV file, raw 16-bit samples on stdout otherwise')
+    args = parser.parse_args()
+
+    if args.output:
+        wav = wave.open(args.output, 'wb')
+        wav.setnchannels(1)
+        wav.setsampwidth(2)
+        wav.setframerate(SAMPLING_RATE)
+        out = wav.writeframes
+    else:
+        wav = None
+        out = lambda samples: (sys.stdout.buffer.write(samples), sys.stdout.buffer.flush())
+
+    stream = Stream(out)
+    try:
+        stream.feed(open_input(args.input, args.baudrate))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if wav:
+            wav.close()
+        sys.stderr.write('%u frames, %u lost, %u corrupted\n' % (stream.frames, stream.lost, stream.errors))
+
+
+if __name__ == '__main__':
+    main()
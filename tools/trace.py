@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+"""Decode the trace records of utils/trace.c mixed with the text output.
+
+The event messages are read from utils/trace_events.h. Timestamps are
+Timer1 ticks; they are unwrapped assuming that two consecutive records are
+less than one timer period apart.
+
+  trace.py /dev/ttyUSB0                 read a serial port (needs pyserial)
+  trace.py log.bin                      decode a capture
+  ./sim_babyphone ... | trace.py -      decode the host simulator output
+"""
+
+import argparse
+import os
+import re
+import sys
+
+TRACE_SYNC = 0xA5
+RECORD_SIZE = 6
+
+EVENTS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        '..', 'utils', 'trace_events.h')
+
+
+def load_events(path):
+    events = []
+    with open(path) as f:
+        for name, message in re.findall(r'^TRACE_EVENT\((\w+),\s*"(.*)"\)',
+                                        f.read(), re.MULTILINE):
+            events.append((name, message))
+    return events
+
+
+def open_input(name, baudrate):
+    if name == '-':
+        return sys.stdin.buffer
+    if name.startswith('/dev/'):
+        import serial
+        return serial.Serial(name, baudrate)
+    return open(name, 'rb')
+
+
+class Decoder:
+    def __init__(self, events, tick_us):
+        self.events = events
+        self.tick_us = tick_us
+        self.last = None
+        self.time = 0
+        self.text = bytearray()
+
+    def timestamp(self, ticks):
+        if self.last is not None:
+            self.time += (ticks - self.last) & 0xFFFF
+        self.last = ticks
+        return self.time * self.tick_us / 1000.0
+
+    def record(self, data):
+        event, ticks, arg = data[1], data[2] | data[3] << 8, data[4] | data[5] << 8
+        ms = self.timestamp(ticks)
+
+        if event < len(self.events):
+            name, message = self.events[event]
+            text = message.format(arg=arg, hi=arg >> 8, lo=arg & 0xFF)
+        else:
+            name, text = 'UNKNOWN', 'event %u arg 0x%04x' % (event, arg)
+
+        return '%10.3f ms  %-16s %s' % (ms, name, text)
+
+    def flush_text(self, out):
+        if self.text:
+            out.write(self.text.decode('latin-1'))
+            self.text = bytearray()
+
+    def feed(self, stream, out):
+        pending = bytearray()
+
+        while True:
+            chunk = stream.read1(4096) if hasattr(stream, 'read1') else stream.read(1)
+            if not chunk:
+                break
+            pending += chunk
+
+            while pending:
+                if pending[0] != TRACE_SYNC:
+                    self.text.append(pending.pop(0))
+                    if self.text.endswith(b'\n'):
+                        self.flush_text(out)
+                    continue
+
+                if len(pending) < RECORD_SIZE:
+                    break
+
+                # A record interrupts the text line, keep them apart
+                if self.text:
+                    self.text.append(ord('\n'))
+                    self.flush_text(out)
+
+                out.write(self.record(pending[:RECORD_SIZE]) + '\n')
+                del pending[:RECORD_SIZE]
+
+            out.flush()
+
+        self.flush_text(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='serial port, capture file or - for stdin')
+    parser.add_argument('-b', '--baudrate', type=int, default=38400)
+    parser.add_argument('-t', '--tick-us', type=float, default=16.0,
+                        help='Timer1 tick in us (16 in the babyphone, 4 in the shell)')
+    parser.add_argument('-e', '--events', default=EVENTS_H,
+                        help='trace_events.h of the firmware')
+    args = parser.parse_args()
+
+    decoder = Decoder(load_events(args.events), args.tick_us)
+
+    try:
+        decoder.feed(open_input(args.input, args.baudrate), sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
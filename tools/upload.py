@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+#
+# Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+#
+# Permission to use, copy, modify, and distribute this software
+# and its documentation for any purpose and without fee is hereby
+# granted, provided that the above copyright notice appear in all
+# copies and that both that the copyright notice and this
+# permission notice and warranty disclaimer appear in supporting
+# documentation, and that the name of the author not be used in
+# advertising or publicity pertaining to distribution of the
+# software without specific, written prior permission.
+#
+# The author disclaim all warranties with regard to this
+# software, including all implied warranties of merchantability
+# and fitness.  In no event shall the author be liable for any
+# special, indirect or consequential damages or any damages
+# whatsoever resulting from loss of use, data or profits, whether
+# in an action of contract, negligence or other tortious action,
+# arising out of or in connection with the use or performance of
+# this software.
+
+"""Upload a sound into a slot through the shell, without pulling the card.
+
+The sound is a WAV file (8-bit mono, at the sampling rate of the slot)
+or raw unsigned 8-bit samples. It is sent in frames of one SD block, see
+apps/shell/upload.c for the protocol.
+
+  upload.py /dev/ttyUSB0 1 3 hello.wav      replace slot 3 of partition 1
+  upload.py -o frames.bin hello.wav         write the frames for a "send"
+                                            event of the host simulator
+"""
+
+import argparse
+import struct
+import sys
+import time
+import wave
+
+BLOCK_SIZE = 512
+WINDOW = 2
+TIMEOUT = 1.0
+MAX_RETRIES = 10
+
+STX, EOT, ACK, NAK, CAN = 0x02, 0x04, 0x06, 0x15, 0x18
+
+
+def crc16(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+
+def load_samples(name):
+    try:
+        with wave.open(name, 'rb') as wav:
+            if wav.getsampwidth() != 1 or wav.getnchannels() != 1:
+                sys.exit('%s: 8-bit mono WAV expected' % name)
+            print('%s: %u Hz, %u samples' % (name, wav.getframerate(), wav.getnframes()))
+            return wav.readframes(wav.getnframes())
+    except wave.Error:
+        with open(name, 'rb') as f:
+            return f.read()
+
+
+def make_frames(samples):
+    # Pad the last block with silence
+    if len(samples) % BLOCK_SIZE:
+        samples += b'\x80' * (BLOCK_SIZE - len(samples) % BLOCK_SIZE)
+
+    frames = []
+    for i in range(0, len(samples), BLOCK_SIZE):
+        seq = (i // BLOCK_SIZE) & 0xFF
+        data = samples[i:i + BLOCK_SIZE]
+        frames.append(bytes([STX, seq, seq ^ 0xFF]) + data + struct.pack('>H', crc16(data)))
+    return frames
+
+
+def read_line(port):
+    line = port.readline()
+    if not line:
+        sys.exit('no answer from the shell')
+    return line.decode('latin-1').strip()
+
+
+def upload(port, partition, slot, frames):
+    port.reset_input_buffer()
+    port.write(b'upload %u %u %u\r' % (partition, slot, len(frames)))
+
+    while True:
+        line = read_line(port)
+        if line.startswith('Upload ready'):
+            max_blocks = int(line.split()[2])
+            break
+        if line.startswith(('No blocks', 'Write error', 'unknown command')):
+            sys.exit(line)
+
+    if len(frames) > max_blocks:
+        port.write(bytes([CAN]))
+        sys.exit('%u blocks, the slot holds %u' % (len(frames), max_blocks))
+
+    start = time.monotonic()
+    base = sent = 0
+    resent = retries = 0
+    reply = b''
+    deadline = start + TIMEOUT
+
+    while base < len(frames):
+        while sent < len(frames) and sent - base < WINDOW:
+            port.write(frames[sent])
+            sent += 1
+
+        reply += port.read(2 - len(reply))
+        if len(reply) < 2:
+            if time.monotonic() < deadline:
+                continue
+            code = None
+        else:
+            code, seq = reply
+            reply = b''
+
+        if code == ACK:
+            # Acknowledges every frame up to seq. Sequence numbers wrap at
+            # 256, the window keeps them apart
+            acked = (seq - base) & 0xFF
+            if acked < sent - base:
+                base += acked + 1
+                retries = 0
+                deadline = time.monotonic() + TIMEOUT
+        elif code in (None, NAK):
+            # Go back to the oldest frame not acknowledged, after a timeout
+            # or a corrupted frame
+            retries += 1
+            if retries > MAX_RETRIES:
+                port.write(bytes([CAN]))
+                sys.exit('no progress after %u retries, %u blocks sent' % (MAX_RETRIES, base))
+            resent += sent - base
+            sent = base
+            deadline = time.monotonic() + TIMEOUT
+        elif code == CAN:
+            sys.exit('upload aborted by the target after %u blocks' % base)
+
+    port.write(bytes([EOT]))
+    reply = port.read(2)
+    if len(reply) < 2 or reply[0] != ACK:
+        sys.exit('end of upload not acknowledged')
+
+    elapsed = time.monotonic() - start
+    print(read_line(port))
+    print('%u bytes in %.2f s, %.1f kB/s, %u frames sent again' % (
+        len(frames) * BLOCK_SIZE, elapsed, len(frames) * BLOCK_SIZE / elapsed / 1000, resent))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('args', nargs='+', metavar='port partition slot file',
+                        help='serial port, partition and slot numbers, and the sound')
+    parser.add_argument('-b', '--baudrate', type=int, default=500000)
+    parser.add_argument('-o', '--output', help='write the frames followed by EOT to a file')
+    args = parser.parse_args()
+
+    frames = make_frames(load_samples(args.args[-1]))
+
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(b''.join(frames) + bytes([EOT]))
+        return
+
+    if len(args.args) != 4:
+        parser.error('port, partition, slot and file expected')
+
+    import serial
+    port = serial.Serial(args.args[0], args.baudrate, timeout=0.1)
+    upload(port, int(args.args[1]), int(args.args[2]), frames)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,184 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/*****************************************************************************
+* Runtime statistics
+*
+* Always-on counters of the audio pipeline: DAC underruns, ADC overruns,
+* duration of the sample and buffer refill interrupts and latency of the SD
+* card accesses.
+*
+* Timestamps come from Timer1. When nothing else uses it, it is started
+* free running at Fclk/64 (4us, wraps after 262ms). The babyphone keyboard
+* polling runs it free at Fclk/256 (16us, wraps after 1s). A timer in CTC
+* mode wraps at OCR1A.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "stats.h"
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+static const uint16_t sd_latency_bounds[STATS_SD_NB_BUCKETS - 1] PROGMEM =
+{
+  128, 512, 2048, 8192,
+};
+
+/* Timer1 prescaler of each clock select */
+static const uint16_t timer1_dividers[8] PROGMEM =
+{
+  0, 1, 8, 64, 256, 1024, 0, 0,
+};
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+volatile t_stats stats;
+
+static struct {
+  uint16_t divider; /* Timer1 prescaler */
+  uint16_t sd_latency_bounds[STATS_SD_NB_BUCKETS - 1]; /* in Timer1 ticks */
+} stats_ctx;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void stats_init(void)
+{
+  uint8_t i;
+  
+  /* Start Timer1 free running if it is not used */
+  if ((TCCR1B & 0x07) == 0)
+  {
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11) | _BV(CS10); /* Fclk / 64 */
+  }
+  
+  stats_ctx.divider = pgm_read_word(&timer1_dividers[TCCR1B & 0x07]);
+  if (stats_ctx.divider == 0)
+    stats_ctx.divider = 1;
+  
+  /* Convert the latency buckets to timer ticks once */
+  for(i = 0; i < STATS_SD_NB_BUCKETS - 1; i++)
+  {
+    uint32_t us = pgm_read_word(&sd_latency_bounds[i]);
+    stats_ctx.sd_latency_bounds[i] = (uint16_t)(us * (F_CPU / 1000000UL) / stats_ctx.divider);
+  }
+  
+  stats_reset();
+}
+
+/* The counters are updated from the interrupts: the main loop only reads
+   and clears them with the interrupts disabled */
+void stats_reset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset((void*)&stats, 0, sizeof(stats));
+  }
+}
+
+static uint32_t ticks_to_us(uint32_t ticks)
+{
+  return ticks * stats_ctx.divider / (F_CPU / 1000000UL);
+}
+
+void stats_print(void)
+{
+  t_stats s;
+  uint8_t i;
+  
+  /* Take a consistent copy */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memcpy(&s, (void*)&stats, sizeof(s));
+  }
+  
+  printf_P(PSTR("DAC underruns = %u\r\n"), s.dac_underruns);
+  printf_P(PSTR("ADC overruns = %u\r\n"), s.adc_overruns);
+  printf_P(PSTR("Sample ISR max = %u us\r\n"), (s.sample_isr_max + 1) / 2);
+  printf_P(PSTR("Refills = %u\r\n"), s.refills);
+  printf_P(PSTR("Refill avg = %lu us\r\n"), s.refills ? ticks_to_us(s.refill_total / s.refills) : 0);
+  printf_P(PSTR("Refill max = %lu us\r\n"), ticks_to_us(s.refill_max));
+  
+  printf_P(PSTR("SD latency:"));
+  for(i = 0; i < STATS_SD_NB_BUCKETS - 1; i++)
+    printf_P(PSTR(" <%uus %u,"), pgm_read_word(&sd_latency_bounds[i]), s.sd_latency[i]);
+  printf_P(PSTR(" more %u\r\n"), s.sd_latency[STATS_SD_NB_BUCKETS - 1]);
+}
+
+uint16_t stats_timestamp(void)
+{
+  return TCNT1;
+}
+
+uint16_t stats_elapsed(uint16_t start)
+{
+  uint16_t now = TCNT1;
+  
+  /* In CTC mode the timer wraps at OCR1A */
+  if ((TCCR1B & _BV(WGM12)) && (now < start))
+    return now + (OCR1A + 1) - start;
+  
+  return now - start;
+}
+
+void stats_add_refill(uint16_t start)
+{
+  uint16_t elapsed = stats_elapsed(start);
+  
+  stats.refills++;
+  stats.refill_total += elapsed;
+  if (elapsed > stats.refill_max)
+    stats.refill_max = elapsed;
+}
+
+void stats_add_sd_latency(uint16_t start)
+{
+  uint16_t elapsed = stats_elapsed(start);
+  uint8_t i;
+  
+  for(i = 0; i < STATS_SD_NB_BUCKETS - 1; i++)
+  {
+    if (elapsed < stats_ctx.sd_latency_bounds[i])
+      break;
+  }
+  
+  /* Also called from the main loop, the refill interrupt accesses the card
+     too */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    stats.sd_latency[i]++;
+  }
+}
@@ -0,0 +1,61 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef STATS_H
+#define STATS_H
+
+/* SD card latency buckets, upper bounds in us */
+enum {
+  STATS_SD_LATENCY_128US,
+  STATS_SD_LATENCY_512US,
+  STATS_SD_LATENCY_2MS,
+  STATS_SD_LATENCY_8MS,
+  STATS_SD_LATENCY_ABOVE,
+  STATS_SD_NB_BUCKETS,
+};
+
+/* Runtime counters, updated from the interrupts. Durations are timer ticks:
+   Timer0 (0.5us, from the sample tick, within one sample period) for the
+   sample interrupt, Timer1 for the others. */
+typedef struct {
+  uint16_t dac_underruns;
+  uint16_t adc_overruns;
+  uint8_t sample_isr_max;
+  uint16_t refills;
+  uint32_t refill_total;
+  uint16_t refill_max;
+  uint16_t sd_latency[STATS_SD_NB_BUCKETS];
+} t_stats;
+
+extern volatile t_stats stats;
+
+void stats_init(void);
+void stats_reset(void);
+void stats_print(void);
+
+uint16_t stats_timestamp(void);
+uint16_t stats_elapsed(uint16_t start);
+void stats_add_refill(uint16_t start);
+void stats_add_sd_latency(uint16_t start);
+
+#endif /* STATS_H */
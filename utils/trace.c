@@ -0,0 +1,151 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/*****************************************************************************
+* Deferred trace log
+*
+* trace() stores a small binary record (event id, Timer1 timestamp, 16-bit
+* argument) in a RAM ring, which is cheap enough for the interrupts.
+* trace_flush() sends the records to stdout from the main loop, when
+* blocking on the UART does not matter. Records which do not fit in the ring
+* are counted and reported by a TRACE_OVERFLOW record.
+*
+* Wire format: TRACE_SYNC, id, timestamp (LE16), argument (LE16).
+* tools/trace.py decodes it.
+*
+* Compiled in only when TRACE_ENABLE is 1, see trace.h.
+******************************************************************************/
+
+/*****************************************************************************
+* Includes
+******************************************************************************/
+#include <stdio.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "trace.h"
+#include "stats.h"
+
+#if (TRACE_ENABLE == 1)
+
+/*****************************************************************************
+* Constants
+******************************************************************************/
+#ifndef TRACE_SIZE
+#define TRACE_SIZE (16) /* Records, power of 2 */
+#endif
+
+/*****************************************************************************
+* Definitions
+******************************************************************************/
+typedef struct {
+  uint8_t id;
+  uint16_t timestamp;
+  uint16_t arg;
+} t_trace_record;
+
+/*****************************************************************************
+* Globals
+******************************************************************************/
+static volatile struct {
+  t_trace_record records[TRACE_SIZE];
+  uint8_t head;
+  uint8_t tail;
+  uint8_t lost;
+} trace_ctx;
+
+/*****************************************************************************
+* Functions
+******************************************************************************/
+
+void trace(uint8_t id, uint16_t arg)
+{
+  uint8_t sreg = SREG;
+  
+  cli();
+  
+  if ((uint8_t)(trace_ctx.head - trace_ctx.tail) >= TRACE_SIZE)
+  {
+    if (trace_ctx.lost < 0xFF)
+      trace_ctx.lost++;
+  }
+  else
+  {
+    volatile t_trace_record* record = &trace_ctx.records[trace_ctx.head & (TRACE_SIZE - 1)];
+    
+    record->id = id;
+    record->timestamp = stats_timestamp();
+    record->arg = arg;
+    trace_ctx.head++;
+  }
+  
+  SREG = sreg;
+}
+
+static void trace_send(const t_trace_record* record)
+{
+  putchar(TRACE_SYNC);
+  putchar(record->id);
+  putchar(record->timestamp & 0xFF);
+  putchar(record->timestamp >> 8);
+  putchar(record->arg & 0xFF);
+  putchar(record->arg >> 8);
+}
+
+void trace_flush(void)
+{
+  t_trace_record record;
+  uint8_t lost;
+  
+  while(1)
+  {
+    /* Pop a record */
+    cli();
+    
+    if (trace_ctx.head == trace_ctx.tail)
+    {
+      lost = trace_ctx.lost;
+      trace_ctx.lost = 0;
+      sei();
+      break;
+    }
+    
+    record = *(t_trace_record*)&trace_ctx.records[trace_ctx.tail & (TRACE_SIZE - 1)];
+    trace_ctx.tail++;
+    
+    sei();
+    
+    /* Send it with the interrupts enabled */
+    trace_send(&record);
+  }
+  
+  if (lost)
+  {
+    record.id = TRACE_OVERFLOW;
+    record.timestamp = stats_timestamp();
+    record.arg = lost;
+    trace_send(&record);
+  }
+}
+
+#endif /* TRACE_ENABLE */
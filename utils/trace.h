@@ -0,0 +1,57 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_EVENT(name, message) TRACE_##name,
+enum {
+#include "trace_events.h"
+  TRACE_NB_EVENTS,
+};
+#undef TRACE_EVENT
+
+/* First byte of a record on the wire, outside of the ASCII range so that
+   the records can be told apart from the text output */
+#define TRACE_SYNC (0xA5)
+
+/* The traces are compiled in with TRACE_ENABLE set to 1. They are off by
+   default on the ATmega328P, where the ring does not fit in the SRAM left
+   by the applications, and the calls then compile to nothing */
+#if !defined(TRACE_ENABLE)
+#if defined(__AVR_ATmega328P__)
+#define TRACE_ENABLE 0
+#else
+#define TRACE_ENABLE 1
+#endif
+#endif
+
+#if (TRACE_ENABLE == 1)
+void trace(uint8_t id, uint16_t arg);
+void trace_flush(void);
+#else
+static inline void trace(uint8_t id, uint16_t arg) {}
+static inline void trace_flush(void) {}
+#endif
+
+#endif /* TRACE_H */
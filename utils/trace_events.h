@@ -0,0 +1,51 @@
+/*
+  Copyright 2011  Mathieu SONET (contact [at] elasticsheep [dot] com)
+
+  Permission to use, copy, modify, and distribute this software
+  and its documentation for any purpose and without fee is hereby
+  granted, provided that the above copyright notice appear in all
+  copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/* Trace events: TRACE_EVENT(name, message)
+ *
+ * The position in the list is the id sent on the wire. tools/trace.py reads
+ * this file to decode the records: {arg} is the 16-bit argument, {hi} and
+ * {lo} its two bytes. Only append new events, the ids of old logs depend on
+ * the order. */
+
+TRACE_EVENT(OVERFLOW,         "{arg} records lost")
+TRACE_EVENT(KEY,              "key event 0x{arg:02x}")
+TRACE_EVENT(STATE,            "state {hi} => {lo}")
+TRACE_EVENT(IDLE_KEY,         "idle key {arg}")
+TRACE_EVENT(RECORD_KEY,       "record key {arg}")
+TRACE_EVENT(PARTITION,        "switch to partition {arg}")
+TRACE_EVENT(PLAY,             "play partition {hi} slot {lo}")
+TRACE_EVENT(PLAY_RATE,        "sampling rate {arg}")
+TRACE_EVENT(PLAY_BLOCKS,      "content blocks {arg}")
+TRACE_EVENT(EMPTY_SLOT,       "empty slot")
+TRACE_EVENT(END_OF_PLAYBACK,  "end of playback")
+TRACE_EVENT(RECORD_START,     "start recording slot {arg}")
+TRACE_EVENT(RECORD_STOP,      "record stopped")
+TRACE_EVENT(RECORD_CANCEL,    "record cancelled")
+TRACE_EVENT(END_OF_RECORD,    "end of record")
+TRACE_EVENT(ADC_OVERRUN,      "ADC overrun")
+TRACE_EVENT(BUFFER_EVENT,     "buffer event 0x{arg:02x}")
+TRACE_EVENT(LISTEN,           "listening for a cry")
+TRACE_EVENT(CRY,              "cry detected")
+TRACE_EVENT(BAD_FORMAT,       "unsupported slot format, codec {hi} channels {lo}")
+TRACE_EVENT(CARD_FULL,        "no free blocks for slot {arg}")